@@ -0,0 +1,313 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "BlockCompression.h"
+#include "MappedFile.h"
+#include "MipChain.h"
+#include "TextureChain.h"
+
+/// <summary>
+/// First bytes of a baked texture, laid out like KTX's so a corrupted transfer shows: «GDTX 1»\r\n\x1A\n.
+/// </summary>
+const unsigned char kBakedTextureIdentifier[12] = { 0xAB, 'G', 'D', 'T', 'X', ' ', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+/// <summary>
+/// Written as a 32-bit number, so a file from a machine of the other byte order reads differently.
+/// </summary>
+const uint32_t kBakedTextureEndianness = 0x04030201;
+
+/// <summary>
+/// Alignment of every image in the file, as the mapping starts on a page.
+/// </summary>
+const size_t kBakedTextureAlignment = 16;
+
+/// <summary>
+/// The most levels a container may hold, enough for a side of 2^31.
+/// </summary>
+const uint32_t kMaxBakedTextureLevels = 32;
+
+// Flags of a container, which have to match the texture asking for it. The compression asked for
+// takes the bits from kBakedTextureCompressionShift on.
+const uint32_t kBakedTextureFlipped = 1;
+const uint32_t kBakedTextureGammaLevels = 2;
+const uint32_t kBakedTextureCompressionShift = 8;
+
+/// <summary>
+/// Where chains encoded at load are cached, as containers named after the hash of their files.
+/// </summary>
+const char* const kDefaultTextureCacheDirectory = "texture-cache";
+
+/// <summary>
+/// The start of a baked texture. A table of BakedTextureLevel follows, one per level, then the
+/// images: level by level, each face of a level in turn.
+/// </summary>
+struct BakedTextureHeader
+{
+    unsigned char identifier[12];
+    uint32_t endianness;
+
+    // As TextureChain has them: glFormat and glType are 0 for block-compressed data
+    uint32_t glInternalFormat;
+    uint32_t glFormat;
+    uint32_t glType;
+
+    // Of level 0; every level below is half the one above rounded down, a side of 1 staying 1
+    uint32_t width;
+    uint32_t height;
+    uint32_t faces;
+    uint32_t levels;
+    uint32_t flags;
+
+    // TextureChain's psnr in hundredths of a decibel
+    uint32_t psnrHundredths;
+
+    // SourceFilesStamp of the images it was baked from, low word first; 0 in the cache, whose names
+    // already hash the images' contents
+    uint32_t sourceStamp[2];
+    uint32_t reserved;
+};
+static_assert(sizeof(BakedTextureHeader) == 64, "The header is read straight from the file");
+
+/// <summary>
+/// Where a level's first face starts in the file and the bytes of each face. The faces of a level
+/// follow one another, each starting on kBakedTextureAlignment.
+/// </summary>
+struct BakedTextureLevel
+{
+    uint64_t offset;
+    uint64_t faceBytes;
+};
+static_assert(sizeof(BakedTextureLevel) == 16, "The level table is read straight from the file");
+
+inline uint64_t AlignBakedOffset(uint64_t offset)
+{
+    return (offset + kBakedTextureAlignment - 1) / kBakedTextureAlignment * kBakedTextureAlignment;
+}
+
+/// <summary>
+/// The container a texture is baked into: its first file's path with the extension swapped for .gdtx.
+/// A cube map's container holds all six faces and is named after the first.
+/// </summary>
+inline std::string BakedTexturePath(const std::string& sourcePath)
+{
+    size_t dot = sourcePath.find_last_of('.');
+    size_t slash = sourcePath.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    {
+        dot = sourcePath.size();
+    }
+    return sourcePath.substr(0, dot) + ".gdtx";
+}
+
+inline uint32_t BakedTextureFlags(bool flip, MipFilter mipFilter, TextureCompression compression)
+{
+    return (flip ? kBakedTextureFlipped : 0) | (mipFilter == MipFilter::Gamma ? kBakedTextureGammaLevels : 0)
+        | static_cast<uint32_t>(compression) << kBakedTextureCompressionShift;
+}
+
+/// <summary>
+/// Folds bytes into a 64-bit FNV-1a hash, starting from 14695981039346656037 for the first.
+/// </summary>
+inline uint64_t HashBytes(uint64_t hash, const unsigned char* bytes, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+/// <summary>
+/// The container caching the encoded chain of a texture, named after the hash of its files' contents,
+/// the flags it is built with and the encoder's version, so changing any of them misses the cache.
+/// </summary>
+inline std::string CachedTexturePath(const std::string& directory, const std::vector<std::vector<unsigned char>>& files, uint32_t flags)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (const std::vector<unsigned char>& file : files)
+    {
+        uint64_t size = file.size();
+        hash = HashBytes(hash, reinterpret_cast<const unsigned char*>(&size), sizeof(size));
+        hash = HashBytes(hash, file.data(), file.size());
+    }
+    const uint32_t parameters[2] = { flags, kBlockEncoderVersion };
+    hash = HashBytes(hash, reinterpret_cast<const unsigned char*>(parameters), sizeof(parameters));
+    char name[24];
+    std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+    return directory + "/" + name + ".gdtx";
+}
+
+/// <summary>
+/// Hashes the size and last write time of every file of a texture, which changes when any of them is
+/// edited, without reading them. Never 0, so a container from the cache is never taken for a baked one.
+/// </summary>
+/// <returns>0 if a file does not exist</returns>
+inline uint64_t SourceFilesStamp(const std::vector<std::string>& paths)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (const std::string& path : paths)
+    {
+        unsigned long long size;
+        long long modified;
+        if (!FileStamp(path, size, modified))
+        {
+            return 0;
+        }
+        hash = HashBytes(hash, reinterpret_cast<const unsigned char*>(&size), sizeof(size));
+        hash = HashBytes(hash, reinterpret_cast<const unsigned char*>(&modified), sizeof(modified));
+    }
+    return std::max<uint64_t>(hash, 1);
+}
+
+/// <summary>
+/// Reads a whole file.
+/// </summary>
+/// <returns>False if it could not be read</returns>
+inline bool ReadFileBytes(const std::string& path, std::vector<unsigned char>& bytes)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !file.bad();
+}
+
+/// <summary>
+/// Writes a chain as a container. It is written beside the path and renamed into place, so another
+/// run mapping the old one never sees it half written.
+/// </summary>
+/// <param name="flags">How the chain was built, from BakedTextureFlags</param>
+/// <param name="sourceStamp">SourceFilesStamp of the images the chain was built from, or 0 for the cache</param>
+/// <returns>False if the file could not be written</returns>
+inline bool WriteBakedTexture(const std::string& path, const TextureChain& chain, uint32_t flags, uint64_t sourceStamp)
+{
+    BakedTextureHeader header = {};
+    std::memcpy(header.identifier, kBakedTextureIdentifier, sizeof(header.identifier));
+    header.endianness = kBakedTextureEndianness;
+    header.glInternalFormat = chain.internalFormat;
+    header.glFormat = chain.format;
+    header.glType = chain.type;
+    header.width = static_cast<uint32_t>(ChainImage(chain, 0, 0).width);
+    header.height = static_cast<uint32_t>(ChainImage(chain, 0, 0).height);
+    header.faces = static_cast<uint32_t>(chain.faceCount);
+    header.levels = static_cast<uint32_t>(chain.levelCount);
+    header.flags = flags;
+    header.psnrHundredths = static_cast<uint32_t>(std::lround(chain.psnr * 100.0f));
+    header.sourceStamp[0] = static_cast<uint32_t>(sourceStamp);
+    header.sourceStamp[1] = static_cast<uint32_t>(sourceStamp >> 32);
+
+    std::vector<BakedTextureLevel> table(chain.levelCount);
+    uint64_t offset = AlignBakedOffset(sizeof(header) + table.size() * sizeof(BakedTextureLevel));
+    for (int level = 0; level < chain.levelCount; level++)
+    {
+        table[level].offset = offset;
+        table[level].faceBytes = ChainImage(chain, level, 0).size;
+        offset += chain.faceCount * AlignBakedOffset(table[level].faceBytes);
+    }
+
+    std::string writingPath = path + ".writing";
+    std::ofstream file(writingPath, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(BakedTextureLevel));
+    const char padding[kBakedTextureAlignment] = {};
+    uint64_t written = sizeof(header) + table.size() * sizeof(BakedTextureLevel);
+    for (const TextureImage& image : chain.images)
+    {
+        file.write(padding, static_cast<std::streamsize>(AlignBakedOffset(written) - written));
+        written = AlignBakedOffset(written);
+        file.write(reinterpret_cast<const char*>(image.data), static_cast<std::streamsize>(image.size));
+        written += image.size;
+    }
+    file.close();
+    if (!file)
+    {
+        std::remove(writingPath.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    // Renaming does not replace a file there
+    std::remove(path.c_str());
+#endif
+    return std::rename(writingPath.c_str(), path.c_str()) == 0;
+}
+
+/// <summary>
+/// Maps a container and points a chain's images into it, for them to be uploaded from the mapping.
+/// Every offset is checked against the file, so a truncated or foreign one is turned down rather than read past.
+/// </summary>
+/// <param name="flags">How the texture asking for it wants its chain built</param>
+/// <param name="faces">Faces the texture has</param>
+/// <param name="sourceStamp">SourceFilesStamp of the texture's images as they are now, or 0 for the cache</param>
+/// <param name="missing">Set if the file could not be opened, as opposed to not matching</param>
+/// <returns>False if the file is missing, malformed, baked for another texture or from images since edited</returns>
+inline bool OpenBakedTexture(const std::string& path, uint32_t flags, int faces, uint64_t sourceStamp, TextureChain& chain, bool& missing)
+{
+    MappedFile file;
+    missing = !MapFile(file, path);
+    if (missing)
+    {
+        return false;
+    }
+
+    BakedTextureHeader header;
+    bool valid = file.size >= sizeof(header);
+    if (valid)
+    {
+        std::memcpy(&header, file.data, sizeof(header));
+        valid = std::memcmp(header.identifier, kBakedTextureIdentifier, sizeof(header.identifier)) == 0
+            && header.endianness == kBakedTextureEndianness && header.flags == flags && header.faces == static_cast<uint32_t>(faces)
+            && header.sourceStamp[0] == static_cast<uint32_t>(sourceStamp) && header.sourceStamp[1] == static_cast<uint32_t>(sourceStamp >> 32)
+            && header.width > 0 && header.height > 0 && header.levels > 0 && header.levels <= kMaxBakedTextureLevels
+            && sizeof(header) + header.levels * sizeof(BakedTextureLevel) <= file.size
+            && (header.glFormat == 0 || (header.glFormat == GL_RGBA && header.glType == GL_UNSIGNED_BYTE));
+    }
+
+    TextureChain baked = {};
+    for (uint32_t level = 0; valid && level < header.levels; level++)
+    {
+        BakedTextureLevel entry;
+        std::memcpy(&entry, file.data + sizeof(header) + level * sizeof(BakedTextureLevel), sizeof(entry));
+        int width = std::max(1, static_cast<int>(header.width >> level));
+        int height = std::max(1, static_cast<int>(header.height >> level));
+        uint64_t stride = AlignBakedOffset(entry.faceBytes);
+        valid = entry.offset % kBakedTextureAlignment == 0 && entry.faceBytes > 0 && entry.faceBytes <= file.size
+            && entry.offset <= file.size && (header.faces - 1) * stride + entry.faceBytes <= file.size - entry.offset
+            && (header.glFormat == 0 || entry.faceBytes == static_cast<uint64_t>(width) * height * 4);
+        for (uint32_t face = 0; valid && face < header.faces; face++)
+        {
+            baked.images.push_back({ width, height, file.data + entry.offset + face * stride, static_cast<size_t>(entry.faceBytes) });
+        }
+    }
+    if (!valid)
+    {
+        UnmapFile(file);
+        return false;
+    }
+
+    baked.internalFormat = header.glInternalFormat;
+    baked.format = header.glFormat;
+    baked.type = header.glType;
+    baked.faceCount = faces;
+    baked.levelCount = static_cast<int>(header.levels);
+    baked.file = file;
+    baked.psnr = header.psnrHundredths / 100.0f;
+    chain = std::move(baked);
+    return true;
+}
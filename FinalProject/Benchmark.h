@@ -0,0 +1,423 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "CpuProfiler.h"
+#include "GpuProfiler.h"
+#include "RenderStats.h"
+#include "Simulation.h"
+
+/// <summary>
+/// Frames rendered before any are timed, so shader compiles and first uploads stay out of the report.
+/// </summary>
+const int kBenchmarkWarmupFrames = 30;
+
+/// <summary>
+/// Simulation steps every benchmark frame runs, whatever the time it took: the scene a frame shows
+/// only depends on its index, as if it ran at 60 frames a second.
+/// </summary>
+const int kBenchmarkStepsPerFrame = 2;
+
+/// <summary>
+/// Seed of the simulation's generator, so the benchmark's day colors are the same on every run.
+/// </summary>
+const uint32_t kBenchmarkSeed = 1;
+
+/// <summary>
+/// Samples of the offscreen target, the same as the window asks for.
+/// </summary>
+const int kBenchmarkSamples = 4;
+
+/// <summary>
+/// A color and depth target to render into when there is no visible window.
+/// </summary>
+struct OffscreenTarget
+{
+    GLuint framebuffer;
+    GLuint color;
+    GLuint depth;
+    int width;
+    int height;
+};
+
+inline OffscreenTarget CreateOffscreenTarget(int width, int height, int samples)
+{
+    OffscreenTarget target;
+    target.width = width;
+    target.height = height;
+
+    glGenRenderbuffers(1, &target.color);
+    glBindRenderbuffer(GL_RENDERBUFFER, target.color);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &target.depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, target.depth);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &target.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, target.depth);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return target;
+}
+
+inline void DeleteOffscreenTarget(OffscreenTarget& target)
+{
+    glDeleteFramebuffers(1, &target.framebuffer);
+    glDeleteRenderbuffers(1, &target.color);
+    glDeleteRenderbuffers(1, &target.depth);
+    target = {};
+}
+
+/// <summary>
+/// The direction the camera looks in for a yaw and pitch in degrees, as the mouse sets them.
+/// </summary>
+inline glm::vec3 CameraFrontFromAngles(float yaw, float pitch)
+{
+    glm::vec3 direction;
+    direction.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
+    direction.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
+    direction.y = sin(glm::radians(pitch));
+    return glm::normalize(direction);
+}
+
+/// <summary>
+/// A stretch of the scripted camera path: keys held and how far the mouse turns the camera each frame.
+/// </summary>
+struct CameraPathSegment
+{
+    int frames;
+    int cameraForward;
+    int cameraRight;
+    int faceForward;
+    int faceRight;
+    bool toggleNight;
+    float yawPerFrame;
+    float pitchPerFrame;
+};
+
+/// <summary>
+/// Looks around the room, walks up to the furniture, strafes past it, switches to day and walks back.
+/// The path repeats if the benchmark runs longer than it.
+/// </summary>
+inline std::vector<CameraPathSegment> DefaultCameraPath()
+{
+    return {
+        { 120, 0, 0, 0, 0, false, 0.5f, 0.0f },
+        { 240, 1, 0, 0, 0, false, -0.25f, 0.05f },
+        { 120, 0, 1, 1, 0, false, -0.5f, 0.0f },
+        { 1, 0, 0, 0, 0, true, 0.0f, 0.0f },
+        { 120, 0, -1, 0, 1, false, 0.75f, -0.05f },
+        { 240, -1, 0, -1, -1, false, -0.5f, 0.0f }
+    };
+}
+
+/// <summary>
+/// Where the camera path starts looking: the camera's starting direction, (0, -1, -2).
+/// </summary>
+inline void CameraPathStart(float& yaw, float& pitch)
+{
+    yaw = -90.0f;
+    pitch = glm::degrees(std::atan2(-1.0f, 2.0f));
+}
+
+/// <summary>
+/// State of the headless benchmark: where on the camera path it is and every frame timed so far.
+/// </summary>
+struct Benchmark
+{
+    bool running;
+    int frames;
+    int width;
+    int height;
+    std::string reportPath;
+
+    std::vector<CameraPathSegment> path;
+    int frame;
+    float yaw;
+    float pitch;
+
+    uint64_t frameStart;
+    std::vector<double> cpuMilliseconds;
+    std::vector<RenderStats> renderStats;
+
+    // How the textures were sampled and the GPU bytes they took, to tell runs with and without mipmaps apart
+    std::string textureSampling;
+    size_t textureBytes;
+
+    // Whether the textures were mapped from baked containers or decoded, how long they took from the
+    // first request, and the time from launch until the first timed frame could start
+    std::string textureSource;
+    double textureLoadMilliseconds;
+    double startupMilliseconds;
+
+    // The block formats the textures were stored in, the bytes they would take uncompressed, their lowest
+    // PSNR against the decoded images and how fast this run encoded them, 0 if it mapped them all
+    std::string textureCompression;
+    size_t textureUncompressedBytes;
+    double texturePsnr;
+    double textureEncodeMtexelsPerSecond;
+};
+
+/// <summary>
+/// A benchmark that is not running yet, with the default frame count, resolution and report file.
+/// </summary>
+inline Benchmark CreateBenchmark()
+{
+    Benchmark benchmark;
+    benchmark.running = false;
+    benchmark.frames = 600;
+    benchmark.width = 1280;
+    benchmark.height = 720;
+    benchmark.reportPath = "benchmark.json";
+    benchmark.path = DefaultCameraPath();
+    benchmark.frame = 0;
+    CameraPathStart(benchmark.yaw, benchmark.pitch);
+
+    benchmark.frameStart = 0;
+    benchmark.textureBytes = 0;
+    benchmark.textureLoadMilliseconds = 0.0;
+    benchmark.startupMilliseconds = 0.0;
+    benchmark.textureUncompressedBytes = 0;
+    benchmark.texturePsnr = 0.0;
+    benchmark.textureEncodeMtexelsPerSecond = 0.0;
+    return benchmark;
+}
+
+/// <summary>
+/// Follows the camera path by one frame: turns the camera and returns the keys held, in place of
+/// glfwGetKey and the mouse callback.
+/// </summary>
+/// <param name="frame">Index of the frame on the path, which repeats</param>
+/// <param name="yaw">The camera's yaw in degrees, turned by the frame</param>
+/// <param name="pitch">The camera's pitch in degrees, turned by the frame</param>
+/// <param name="cameraUp">The camera's up direction</param>
+/// <returns>Input for every simulation step of the frame</returns>
+inline SimulationInput FollowCameraPath(const std::vector<CameraPathSegment>& path, int frame, float& yaw, float& pitch,
+    const glm::vec3& cameraUp)
+{
+    int pathFrames = 0;
+    for (const CameraPathSegment& segment : path)
+    {
+        pathFrames += segment.frames;
+    }
+    frame %= pathFrames;
+    const CameraPathSegment* segment = &path.front();
+    for (const CameraPathSegment& candidate : path)
+    {
+        segment = &candidate;
+        if (frame < candidate.frames)
+        {
+            break;
+        }
+        frame -= candidate.frames;
+    }
+
+    yaw += segment->yawPerFrame;
+    pitch = glm::clamp(pitch + segment->pitchPerFrame, -89.0f, 89.0f);
+
+    SimulationInput input;
+    input.cameraForward = segment->cameraForward;
+    input.cameraRight = segment->cameraRight;
+    input.faceForward = segment->faceForward;
+    input.faceRight = segment->faceRight;
+    input.toggleNight = segment->toggleNight;
+    input.cameraFront = CameraFrontFromAngles(yaw, pitch);
+    input.cameraUp = cameraUp;
+    return input;
+}
+
+/// <summary>
+/// Starts a frame: takes the place of glfwGetKey and the mouse callback with the camera path.
+/// </summary>
+/// <param name="cameraUp">The camera's up direction</param>
+/// <returns>Input for every simulation step of the frame</returns>
+inline SimulationInput BeginBenchmarkFrame(Benchmark& benchmark, const glm::vec3& cameraUp)
+{
+    benchmark.frameStart = CpuTimestamp();
+    return FollowCameraPath(benchmark.path, benchmark.frame, benchmark.yaw, benchmark.pitch, cameraUp);
+}
+
+/// <summary>
+/// Records a frame once it has been submitted. The GPU times come from the profiler's trace.
+/// </summary>
+/// <param name="stats">What the renderer did in the frame</param>
+/// <returns>False once the last frame has been rendered</returns>
+inline bool EndBenchmarkFrame(Benchmark& benchmark, const RenderStats& stats)
+{
+    benchmark.frame++;
+    if (benchmark.frame > kBenchmarkWarmupFrames)
+    {
+        benchmark.cpuMilliseconds.push_back((CpuTimestamp() - benchmark.frameStart) / 1.0e6);
+        benchmark.renderStats.push_back(stats);
+    }
+    benchmark.running = benchmark.frame < kBenchmarkWarmupFrames + benchmark.frames;
+    return benchmark.running;
+}
+
+/// <summary>
+/// The most memory the process has had resident at once, in bytes.
+/// </summary>
+inline uint64_t PeakResidentBytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0;
+    }
+#ifdef __APPLE__
+    return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+/// <summary>
+/// Writes min/p50/p90/p99/max/avg of the samples as a JSON object.
+/// </summary>
+inline void WritePercentiles(std::ostream& file, std::vector<double> samples)
+{
+    if (samples.empty())
+    {
+        file << "null";
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](int p) {
+        return samples[(samples.size() * p + 99) / 100 - 1];
+    };
+    double total = 0.0;
+    for (double sample : samples)
+    {
+        total += sample;
+    }
+    file << "{\"min\":" << samples.front() << ",\"p50\":" << percentile(50) << ",\"p90\":" << percentile(90)
+        << ",\"p99\":" << percentile(99) << ",\"max\":" << samples.back() << ",\"avg\":" << total / samples.size() << "}";
+}
+
+/// <summary>
+/// Writes the report of a finished benchmark. The GPU profiler has to be flushed first,
+/// so the last frames' times are in its trace.
+/// </summary>
+/// <returns>False if the file could not be written</returns>
+inline bool WriteBenchmarkReport(const Benchmark& benchmark, const GpuProfiler& gpuProfiler)
+{
+    std::ofstream file(benchmark.reportPath);
+    if (!file)
+    {
+        return false;
+    }
+
+    // GPU times of every scope over the timed frames. The outermost scope is the whole frame and is
+    // traced before the scopes inside it, so it starts each frame's events.
+    std::vector<std::vector<double>> scopeMilliseconds(gpuProfiler.scopes.size());
+    std::vector<double> gpuMilliseconds;
+    int gpuFrame = 0;
+    for (const GpuTraceEvent& event : gpuProfiler.trace)
+    {
+        if (event.depth == 0)
+        {
+            gpuFrame++;
+        }
+        if (gpuFrame <= kBenchmarkWarmupFrames)
+        {
+            continue;
+        }
+        double milliseconds = (event.end - event.begin) / 1.0e6;
+        scopeMilliseconds[event.scope].push_back(milliseconds);
+        if (event.depth == 0)
+        {
+            gpuMilliseconds.push_back(milliseconds);
+        }
+    }
+
+    auto counter = [&benchmark](double (*read)(const RenderStats&)) {
+        std::vector<double> samples;
+        for (const RenderStats& stats : benchmark.renderStats)
+        {
+            samples.push_back(read(stats));
+        }
+        return samples;
+    };
+
+    file << std::fixed << std::setprecision(4) << "{\n";
+    file << "  \"renderer\": \"" << reinterpret_cast<const char*>(glGetString(GL_RENDERER)) << "\",\n";
+    file << "  \"version\": \"" << reinterpret_cast<const char*>(glGetString(GL_VERSION)) << "\",\n";
+    file << "  \"width\": " << benchmark.width << ",\n";
+    file << "  \"height\": " << benchmark.height << ",\n";
+    file << "  \"samples\": " << kBenchmarkSamples << ",\n";
+    file << "  \"textureSampling\": \"" << benchmark.textureSampling << "\",\n";
+    file << "  \"textureBytes\": " << benchmark.textureBytes << ",\n";
+    file << "  \"textureSource\": \"" << benchmark.textureSource << "\",\n";
+    file << "  \"textureLoadMs\": " << benchmark.textureLoadMilliseconds << ",\n";
+    file << "  \"startupMs\": " << benchmark.startupMilliseconds << ",\n";
+    file << "  \"textureCompression\": \"" << benchmark.textureCompression << "\",\n";
+    file << "  \"textureUncompressedBytes\": " << benchmark.textureUncompressedBytes << ",\n";
+    file << "  \"texturePsnr\": " << benchmark.texturePsnr << ",\n";
+    file << "  \"textureEncodeMtexelsPerSecond\": " << benchmark.textureEncodeMtexelsPerSecond << ",\n";
+    file << "  \"warmupFrames\": " << kBenchmarkWarmupFrames << ",\n";
+    file << "  \"frames\": " << benchmark.cpuMilliseconds.size() << ",\n";
+    file << "  \"gpuFrames\": " << gpuMilliseconds.size() << ",\n";
+    file << "  \"gpuFramesDropped\": " << gpuProfiler.droppedFrames << ",\n";
+    file << "  \"cpuFrameMs\": ";
+    WritePercentiles(file, benchmark.cpuMilliseconds);
+    file << ",\n  \"gpuFrameMs\": ";
+    WritePercentiles(file, gpuMilliseconds);
+    file << ",\n  \"gpuScopeMs\": {";
+    for (size_t i = 0; i < gpuProfiler.scopes.size(); i++)
+    {
+        file << (i == 0 ? "\n    \"" : ",\n    \"") << gpuProfiler.scopes[i].name << "\": ";
+        WritePercentiles(file, scopeMilliseconds[i]);
+    }
+    file << "\n  },\n  \"drawCalls\": ";
+    WritePercentiles(file, counter([](const RenderStats& stats) { return static_cast<double>(stats.drawCalls); }));
+    file << ",\n  \"triangles\": ";
+    WritePercentiles(file, counter([](const RenderStats& stats) { return static_cast<double>(stats.triangles); }));
+    file << ",\n  \"programChanges\": ";
+    WritePercentiles(file, counter([](const RenderStats& stats) { return static_cast<double>(stats.programChanges); }));
+    file << ",\n  \"textureBinds\": ";
+    WritePercentiles(file, counter([](const RenderStats& stats) { return static_cast<double>(stats.textureBinds); }));
+    file << ",\n  \"uniformUploads\": ";
+    WritePercentiles(file, counter([](const RenderStats& stats) { return static_cast<double>(stats.uniformUploads); }));
+    file << ",\n  \"bufferBytes\": ";
+    WritePercentiles(file, counter([](const RenderStats& stats) { return static_cast<double>(stats.bufferBytes); }));
+    file << ",\n  \"submittedStateChanges\": ";
+    WritePercentiles(file, counter([](const RenderStats& stats) { return static_cast<double>(stats.submittedStateChanges); }));
+    file << ",\n  \"sortedStateChanges\": ";
+    WritePercentiles(file, counter([](const RenderStats& stats) { return static_cast<double>(stats.sortedStateChanges); }));
+    file << ",\n  \"glCalls\": ";
+    WritePercentiles(file, counter([](const RenderStats& stats) { return static_cast<double>(stats.glCallsIssued); }));
+    file << ",\n  \"glCallsElided\": ";
+    WritePercentiles(file, counter([](const RenderStats& stats) { return static_cast<double>(stats.glCallsElided); }));
+    file << ",\n  \"peakResidentBytes\": " << PeakResidentBytes() << "\n}\n";
+    return static_cast<bool>(file);
+}
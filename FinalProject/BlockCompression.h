@@ -0,0 +1,724 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BLOCK_COMPRESSION_SSE2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define BLOCK_COMPRESSION_NEON 1
+#endif
+
+// S3TC is an extension on every GL version, under the same values everywhere
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+/// <summary>
+/// Changes whenever the encoder's output does, so blocks cached by an older one are encoded again.
+/// </summary>
+const uint32_t kBlockEncoderVersion = 1;
+
+/// <summary>
+/// Least-squares passes over the endpoints of a colour block after the first fit along its principal axis.
+/// </summary>
+const int kColorRefinements = 2;
+
+/// <summary>
+/// What a texture's data is, which decides the block format it is compressed to.
+/// </summary>
+enum class TextureCompression
+{
+    // Uploaded as it is
+    None,
+
+    // RGB, with alpha if any texel is not opaque: BC1, or BC3 with alpha
+    Color,
+
+    // A single channel, such as a height or roughness map: BC4
+    Red,
+
+    // Two channels, such as the X and Y of a normal map: BC5
+    RedGreen
+};
+
+enum class BlockFormat
+{
+    BC1,
+    BC3,
+    BC4,
+    BC5
+};
+
+inline size_t BlockBytes(BlockFormat format)
+{
+    return format == BlockFormat::BC1 || format == BlockFormat::BC4 ? 8 : 16;
+}
+
+/// <summary>
+/// Channels of the source a format keeps, the ones its error is measured over.
+/// </summary>
+inline int BlockChannels(BlockFormat format)
+{
+    switch (format)
+    {
+    case BlockFormat::BC1:
+        return 3;
+    case BlockFormat::BC3:
+        return 4;
+    case BlockFormat::BC4:
+        return 1;
+    default:
+        return 2;
+    }
+}
+
+inline GLenum BlockInternalFormat(BlockFormat format)
+{
+    switch (format)
+    {
+    case BlockFormat::BC1:
+        return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case BlockFormat::BC3:
+        return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case BlockFormat::BC4:
+        return GL_COMPRESSED_RED_RGTC1;
+    default:
+        return GL_COMPRESSED_RG_RGTC2;
+    }
+}
+
+/// <summary>
+/// Name of a block-compressed internal format for reports, or an empty string for any other.
+/// </summary>
+inline std::string BlockFormatName(GLenum internalFormat)
+{
+    switch (internalFormat)
+    {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        return "BC1";
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        return "BC3";
+    case GL_COMPRESSED_RED_RGTC1:
+        return "BC4";
+    case GL_COMPRESSED_RG_RGTC2:
+        return "BC5";
+    default:
+        return std::string();
+    }
+}
+
+/// <summary>
+/// The format a texture's data compresses to.
+/// </summary>
+/// <param name="opaque">Whether every texel's alpha is 255, for colour data</param>
+inline BlockFormat ChooseBlockFormat(TextureCompression compression, bool opaque)
+{
+    switch (compression)
+    {
+    case TextureCompression::Red:
+        return BlockFormat::BC4;
+    case TextureCompression::RedGreen:
+        return BlockFormat::BC5;
+    default:
+        return opaque ? BlockFormat::BC1 : BlockFormat::BC3;
+    }
+}
+
+/// <summary>
+/// Whether the context samples the formats a compression asks for. BC1 and BC3 need S3TC, which
+/// Mesa's drivers, the software ones included, expose. BC4 and BC5 need RGTC, core since GL 3.0
+/// and otherwise an extension.
+/// </summary>
+inline bool BlockCompressionSupported(TextureCompression compression)
+{
+    bool rgtc = compression == TextureCompression::Red || compression == TextureCompression::RedGreen;
+    GLint majorVersion = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &majorVersion);
+    if (rgtc && majorVersion >= 3)
+    {
+        return true;
+    }
+    GLint extensionCount = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+    for (GLint i = 0; i < extensionCount; i++)
+    {
+        std::string extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+        if (rgtc ? extension == "GL_ARB_texture_compression_rgtc" || extension == "GL_EXT_texture_compression_rgtc"
+                 : extension == "GL_EXT_texture_compression_s3tc")
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// <summary>
+/// Number of 4x4 blocks along a side, the last one padded.
+/// </summary>
+inline int BlockCount(int size)
+{
+    return (size + 3) / 4;
+}
+
+inline size_t BlockImageBytes(int width, int height, BlockFormat format)
+{
+    return static_cast<size_t>(BlockCount(width)) * BlockCount(height) * BlockBytes(format);
+}
+
+/// <summary>
+/// Picks the nearest of four colours for each of 16 pixels, given as separate channels.
+/// </summary>
+/// <param name="palette">Red, green and blue of each colour</param>
+/// <param name="error">Set to the summed squared distance of every pixel to its colour</param>
+/// <returns>The 2-bit index of each pixel, the first pixel in the lowest bits</returns>
+inline uint32_t SelectColorIndices(const float* red, const float* green, const float* blue, const float palette[4][3], float& error)
+{
+    uint32_t indices = 0;
+    error = 0.0f;
+    int i = 0;
+#if BLOCK_COMPRESSION_SSE2
+    // Four pixels at a time against every colour, keeping the nearest so far
+    __m128 sum = _mm_setzero_ps();
+    for (; i < 16; i += 4)
+    {
+        __m128 r = _mm_loadu_ps(red + i);
+        __m128 g = _mm_loadu_ps(green + i);
+        __m128 b = _mm_loadu_ps(blue + i);
+        __m128 best = _mm_set1_ps(3.0e38f);
+        __m128i bestIndex = _mm_setzero_si128();
+        for (int k = 0; k < 4; k++)
+        {
+            __m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[k][0]));
+            __m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[k][1]));
+            __m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[k][2]));
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+            best = _mm_min_ps(distance, best);
+            bestIndex = _mm_or_si128(_mm_andnot_si128(closer, bestIndex), _mm_and_si128(closer, _mm_set1_epi32(k)));
+        }
+        sum = _mm_add_ps(sum, best);
+        alignas(16) int32_t lanes[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes), bestIndex);
+        indices |= static_cast<uint32_t>(lanes[0] | lanes[1] << 2 | lanes[2] << 4 | lanes[3] << 6) << (i * 2);
+    }
+    alignas(16) float sums[4];
+    _mm_store_ps(sums, sum);
+    error = sums[0] + sums[1] + sums[2] + sums[3];
+#elif BLOCK_COMPRESSION_NEON
+    // Four pixels at a time against every colour, keeping the nearest so far
+    float32x4_t sum = vdupq_n_f32(0.0f);
+    for (; i < 16; i += 4)
+    {
+        float32x4_t r = vld1q_f32(red + i);
+        float32x4_t g = vld1q_f32(green + i);
+        float32x4_t b = vld1q_f32(blue + i);
+        float32x4_t best = vdupq_n_f32(3.0e38f);
+        uint32x4_t bestIndex = vdupq_n_u32(0);
+        for (int k = 0; k < 4; k++)
+        {
+            float32x4_t dr = vsubq_f32(r, vdupq_n_f32(palette[k][0]));
+            float32x4_t dg = vsubq_f32(g, vdupq_n_f32(palette[k][1]));
+            float32x4_t db = vsubq_f32(b, vdupq_n_f32(palette[k][2]));
+            float32x4_t distance = vmlaq_f32(vmlaq_f32(vmulq_f32(dr, dr), dg, dg), db, db);
+            uint32x4_t closer = vcltq_f32(distance, best);
+            best = vminq_f32(distance, best);
+            bestIndex = vbslq_u32(closer, vdupq_n_u32(static_cast<uint32_t>(k)), bestIndex);
+        }
+        sum = vaddq_f32(sum, best);
+        uint32_t lanes[4];
+        vst1q_u32(lanes, bestIndex);
+        indices |= (lanes[0] | lanes[1] << 2 | lanes[2] << 4 | lanes[3] << 6) << (i * 2);
+    }
+    float sums[4];
+    vst1q_f32(sums, sum);
+    error = sums[0] + sums[1] + sums[2] + sums[3];
+#endif
+    for (; i < 16; i++)
+    {
+        float best = 3.0e38f;
+        uint32_t bestIndex = 0;
+        for (int k = 0; k < 4; k++)
+        {
+            float dr = red[i] - palette[k][0];
+            float dg = green[i] - palette[k][1];
+            float db = blue[i] - palette[k][2];
+            float distance = dr * dr + dg * dg + db * db;
+            if (distance < best)
+            {
+                best = distance;
+                bestIndex = static_cast<uint32_t>(k);
+            }
+        }
+        error += best;
+        indices |= bestIndex << (i * 2);
+    }
+    return indices;
+}
+
+/// <summary>
+/// Picks the nearest of eight values for each of 16 pixels of a single channel.
+/// </summary>
+/// <returns>The 3-bit index of each pixel, the first pixel in the lowest bits</returns>
+inline uint64_t SelectValueIndices(const float* values, const float palette[8])
+{
+    uint64_t indices = 0;
+    int i = 0;
+#if BLOCK_COMPRESSION_SSE2
+    for (; i < 16; i += 4)
+    {
+        __m128 v = _mm_loadu_ps(values + i);
+        __m128 best = _mm_set1_ps(3.0e38f);
+        __m128i bestIndex = _mm_setzero_si128();
+        for (int k = 0; k < 8; k++)
+        {
+            __m128 d = _mm_sub_ps(v, _mm_set1_ps(palette[k]));
+            __m128 distance = _mm_mul_ps(d, d);
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+            best = _mm_min_ps(distance, best);
+            bestIndex = _mm_or_si128(_mm_andnot_si128(closer, bestIndex), _mm_and_si128(closer, _mm_set1_epi32(k)));
+        }
+        alignas(16) int32_t lanes[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes), bestIndex);
+        indices |= static_cast<uint64_t>(lanes[0] | lanes[1] << 3 | lanes[2] << 6 | lanes[3] << 9) << (i * 3);
+    }
+#elif BLOCK_COMPRESSION_NEON
+    for (; i < 16; i += 4)
+    {
+        float32x4_t v = vld1q_f32(values + i);
+        float32x4_t best = vdupq_n_f32(3.0e38f);
+        uint32x4_t bestIndex = vdupq_n_u32(0);
+        for (int k = 0; k < 8; k++)
+        {
+            float32x4_t d = vsubq_f32(v, vdupq_n_f32(palette[k]));
+            float32x4_t distance = vmulq_f32(d, d);
+            uint32x4_t closer = vcltq_f32(distance, best);
+            best = vminq_f32(distance, best);
+            bestIndex = vbslq_u32(closer, vdupq_n_u32(static_cast<uint32_t>(k)), bestIndex);
+        }
+        uint32_t lanes[4];
+        vst1q_u32(lanes, bestIndex);
+        indices |= static_cast<uint64_t>(lanes[0] | lanes[1] << 3 | lanes[2] << 6 | lanes[3] << 9) << (i * 3);
+    }
+#endif
+    for (; i < 16; i++)
+    {
+        float best = 3.0e38f;
+        uint64_t bestIndex = 0;
+        for (int k = 0; k < 8; k++)
+        {
+            float distance = (values[i] - palette[k]) * (values[i] - palette[k]);
+            if (distance < best)
+            {
+                best = distance;
+                bestIndex = static_cast<uint64_t>(k);
+            }
+        }
+        indices |= bestIndex << (i * 3);
+    }
+    return indices;
+}
+
+/// <summary>
+/// Rounds a colour to 5:6:5 bits.
+/// </summary>
+inline uint16_t QuantizeColor565(float red, float green, float blue)
+{
+    int r = static_cast<int>(std::lround(std::min(std::max(red, 0.0f), 255.0f) * 31.0f / 255.0f));
+    int g = static_cast<int>(std::lround(std::min(std::max(green, 0.0f), 255.0f) * 63.0f / 255.0f));
+    int b = static_cast<int>(std::lround(std::min(std::max(blue, 0.0f), 255.0f) * 31.0f / 255.0f));
+    return static_cast<uint16_t>(r << 11 | g << 5 | b);
+}
+
+/// <summary>
+/// The four colours of a BC1 block with the provided endpoints, as a decoder sees them in four-colour mode.
+/// </summary>
+inline void ColorPalette(uint16_t color0, uint16_t color1, int palette[4][3])
+{
+    const uint16_t endpoints[2] = { color0, color1 };
+    for (int e = 0; e < 2; e++)
+    {
+        int r = endpoints[e] >> 11 & 31;
+        int g = endpoints[e] >> 5 & 63;
+        int b = endpoints[e] & 31;
+        palette[e][0] = r << 3 | r >> 2;
+        palette[e][1] = g << 2 | g >> 4;
+        palette[e][2] = b << 3 | b >> 2;
+    }
+    for (int c = 0; c < 3; c++)
+    {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+}
+
+/// <summary>
+/// Indices of the pixels for the provided endpoints, and their error.
+/// </summary>
+inline uint32_t FitColorIndices(const float* red, const float* green, const float* blue, uint16_t color0, uint16_t color1, float& error)
+{
+    int palette[4][3];
+    ColorPalette(color0, color1, palette);
+    float paletteFloat[4][3];
+    for (int k = 0; k < 4; k++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            paletteFloat[k][c] = static_cast<float>(palette[k][c]);
+        }
+    }
+    return SelectColorIndices(red, green, blue, paletteFloat, error);
+}
+
+/// <summary>
+/// Encodes the colour of a 4x4 block of RGBA8 pixels as a BC1 block in four-colour mode. The
+/// endpoints start as the pixels furthest apart along the block's principal axis and are then fit
+/// by least squares to the indices they gave, as long as that lowers the error.
+/// </summary>
+inline void EncodeColorBlock(const unsigned char* pixels, unsigned char* out)
+{
+    float red[16];
+    float green[16];
+    float blue[16];
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; i++)
+    {
+        red[i] = pixels[i * 4];
+        green[i] = pixels[i * 4 + 1];
+        blue[i] = pixels[i * 4 + 2];
+        mean[0] += red[i];
+        mean[1] += green[i];
+        mean[2] += blue[i];
+    }
+    for (float& m : mean)
+    {
+        m /= 16.0f;
+    }
+
+    // Principal axis of the colours by power iteration on their covariance, from the diagonal of their bounds
+    float covariance[6] = {};
+    float low[3] = { 255.0f, 255.0f, 255.0f };
+    float high[3] = { 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; i++)
+    {
+        float r = red[i] - mean[0];
+        float g = green[i] - mean[1];
+        float b = blue[i] - mean[2];
+        covariance[0] += r * r;
+        covariance[1] += r * g;
+        covariance[2] += r * b;
+        covariance[3] += g * g;
+        covariance[4] += g * b;
+        covariance[5] += b * b;
+        low[0] = std::min(low[0], red[i]);
+        low[1] = std::min(low[1], green[i]);
+        low[2] = std::min(low[2], blue[i]);
+        high[0] = std::max(high[0], red[i]);
+        high[1] = std::max(high[1], green[i]);
+        high[2] = std::max(high[2], blue[i]);
+    }
+    float axis[3] = { high[0] - low[0], high[1] - low[1], high[2] - low[2] };
+    for (int iteration = 0; iteration < 4; iteration++)
+    {
+        float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+        float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+        float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+        float largest = std::max(std::fabs(x), std::max(std::fabs(y), std::fabs(z)));
+        if (largest < 1.0e-6f)
+        {
+            break;
+        }
+        axis[0] = x / largest;
+        axis[1] = y / largest;
+        axis[2] = z / largest;
+    }
+
+    int lowest = 0;
+    int highest = 0;
+    float lowestDot = 3.0e38f;
+    float highestDot = -3.0e38f;
+    for (int i = 0; i < 16; i++)
+    {
+        float dot = red[i] * axis[0] + green[i] * axis[1] + blue[i] * axis[2];
+        if (dot < lowestDot)
+        {
+            lowestDot = dot;
+            lowest = i;
+        }
+        if (dot > highestDot)
+        {
+            highestDot = dot;
+            highest = i;
+        }
+    }
+    uint16_t color0 = QuantizeColor565(red[highest], green[highest], blue[highest]);
+    uint16_t color1 = QuantizeColor565(red[lowest], green[lowest], blue[lowest]);
+    float error;
+    uint32_t indices = FitColorIndices(red, green, blue, color0, color1, error);
+
+    // Index k puts a pixel this far along from colour 0 to colour 1
+    const float weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+    for (int refinement = 0; refinement < kColorRefinements && error > 0.0f; refinement++)
+    {
+        float aa = 0.0f;
+        float bb = 0.0f;
+        float ab = 0.0f;
+        float ax[3] = {};
+        float bx[3] = {};
+        for (int i = 0; i < 16; i++)
+        {
+            float t = weights[indices >> (i * 2) & 3];
+            float s = 1.0f - t;
+            aa += s * s;
+            bb += t * t;
+            ab += s * t;
+            ax[0] += s * red[i];
+            ax[1] += s * green[i];
+            ax[2] += s * blue[i];
+            bx[0] += t * red[i];
+            bx[1] += t * green[i];
+            bx[2] += t * blue[i];
+        }
+        float determinant = aa * bb - ab * ab;
+        if (std::fabs(determinant) < 1.0e-6f)
+        {
+            break;
+        }
+        float end0[3];
+        float end1[3];
+        for (int c = 0; c < 3; c++)
+        {
+            end0[c] = (bb * ax[c] - ab * bx[c]) / determinant;
+            end1[c] = (aa * bx[c] - ab * ax[c]) / determinant;
+        }
+        uint16_t refined0 = QuantizeColor565(end0[0], end0[1], end0[2]);
+        uint16_t refined1 = QuantizeColor565(end1[0], end1[1], end1[2]);
+        float refinedError;
+        uint32_t refinedIndices = FitColorIndices(red, green, blue, refined0, refined1, refinedError);
+        if (refinedError >= error)
+        {
+            break;
+        }
+        color0 = refined0;
+        color1 = refined1;
+        indices = refinedIndices;
+        error = refinedError;
+    }
+
+    // Four-colour mode needs colour 0 above colour 1: swapping them swaps indices 0 with 1 and 2 with 3.
+    // Equal endpoints would mean three-colour mode, where index 3 is transparent, so every pixel takes 0.
+    if (color0 < color1)
+    {
+        std::swap(color0, color1);
+        indices ^= 0x55555555u;
+    }
+    else if (color0 == color1)
+    {
+        indices = 0;
+    }
+    out[0] = static_cast<unsigned char>(color0 & 0xFF);
+    out[1] = static_cast<unsigned char>(color0 >> 8);
+    out[2] = static_cast<unsigned char>(color1 & 0xFF);
+    out[3] = static_cast<unsigned char>(color1 >> 8);
+    for (int i = 0; i < 4; i++)
+    {
+        out[4 + i] = static_cast<unsigned char>(indices >> (i * 8));
+    }
+}
+
+/// <summary>
+/// The eight values of a BC4 block whose first endpoint is above its second, as a decoder sees them.
+/// </summary>
+inline void ValuePalette(int value0, int value1, int palette[8])
+{
+    palette[0] = value0;
+    palette[1] = value1;
+    for (int k = 2; k < 8; k++)
+    {
+        palette[k] = ((8 - k) * value0 + (k - 1) * value1 + 3) / 7;
+    }
+}
+
+/// <summary>
+/// Encodes one channel of a 4x4 block as a BC4 block, the layout of BC3's alpha and of each half of BC5.
+/// </summary>
+/// <param name="pixels">RGBA8 pixels of the block</param>
+/// <param name="channel">Which of the four channels</param>
+inline void EncodeValueBlock(const unsigned char* pixels, int channel, unsigned char* out)
+{
+    float values[16];
+    int low = 255;
+    int high = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        int value = pixels[i * 4 + channel];
+        values[i] = static_cast<float>(value);
+        low = std::min(low, value);
+        high = std::max(high, value);
+    }
+    out[0] = static_cast<unsigned char>(high);
+    out[1] = static_cast<unsigned char>(low);
+    uint64_t indices = 0;
+    if (high != low)
+    {
+        int palette[8];
+        ValuePalette(high, low, palette);
+        float paletteFloat[8];
+        for (int k = 0; k < 8; k++)
+        {
+            paletteFloat[k] = static_cast<float>(palette[k]);
+        }
+        indices = SelectValueIndices(values, paletteFloat);
+    }
+    for (int i = 0; i < 6; i++)
+    {
+        out[2 + i] = static_cast<unsigned char>(indices >> (i * 8));
+    }
+}
+
+/// <summary>
+/// Encodes a 4x4 block of RGBA8 pixels in the provided format.
+/// </summary>
+inline void EncodeBlock(const unsigned char* pixels, BlockFormat format, unsigned char* out)
+{
+    switch (format)
+    {
+    case BlockFormat::BC1:
+        EncodeColorBlock(pixels, out);
+        break;
+    case BlockFormat::BC3:
+        EncodeValueBlock(pixels, 3, out);
+        EncodeColorBlock(pixels, out + 8);
+        break;
+    case BlockFormat::BC4:
+        EncodeValueBlock(pixels, 0, out);
+        break;
+    case BlockFormat::BC5:
+        EncodeValueBlock(pixels, 0, out);
+        EncodeValueBlock(pixels, 1, out + 8);
+        break;
+    }
+}
+
+inline void DecodeColorBlock(const unsigned char* block, unsigned char* pixels)
+{
+    int palette[4][3];
+    ColorPalette(static_cast<uint16_t>(block[0] | block[1] << 8), static_cast<uint16_t>(block[2] | block[3] << 8), palette);
+    uint32_t indices = static_cast<uint32_t>(block[4] | block[5] << 8 | block[6] << 16) | static_cast<uint32_t>(block[7]) << 24;
+    for (int i = 0; i < 16; i++)
+    {
+        const int* color = palette[indices >> (i * 2) & 3];
+        pixels[i * 4] = static_cast<unsigned char>(color[0]);
+        pixels[i * 4 + 1] = static_cast<unsigned char>(color[1]);
+        pixels[i * 4 + 2] = static_cast<unsigned char>(color[2]);
+    }
+}
+
+inline void DecodeValueBlock(const unsigned char* block, int channel, unsigned char* pixels)
+{
+    int palette[8];
+    ValuePalette(block[0], block[1], palette);
+    uint64_t indices = 0;
+    for (int i = 0; i < 6; i++)
+    {
+        indices |= static_cast<uint64_t>(block[2 + i]) << (i * 8);
+    }
+    for (int i = 0; i < 16; i++)
+    {
+        pixels[i * 4 + channel] = static_cast<unsigned char>(palette[indices >> (i * 3) & 7]);
+    }
+}
+
+/// <summary>
+/// Decodes a block as a GPU would, into the channels its format keeps.
+/// </summary>
+inline void DecodeBlock(const unsigned char* block, BlockFormat format, unsigned char* pixels)
+{
+    switch (format)
+    {
+    case BlockFormat::BC1:
+        DecodeColorBlock(block, pixels);
+        break;
+    case BlockFormat::BC3:
+        DecodeValueBlock(block, 3, pixels);
+        DecodeColorBlock(block + 8, pixels);
+        break;
+    case BlockFormat::BC4:
+        DecodeValueBlock(block, 0, pixels);
+        break;
+    case BlockFormat::BC5:
+        DecodeValueBlock(block, 0, pixels);
+        DecodeValueBlock(block + 8, 1, pixels);
+        break;
+    }
+}
+
+/// <summary>
+/// Encodes rows of blocks of an RGBA8 image, repeating its last row and column to fill the blocks
+/// they run over, and decodes every block again to measure its error against the source.
+/// </summary>
+/// <param name="out">Blocks of the whole image, row by row</param>
+/// <returns>Summed squared error over the image's pixels and the channels the format keeps</returns>
+inline uint64_t EncodeBlockRows(const unsigned char* pixels, int width, int height, BlockFormat format, int firstRow, int rowCount,
+    unsigned char* out)
+{
+    int blocksWide = BlockCount(width);
+    size_t blockBytes = BlockBytes(format);
+    int channels = BlockChannels(format);
+    uint64_t squaredError = 0;
+    unsigned char block[64];
+    unsigned char decoded[64];
+    for (int by = firstRow; by < firstRow + rowCount; by++)
+    {
+        for (int bx = 0; bx < blocksWide; bx++)
+        {
+            for (int y = 0; y < 4; y++)
+            {
+                const unsigned char* row = pixels + static_cast<size_t>(std::min(by * 4 + y, height - 1)) * width * 4;
+                for (int x = 0; x < 4; x++)
+                {
+                    std::memcpy(block + (y * 4 + x) * 4, row + std::min(bx * 4 + x, width - 1) * 4, 4);
+                }
+            }
+            unsigned char* encoded = out + (static_cast<size_t>(by) * blocksWide + bx) * blockBytes;
+            EncodeBlock(block, format, encoded);
+            DecodeBlock(encoded, format, decoded);
+            for (int y = 0; y < 4 && by * 4 + y < height; y++)
+            {
+                for (int x = 0; x < 4 && bx * 4 + x < width; x++)
+                {
+                    for (int c = 0; c < channels; c++)
+                    {
+                        // BC4 and BC5 keep red and green, the others every channel in turn
+                        int difference = block[(y * 4 + x) * 4 + c] - decoded[(y * 4 + x) * 4 + c];
+                        squaredError += static_cast<uint64_t>(difference * difference);
+                    }
+                }
+            }
+        }
+    }
+    return squaredError;
+}
+
+/// <summary>
+/// Peak signal-to-noise ratio of 8-bit samples in decibels, capped at 99 for an exact copy.
+/// </summary>
+inline double PeakSignalToNoise(uint64_t squaredError, uint64_t samples)
+{
+    if (squaredError == 0 || samples == 0)
+    {
+        return 99.0;
+    }
+    double meanSquaredError = static_cast<double>(squaredError) / samples;
+    return std::min(99.0, 10.0 * std::log10(255.0 * 255.0 / meanSquaredError));
+}
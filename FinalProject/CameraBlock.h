@@ -0,0 +1,73 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "CascadedShadows.h"
+#include "RenderStats.h"
+
+/// <summary>
+/// Uniform buffer binding point of the Camera block declared in camera.glsl.
+/// </summary>
+const GLuint kCameraBlockBinding = 0;
+
+/// <summary>
+/// CPU-side mirror of the std140 Camera block in camera.glsl.
+/// Every member is a mat4 or vec4, so the C++ layout already matches std140
+/// without any manual padding.
+/// </summary>
+struct CameraBlock
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 skyboxView;
+    glm::mat4 lightSpace[kMaxCascades];
+    glm::vec4 cascadeSplits;
+    glm::vec4 cascadeDepthScale;
+    glm::vec4 cameraPos;
+};
+
+static_assert(sizeof(CameraBlock) == (3 + kMaxCascades) * 64 + 3 * 16, "CameraBlock must match the std140 layout of camera.glsl");
+
+/// <summary>
+/// Creates the uniform buffer that backs the Camera block and attaches it to its binding point.
+/// </summary>
+/// <returns>OpenGL handle to the created buffer</returns>
+inline GLuint CreateCameraBuffer()
+{
+    GLuint ubo;
+    glGenBuffers(1, &ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBlock), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, kCameraBlockBinding, ubo);
+    return ubo;
+}
+
+/// <summary>
+/// Points the Camera block of a program at the shared binding point.
+/// Programs that do not declare the block are left untouched.
+/// </summary>
+/// <param name="program">Linked shader program handle</param>
+inline void BindCameraBlock(GLuint program)
+{
+    GLuint blockIndex = glGetUniformBlockIndex(program, "Camera");
+    if (blockIndex != GL_INVALID_INDEX)
+    {
+        glUniformBlockBinding(program, blockIndex, kCameraBlockBinding);
+    }
+}
+
+/// <summary>
+/// Uploads this frame's camera data with a single buffer update.
+/// </summary>
+/// <param name="ubo">Buffer created by CreateCameraBuffer</param>
+/// <param name="camera">Camera data for the frame</param>
+inline void UpdateCameraBuffer(GLuint ubo, const CameraBlock& camera)
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CameraBlock), &camera);
+    CountBufferUpload(sizeof(CameraBlock));
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
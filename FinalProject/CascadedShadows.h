@@ -0,0 +1,438 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <ostream>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+/// <summary>
+/// Most cascades the shaders can hold. Must match kMaxCascades in camera.glsl,
+/// and depth.gsh emits 3 * kMaxCascades vertices at most.
+/// </summary>
+const int kMaxCascades = 4;
+
+/// <summary>
+/// Blend between logarithmic (1) and uniform (0) split distances.
+/// </summary>
+const float kCascadeSplitLambda = 0.75f;
+
+/// <summary>
+/// How far behind each cascade's bounding sphere, towards the light, casters are still captured.
+/// </summary>
+const float kShadowCasterMargin = 10.0f;
+
+/// <summary>
+/// Static casters below which redrawing them every frame costs less than compositing their cached
+/// depth into every cascade: the composite touches each layer's texels under them whatever their count.
+/// </summary>
+const int kDefaultStaticCacheCasters = 64;
+
+/// <summary>
+/// Frames a timer query waits before its result is read, so it is usually available by then.
+/// </summary>
+const int kShadowTimerLatency = 3;
+
+/// <summary>
+/// Frames the shadow pass timings are averaged over before they are printed.
+/// </summary>
+const int kShadowTimerReportFrames = 120;
+
+/// <summary>
+/// How the directional light's shadow is split up, set from the command line.
+/// </summary>
+struct CascadeSettings
+{
+    int count;
+    int resolution;
+
+    // View distance the last cascade ends at; nothing further away is shadowed
+    float shadowDistance;
+
+    // Times the static composite and the casters of every cascade on their own, drawing the casters
+    // one cascade at a time instead of all of them in one layered pass
+    bool timePerCascade;
+
+    // Static casters there have to be before their depth is cached and composited into the cascades
+    // rather than drawn along with the moving ones every frame
+    int staticCacheCasters;
+};
+
+inline CascadeSettings DefaultCascadeSettings()
+{
+    return { 3, 1024, 20.0f, false, kDefaultStaticCacheCasters };
+}
+
+/// <summary>
+/// A layered depth texture with one layer per cascade. The layered framebuffer is rendered into
+/// through depth.gsh; the per-layer framebuffers only exist to write single layers.
+/// </summary>
+struct ShadowMap
+{
+    GLuint texture;
+    GLuint framebuffer;
+    GLuint layerFramebuffers[kMaxCascades];
+    int resolution;
+    int layers;
+};
+
+/// <summary>
+/// This frame's cascades, in the form the Camera block wants them.
+/// </summary>
+struct Cascades
+{
+    glm::mat4 lightSpace[kMaxCascades];
+
+    // View depth each cascade ends at, 0 for unused cascades
+    glm::vec4 splits;
+
+    // 1 / depth range of each cascade's projection, to turn a world space bias into a depth bias
+    glm::vec4 depthScale;
+
+    int count;
+};
+
+inline GLuint CreateDepthOnlyFramebuffer()
+{
+    GLuint framebuffer;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    return framebuffer;
+}
+
+/// <summary>
+/// Creates the depth texture array and its framebuffers. Leaves framebuffer 0 bound.
+/// </summary>
+/// <param name="resolution">Width and height of every layer</param>
+/// <param name="layers">Number of cascades, at most kMaxCascades</param>
+inline ShadowMap CreateShadowMap(int resolution, int layers)
+{
+    ShadowMap map = {};
+    map.resolution = resolution;
+    map.layers = layers;
+
+    glGenTextures(1, &map.texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, map.texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, resolution, resolution, layers, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // Anything outside a cascade's ortho box counts as lit
+    GLfloat border[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    map.framebuffer = CreateDepthOnlyFramebuffer();
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, map.texture, 0);
+    for (int layer = 0; layer < layers; layer++)
+    {
+        map.layerFramebuffers[layer] = CreateDepthOnlyFramebuffer();
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, map.texture, 0, layer);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return map;
+}
+
+inline void DeleteShadowMap(ShadowMap& map)
+{
+    glDeleteFramebuffers(1, &map.framebuffer);
+    glDeleteFramebuffers(map.layers, map.layerFramebuffers);
+    glDeleteTextures(1, &map.texture);
+}
+
+/// <summary>
+/// View of the directional light from the origin, shared by the cascades and the static shadow cache.
+/// </summary>
+inline glm::mat4 ShadowLightView(const glm::vec3& lightDirection)
+{
+    glm::vec3 up = std::abs(lightDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    return glm::lookAt(glm::vec3(0.0f), lightDirection, up);
+}
+
+/// <summary>
+/// Splits [nearPlane, shadowDistance] into count slices, denser close to the camera.
+/// </summary>
+/// <param name="splits">Receives the far end of every slice</param>
+inline void ComputeCascadeSplits(float nearPlane, float shadowDistance, int count, float* splits)
+{
+    for (int i = 0; i < count; i++)
+    {
+        float fraction = static_cast<float>(i + 1) / count;
+        float logarithmic = nearPlane * std::pow(shadowDistance / nearPlane, fraction);
+        float uniform = nearPlane + (shadowDistance - nearPlane) * fraction;
+        splits[i] = kCascadeSplitLambda * logarithmic + (1.0f - kCascadeSplitLambda) * uniform;
+    }
+}
+
+/// <summary>
+/// Fits one orthographic light projection around every slice of the camera frustum.
+/// Each box is sized to the slice's bounding sphere and moved in whole texels, so the
+/// shadow edges do not shimmer as the camera turns and moves.
+/// </summary>
+/// <param name="view">Camera view matrix</param>
+/// <param name="fovy">Camera vertical field of view, in radians</param>
+/// <param name="aspect">Camera aspect ratio</param>
+/// <param name="nearPlane">Camera near plane</param>
+/// <param name="lightDirection">Direction the light shines in</param>
+/// <param name="settings">Cascade count, resolution and shadow distance</param>
+inline Cascades FitCascades(const glm::mat4& view, float fovy, float aspect, float nearPlane,
+    const glm::vec3& lightDirection, const CascadeSettings& settings)
+{
+    Cascades cascades = {};
+    cascades.count = settings.count;
+
+    float splits[kMaxCascades];
+    ComputeCascadeSplits(nearPlane, settings.shadowDistance, settings.count, splits);
+
+    glm::mat4 inverseView = glm::inverse(view);
+    glm::mat4 lightView = ShadowLightView(lightDirection);
+    float tanY = std::tan(fovy * 0.5f);
+    float tanX = tanY * aspect;
+
+    float sliceNear = nearPlane;
+    for (int i = 0; i < settings.count; i++)
+    {
+        float sliceFar = splits[i];
+
+        // Corners of the slice in world space
+        glm::vec3 corners[8];
+        glm::vec3 center(0.0f);
+        for (int corner = 0; corner < 8; corner++)
+        {
+            float depth = (corner & 4) ? sliceFar : sliceNear;
+            float x = (corner & 1) ? depth * tanX : -depth * tanX;
+            float y = (corner & 2) ? depth * tanY : -depth * tanY;
+            corners[corner] = glm::vec3(inverseView * glm::vec4(x, y, -depth, 1.0f));
+            center += corners[corner] / 8.0f;
+        }
+
+        float radius = 0.0f;
+        for (const glm::vec3& corner : corners)
+        {
+            radius = std::max(radius, glm::length(corner - center));
+        }
+        // Round up so float noise does not change the box size from frame to frame
+        radius = std::ceil(radius * 16.0f) / 16.0f;
+
+        glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1.0f));
+        float texel = 2.0f * radius / settings.resolution;
+        lightCenter.x = std::floor(lightCenter.x / texel) * texel;
+        lightCenter.y = std::floor(lightCenter.y / texel) * texel;
+
+        // The light looks down -z, so the sphere spans [-z - radius, -z + radius] in front of it
+        float boxNear = -lightCenter.z - radius - kShadowCasterMargin;
+        float boxFar = -lightCenter.z + radius;
+        glm::mat4 projection = glm::ortho(lightCenter.x - radius, lightCenter.x + radius,
+            lightCenter.y - radius, lightCenter.y + radius, boxNear, boxFar);
+
+        cascades.lightSpace[i] = projection * lightView;
+        cascades.splits[i] = sliceFar;
+        cascades.depthScale[i] = 1.0f / (boxFar - boxNear);
+        sliceNear = sliceFar;
+    }
+    return cascades;
+}
+
+/// <summary>
+/// Queries a frame of the shadow timer can issue: the whole pass, or with timePerCascade the static
+/// casters' render into their cache, then the static composite and the casters of every cascade.
+/// </summary>
+const int kShadowTimerQueries = 1 + 2 * kMaxCascades;
+
+inline int CompositeShadowQuery(int cascade)
+{
+    return 1 + cascade;
+}
+
+inline int CasterShadowQuery(int cascade)
+{
+    return 1 + kMaxCascades + cascade;
+}
+
+/// <summary>
+/// GL_TIME_ELAPSED queries around the shadow pass, either one for the whole pass or one per step
+/// of it. Results are read kShadowTimerLatency frames late.
+/// </summary>
+struct ShadowTimer
+{
+    GLuint queries[kShadowTimerLatency][kShadowTimerQueries];
+    bool issued[kShadowTimerLatency][kShadowTimerQueries];
+
+    // The query of each frame that was issued last, -1 if none was
+    int lastIssued[kShadowTimerLatency];
+    bool staticRendered[kShadowTimerLatency];
+    int frame;
+
+    // Summed over the frames each query was issued in
+    double totalMs[kShadowTimerQueries];
+    int timedFrames[kShadowTimerQueries];
+    int samples;
+    int staticRenders;
+
+    // Frames whose queries were still running when their slot came round again, left out of the averages
+    int droppedFrames;
+};
+
+inline ShadowTimer CreateShadowTimer()
+{
+    ShadowTimer timer = {};
+    glGenQueries(kShadowTimerLatency * kShadowTimerQueries, &timer.queries[0][0]);
+    for (int& last : timer.lastIssued)
+    {
+        last = -1;
+    }
+    return timer;
+}
+
+inline void DeleteShadowTimer(ShadowTimer& timer)
+{
+    glDeleteQueries(kShadowTimerLatency * kShadowTimerQueries, &timer.queries[0][0]);
+}
+
+/// <summary>
+/// Starts timing the part of this frame's shadow pass at the provided index. Only one can run at a time.
+/// </summary>
+inline void BeginShadowTimer(ShadowTimer& timer, int index)
+{
+    int slot = timer.frame % kShadowTimerLatency;
+    glBeginQuery(GL_TIME_ELAPSED, timer.queries[slot][index]);
+    timer.issued[slot][index] = true;
+    timer.lastIssued[slot] = index;
+}
+
+inline void EndShadowTimer()
+{
+    glEndQuery(GL_TIME_ELAPSED);
+}
+
+/// <summary>
+/// Starts timing a part of the shadow pass if there is a timer, for the parts only timed per cascade.
+/// </summary>
+inline void BeginShadowTimer(ShadowTimer* timer, int index)
+{
+    if (timer != nullptr)
+    {
+        BeginShadowTimer(*timer, index);
+    }
+}
+
+inline void EndShadowTimer(ShadowTimer* timer)
+{
+    if (timer != nullptr)
+    {
+        EndShadowTimer();
+    }
+}
+
+/// <summary>
+/// Average of a query over the frames it was issued in.
+/// </summary>
+inline double AverageShadowTime(const ShadowTimer& timer, int index)
+{
+    return timer.timedFrames[index] == 0 ? 0.0 : timer.totalMs[index] / timer.timedFrames[index];
+}
+
+/// <summary>
+/// Ends the frame: reads the oldest frame's queries and prints the averages every kShadowTimerReportFrames frames.
+/// A frame whose queries are not finished yet is dropped rather than waited for, which would stall
+/// the CPU on the GPU and lengthen the very frames being timed.
+/// </summary>
+/// <param name="timer">Shadow timer</param>
+/// <param name="settings">Cascade settings, to label the report</param>
+/// <param name="staticCached">Whether the static casters went through their cache rather than being drawn with the others</param>
+/// <param name="staticRendered">Whether the static casters were rendered into their cache this frame</param>
+/// <param name="report">Stream to print to</param>
+inline void AdvanceShadowTimer(ShadowTimer& timer, const CascadeSettings& settings, bool staticCached, bool staticRendered,
+    std::ostream& report)
+{
+    timer.staticRendered[timer.frame % kShadowTimerLatency] = staticRendered;
+    timer.frame++;
+
+    // The slot about to be reused holds the oldest frame's queries
+    int slot = timer.frame % kShadowTimerLatency;
+    if (timer.lastIssued[slot] == -1)
+    {
+        return;
+    }
+
+    // Queries finish in order, so the last one being available means they all are
+    GLint available = GL_FALSE;
+    glGetQueryObjectiv(timer.queries[slot][timer.lastIssued[slot]], GL_QUERY_RESULT_AVAILABLE, &available);
+    timer.lastIssued[slot] = -1;
+    if (available != GL_TRUE)
+    {
+        for (bool& issued : timer.issued[slot])
+        {
+            issued = false;
+        }
+        timer.droppedFrames++;
+        return;
+    }
+    for (int i = 0; i < kShadowTimerQueries; i++)
+    {
+        if (timer.issued[slot][i])
+        {
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(timer.queries[slot][i], GL_QUERY_RESULT, &nanoseconds);
+            timer.totalMs[i] += nanoseconds / 1.0e6;
+            timer.timedFrames[i]++;
+            timer.issued[slot][i] = false;
+        }
+    }
+    timer.staticRenders += timer.staticRendered[slot] ? 1 : 0;
+
+    if (++timer.samples < kShadowTimerReportFrames)
+    {
+        return;
+    }
+    report << std::fixed << std::setprecision(3) << "Shadow pass GPU time (" << settings.resolution << "x" << settings.resolution
+        << ", " << settings.count << " cascades, static casters " << (staticCached ? "cached" : "drawn with the others");
+    if (!settings.timePerCascade)
+    {
+        report << "): " << AverageShadowTime(timer, 0) << " ms";
+    }
+    else
+    {
+        report << ") per cascade, " << (staticCached ? "static composite + casters" : "casters") << ":";
+        for (int i = 0; i < settings.count; i++)
+        {
+            report << " ";
+            if (staticCached)
+            {
+                report << AverageShadowTime(timer, CompositeShadowQuery(i)) << "+";
+            }
+            report << AverageShadowTime(timer, CasterShadowQuery(i));
+        }
+        report << " ms";
+        if (timer.timedFrames[0] != 0)
+        {
+            report << ", static render " << AverageShadowTime(timer, 0) << " ms";
+        }
+    }
+    if (staticCached)
+    {
+        report << ", static casters rendered in " << timer.staticRenders << "/" << timer.samples << " frames";
+    }
+    if (timer.droppedFrames != 0)
+    {
+        report << ", " << timer.droppedFrames << " frames dropped as their queries were not finished";
+    }
+    report << std::defaultfloat << std::endl;
+
+    for (int i = 0; i < kShadowTimerQueries; i++)
+    {
+        timer.totalMs[i] = 0.0;
+        timer.timedFrames[i] = 0;
+    }
+    timer.samples = 0;
+    timer.staticRenders = 0;
+    timer.droppedFrames = 0;
+}
@@ -0,0 +1,510 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "GLStateCache.h"
+#include "GpuProfiler.h"
+#include "Instancing.h"
+#include "MeshBuilder.h"
+#include "UniformTable.h"
+
+/// <summary>
+/// Passes of a framebuffer, in the order they are drawn.
+/// </summary>
+enum class RenderPass
+{
+    Opaque = 0,
+    Reflection = 1,
+    Skybox = 2
+};
+
+/// <summary>
+/// Textures bound for a draw: one target shared by texture units 0 and 1.
+/// A texture of 0 leaves whatever is bound on that unit alone.
+/// </summary>
+struct TextureSet
+{
+    GLenum target;
+    GLuint unit0;
+    GLuint unit1;
+};
+
+/// <summary>
+/// Everything needed to draw one object.
+/// Instanced packets pass their transform and light range as instance data, so packets
+/// sharing all of their state and mesh range go out as a single instanced draw.
+/// Other packets set their transform through transformUniform.
+/// </summary>
+struct DrawPacket
+{
+    uint64_t key;
+    RenderPass pass;
+    GLuint program;
+    const UniformTable* uniforms;
+    GLuint vao;
+    TextureSet textures;
+    bool instanced;
+    Uniform transformUniform;
+    glm::mat4 transform;
+    glm::ivec2 lightRange;
+    MeshRange mesh;
+};
+
+/// <summary>
+/// One draw call: a packet, plus the run of instances drawn with it when it is instanced.
+/// </summary>
+struct DrawBatch
+{
+    uint32_t packet;
+    GLint firstInstance;
+    GLsizei instanceCount;
+};
+
+/// <summary>
+/// GL state changes needed to submit a frame's packets in a given order.
+/// </summary>
+struct StateChangeCounts
+{
+    int programChanges;
+    int vaoChanges;
+    int textureBinds;
+    int passChanges;
+    int drawCalls;
+};
+
+inline int TotalStateChanges(const StateChangeCounts& counts)
+{
+    return counts.programChanges + counts.vaoChanges + counts.textureBinds + counts.passChanges;
+}
+
+/// <summary>
+/// Collects the draws of a frame and submits them sorted by key, so that draws sharing
+/// a program, vertex array and textures end up next to each other.
+/// </summary>
+struct DrawQueue
+{
+    std::vector<DrawPacket> packets;
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> scratch;
+    std::vector<DrawBatch> batches;
+
+    // Instance data of every batch, uploaded to instanceBuffer once per flush
+    std::vector<InstanceData> instances;
+    GLuint instanceBuffer;
+    GLsizeiptr instanceCapacity;
+
+    // Small ids handed out to the GL handles and mesh ranges that go into the sort key
+    std::vector<GLuint> programIds;
+    std::vector<GLuint> vaoIds;
+    std::vector<TextureSet> textureSetIds;
+    std::vector<glm::ivec2> meshIds;
+
+    StateChangeCounts submittedOrder;
+    StateChangeCounts sortedOrder;
+};
+
+// Sort key layout, most significant bits first:
+// pass (4) | program (8) | vertex array (8) | texture set (12) | mesh range (8) | depth (16) | unused (8)
+// The mesh range comes before depth so that every instance of a mesh sorts next to the others.
+const int kKeyPassShift = 60;
+const int kKeyProgramShift = 52;
+const int kKeyVaoShift = 44;
+const int kKeyTextureShift = 32;
+const int kKeyMeshShift = 24;
+const int kKeyDepthShift = 8;
+const uint64_t kKeyDepthMax = (1u << 16) - 1;
+
+/// <summary>
+/// Creates an empty queue along with the buffer its instance data is uploaded to.
+/// </summary>
+inline DrawQueue CreateDrawQueue()
+{
+    DrawQueue queue;
+    glGenBuffers(1, &queue.instanceBuffer);
+    queue.instanceCapacity = 0;
+    queue.submittedOrder = {};
+    queue.sortedOrder = {};
+    return queue;
+}
+
+inline void DeleteDrawQueue(DrawQueue& queue)
+{
+    glDeleteBuffers(1, &queue.instanceBuffer);
+}
+
+/// <summary>
+/// Returns the small id of a value, adding it to the table on first use.
+/// </summary>
+template <typename T, typename Equal>
+uint64_t KeyId(std::vector<T>& ids, const T& value, uint64_t maxId, Equal equal)
+{
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+        if (equal(ids[i], value))
+        {
+            return i;
+        }
+    }
+    ids.push_back(value);
+    return ids.size() - 1 <= maxId ? ids.size() - 1 : maxId;
+}
+
+/// <summary>
+/// Fills in a packet for a draw of a mesh whose transform is set through a uniform.
+/// The light range defaults to no point lights; the key is built by SubmitDraw.
+/// </summary>
+inline DrawPacket MakeDrawPacket(RenderPass pass, GLuint program, const UniformTable& uniforms, GLuint vao,
+    TextureSet textures, Uniform transformUniform, const glm::mat4& transform, MeshRange mesh)
+{
+    DrawPacket packet;
+    packet.key = 0;
+    packet.pass = pass;
+    packet.program = program;
+    packet.uniforms = &uniforms;
+    packet.vao = vao;
+    packet.textures = textures;
+    packet.instanced = false;
+    packet.transformUniform = transformUniform;
+    packet.transform = transform;
+    packet.lightRange = glm::ivec2(0, 0);
+    packet.mesh = mesh;
+    return packet;
+}
+
+/// <summary>
+/// Fills in a packet for a program that reads its transform and light range as instance data.
+/// </summary>
+inline DrawPacket MakeInstancedDrawPacket(RenderPass pass, GLuint program, const UniformTable& uniforms, GLuint vao,
+    TextureSet textures, const glm::mat4& transform, MeshRange mesh)
+{
+    DrawPacket packet = MakeDrawPacket(pass, program, uniforms, vao, textures, Uniform::Count, transform, mesh);
+    packet.instanced = true;
+    return packet;
+}
+
+/// <summary>
+/// Distance along the view direction from the camera to the origin of an object.
+/// </summary>
+inline float ViewDepth(const glm::mat4& view, const glm::mat4& transform)
+{
+    return -(view * transform[3]).z;
+}
+
+/// <summary>
+/// Removes the packets of the previous frame. The key id tables are kept, so ids stay stable across frames.
+/// </summary>
+inline void ClearDrawQueue(DrawQueue& queue)
+{
+    queue.packets.clear();
+}
+
+/// <summary>
+/// Records a draw and builds its sort key.
+/// </summary>
+/// <param name="queue">Queue to add the draw to</param>
+/// <param name="packet">Draw to record; its key is filled in here</param>
+/// <param name="viewDepth">Distance of the object from the camera, sorts opaque draws front to back</param>
+/// <param name="farPlane">Far plane distance used to quantize viewDepth</param>
+inline void SubmitDraw(DrawQueue& queue, DrawPacket packet, float viewDepth, float farPlane)
+{
+    auto sameHandle = [](GLuint a, GLuint b) { return a == b; };
+    auto sameTextures = [](const TextureSet& a, const TextureSet& b) {
+        return a.target == b.target && a.unit0 == b.unit0 && a.unit1 == b.unit1;
+    };
+    auto sameMesh = [](const glm::ivec2& a, const glm::ivec2& b) { return a == b; };
+
+    float normalizedDepth = glm::clamp(viewDepth / farPlane, 0.0f, 1.0f);
+    uint64_t depth = static_cast<uint64_t>(normalizedDepth * kKeyDepthMax);
+
+    packet.key = (static_cast<uint64_t>(packet.pass) << kKeyPassShift)
+        | (KeyId(queue.programIds, packet.program, 0xff, sameHandle) << kKeyProgramShift)
+        | (KeyId(queue.vaoIds, packet.vao, 0xff, sameHandle) << kKeyVaoShift)
+        | (KeyId(queue.textureSetIds, packet.textures, 0xfff, sameTextures) << kKeyTextureShift)
+        | (KeyId(queue.meshIds, glm::ivec2(packet.mesh.firstIndex, packet.mesh.indexCount), 0xff, sameMesh) << kKeyMeshShift)
+        | (depth << kKeyDepthShift);
+    queue.packets.push_back(packet);
+}
+
+/// <summary>
+/// Sorts packet indices by key with an LSD radix sort, one byte per pass.
+/// Passes where every key has the same byte are skipped, and equal keys keep their submission order.
+/// </summary>
+inline void SortDrawQueue(DrawQueue& queue)
+{
+    size_t count = queue.packets.size();
+    queue.order.resize(count);
+    queue.scratch.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        queue.order[i] = static_cast<uint32_t>(i);
+    }
+
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        size_t histogram[256] = {};
+        for (size_t i = 0; i < count; i++)
+        {
+            histogram[(queue.packets[i].key >> shift) & 0xff]++;
+        }
+        if (count == 0 || histogram[(queue.packets[0].key >> shift) & 0xff] == count)
+        {
+            continue;
+        }
+
+        size_t offset = 0;
+        for (int digit = 0; digit < 256; digit++)
+        {
+            size_t digitCount = histogram[digit];
+            histogram[digit] = offset;
+            offset += digitCount;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            uint32_t index = queue.order[i];
+            queue.scratch[histogram[(queue.packets[index].key >> shift) & 0xff]++] = index;
+        }
+        queue.order.swap(queue.scratch);
+    }
+}
+
+/// <summary>
+/// Sets up the fixed-function state of a pass.
+/// </summary>
+inline void BeginRenderPass(GLStateCache& cache, RenderPass pass)
+{
+    switch (pass)
+    {
+    case RenderPass::Opaque:
+    case RenderPass::Reflection:
+        DepthFunc(cache, GL_LESS);
+        break;
+    case RenderPass::Skybox:
+        // The skybox is drawn at the far plane, so it has to pass the depth test there
+        DepthFunc(cache, GL_LEQUAL);
+        break;
+    }
+}
+
+/// <summary>
+/// Name of a pass in the GPU profiler.
+/// </summary>
+inline const char* RenderPassName(RenderPass pass)
+{
+    switch (pass)
+    {
+    case RenderPass::Opaque:
+        return "Opaque";
+    case RenderPass::Reflection:
+        return "Reflection";
+    case RenderPass::Skybox:
+        return "Skybox";
+    }
+    return "Unknown pass";
+}
+
+/// <summary>
+/// Whether two packets can be drawn by the same instanced draw call.
+/// </summary>
+inline bool CanShareDraw(const DrawPacket& a, const DrawPacket& b)
+{
+    return a.instanced && b.instanced && a.pass == b.pass && a.program == b.program && a.vao == b.vao
+        && a.textures.target == b.textures.target && a.textures.unit0 == b.textures.unit0
+        && a.textures.unit1 == b.textures.unit1 && a.mesh.firstIndex == b.mesh.firstIndex
+        && a.mesh.indexCount == b.mesh.indexCount;
+}
+
+/// <summary>
+/// Groups the packets, taken in the provided order, into draw calls and lays out their instance data.
+/// </summary>
+/// <param name="queue">Queue holding the packets</param>
+/// <param name="indexAt">Maps a position in the order to a packet index</param>
+/// <param name="merge">Whether consecutive packets that can share a draw call are merged into one</param>
+template <typename IndexAt>
+void BuildDrawBatches(DrawQueue& queue, IndexAt indexAt, bool merge)
+{
+    queue.batches.clear();
+    queue.instances.clear();
+    for (size_t i = 0; i < queue.packets.size(); i++)
+    {
+        uint32_t index = static_cast<uint32_t>(indexAt(i));
+        const DrawPacket& packet = queue.packets[index];
+        if (packet.instanced)
+        {
+            if (merge && !queue.batches.empty() && CanShareDraw(queue.packets[queue.batches.back().packet], packet))
+            {
+                queue.batches.back().instanceCount++;
+            }
+            else
+            {
+                queue.batches.push_back({ index, static_cast<GLint>(queue.instances.size()), 1 });
+            }
+            queue.instances.push_back({ packet.transform, packet.lightRange });
+        }
+        else
+        {
+            queue.batches.push_back({ index, 0, 0 });
+        }
+    }
+}
+
+/// <summary>
+/// Uploads the instance data of the batches with a single buffer update, growing the buffer when needed.
+/// </summary>
+inline void UploadInstances(DrawQueue& queue)
+{
+    GLsizeiptr bytes = queue.instances.size() * sizeof(InstanceData);
+    if (bytes == 0)
+    {
+        return;
+    }
+    if (bytes > queue.instanceCapacity)
+    {
+        queue.instanceCapacity = std::max(bytes, queue.instanceCapacity * 2);
+    }
+
+    // Always hand GL a fresh store, so the upload does not wait on last frame's draws still reading the old one
+    glBindBuffer(GL_ARRAY_BUFFER, queue.instanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, queue.instanceCapacity, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, queue.instances.data());
+    CountBufferUpload(bytes);
+}
+
+/// <summary>
+/// Walks the batches built by BuildDrawBatches, working out which state changes each one needs.
+/// Only issues the GL calls when a state cache is provided, so the same walk also counts the changes
+/// an order would cost without drawing anything.
+/// </summary>
+/// <param name="queue">Queue holding the packets and batches</param>
+/// <param name="cache">State cache to change state and draw through, or nullptr to only count</param>
+/// <param name="profiler">GPU profiler to time every pass in, or nullptr</param>
+/// <returns>Number of state changes and draw calls the order needed</returns>
+inline StateChangeCounts WalkDrawBatches(const DrawQueue& queue, GLStateCache* cache, GpuProfiler* profiler = nullptr)
+{
+    StateChangeCounts counts = {};
+    const DrawPacket* previous = nullptr;
+
+    // Textures bound on units 0 and 1, per target. 0 means not known yet.
+    GLuint bound2D[2] = { 0, 0 };
+    GLuint boundCube[2] = { 0, 0 };
+
+    for (const DrawBatch& batch : queue.batches)
+    {
+        const DrawPacket& packet = queue.packets[batch.packet];
+        if (previous == nullptr || previous->pass != packet.pass)
+        {
+            counts.passChanges++;
+            if (cache != nullptr)
+            {
+                if (previous != nullptr)
+                {
+                    EndGpuScope(profiler);
+                }
+                BeginGpuScope(profiler, RenderPassName(packet.pass));
+                BeginRenderPass(*cache, packet.pass);
+            }
+        }
+        if (previous == nullptr || previous->program != packet.program)
+        {
+            counts.programChanges++;
+            if (cache != nullptr)
+            {
+                UseProgram(*cache, packet.program);
+            }
+        }
+        if (previous == nullptr || previous->vao != packet.vao)
+        {
+            counts.vaoChanges++;
+            if (cache != nullptr)
+            {
+                BindVertexArray(*cache, packet.vao);
+            }
+        }
+
+        GLuint* bound = packet.textures.target == GL_TEXTURE_CUBE_MAP ? boundCube : bound2D;
+        GLuint wanted[2] = { packet.textures.unit0, packet.textures.unit1 };
+        for (int unit = 1; unit >= 0; unit--)
+        {
+            if (wanted[unit] != 0 && bound[unit] != wanted[unit])
+            {
+                bound[unit] = wanted[unit];
+                counts.textureBinds++;
+                if (cache != nullptr)
+                {
+                    BindTexture(*cache, unit, packet.textures.target, wanted[unit]);
+                }
+            }
+        }
+
+        counts.drawCalls++;
+        if (cache != nullptr)
+        {
+            if (packet.instanced)
+            {
+                PointInstanceAttributes(queue.instanceBuffer, batch.firstInstance);
+                glDrawElementsInstanced(GL_TRIANGLES, packet.mesh.indexCount, GL_UNSIGNED_SHORT,
+                    MeshIndexOffset(packet.mesh), batch.instanceCount);
+                CountDrawCall(packet.mesh.indexCount / 3, batch.instanceCount);
+            }
+            else
+            {
+                SetUniform(*packet.uniforms, packet.transformUniform, packet.transform);
+                glDrawElements(GL_TRIANGLES, packet.mesh.indexCount, GL_UNSIGNED_SHORT, MeshIndexOffset(packet.mesh));
+                CountDrawCall(packet.mesh.indexCount / 3, 1);
+            }
+        }
+        previous = &packet;
+    }
+    if (cache != nullptr && previous != nullptr)
+    {
+        EndGpuScope(profiler);
+    }
+    return counts;
+}
+
+/// <summary>
+/// Number of vertices the last flush drew through a vertex array object, counting every index of every instance.
+/// </summary>
+inline size_t DrawnVertexCount(const DrawQueue& queue, GLuint vao)
+{
+    size_t vertices = 0;
+    for (const DrawBatch& batch : queue.batches)
+    {
+        const DrawPacket& packet = queue.packets[batch.packet];
+        if (packet.vao == vao)
+        {
+            vertices += static_cast<size_t>(packet.mesh.indexCount) * std::max(batch.instanceCount, 1);
+        }
+    }
+    return vertices;
+}
+
+/// <summary>
+/// Sorts the recorded packets, merges instances of the same mesh and state into single draws and
+/// issues them, changing GL state only when the next draw needs it.
+/// Also records how many state changes and draw calls the frame needed before and after sorting.
+/// Leaves texture unit 0 active and the default depth test set.
+/// </summary>
+/// <param name="queue">Queue to flush</param>
+/// <param name="cache">State cache to change state and draw through</param>
+/// <param name="profiler">GPU profiler to time every pass in, or nullptr</param>
+inline void FlushDrawQueue(DrawQueue& queue, GLStateCache& cache, GpuProfiler* profiler = nullptr)
+{
+    SortDrawQueue(queue);
+
+    // Submission order, one draw per packet: what drawing the packets as they come would cost
+    BuildDrawBatches(queue, [](size_t i) { return i; }, false);
+    queue.submittedOrder = WalkDrawBatches(queue, nullptr);
+
+    BuildDrawBatches(queue, [&queue](size_t i) { return queue.order[i]; }, true);
+    UploadInstances(queue);
+    queue.sortedOrder = WalkDrawBatches(queue, &cache, profiler);
+
+    ActiveTexture(cache, 0);
+    BeginRenderPass(cache, RenderPass::Opaque);
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <iomanip>
+#include <ostream>
+
+/// <summary>
+/// Rate, in frames per second, animations are shown at in on-demand mode while nothing else changes.
+/// </summary>
+const double kIdleAnimationRate = 15.0;
+
+/// <summary>
+/// Seconds between two prints of the on-demand statistics.
+/// </summary>
+const double kFramePacerReportSeconds = 5.0;
+
+/// <summary>
+/// Decides, in on-demand mode, whether the loop has to render a frame or can sleep until something
+/// changes. Input and window events mark the scene dirty; animations only mark it dirty
+/// kIdleAnimationRate times a second. When disabled, every loop iteration renders.
+/// </summary>
+struct FramePacer
+{
+    bool enabled;
+    bool dirty;
+
+    // When the last frame was presented, in seconds
+    double lastPresent;
+
+    // Since the last report
+    double reportStart;
+    double idleSeconds;
+    int presented;
+    int wakeups;
+};
+
+inline FramePacer CreateFramePacer(bool enabled, double now)
+{
+    FramePacer pacer = {};
+    pacer.enabled = enabled;
+    pacer.dirty = true;
+    pacer.lastPresent = now;
+    pacer.reportStart = now;
+    return pacer;
+}
+
+/// <summary>
+/// Something that changes what is on screen happened, so the next loop iteration renders.
+/// </summary>
+inline void MarkFrameDirty(FramePacer& pacer)
+{
+    pacer.dirty = true;
+}
+
+/// <summary>
+/// Whether this loop iteration has to render and present a frame.
+/// </summary>
+inline bool FrameDue(const FramePacer& pacer, double now)
+{
+    return !pacer.enabled || pacer.dirty || now - pacer.lastPresent >= 1.0 / kIdleAnimationRate;
+}
+
+/// <summary>
+/// How long the loop may sleep before the next animation frame is due.
+/// </summary>
+inline double SecondsUntilFrameDue(const FramePacer& pacer, double now)
+{
+    double remaining = pacer.lastPresent + 1.0 / kIdleAnimationRate - now;
+    return remaining > 0.0 ? remaining : 0.0;
+}
+
+/// <summary>
+/// Records a sleep in glfwWaitEventsTimeout that ended after the provided number of seconds.
+/// </summary>
+inline void RecordIdle(FramePacer& pacer, double seconds)
+{
+    pacer.idleSeconds += seconds;
+    pacer.wakeups++;
+}
+
+/// <summary>
+/// Records that a frame is being rendered, which clears the dirty flag.
+/// </summary>
+inline void RecordPresent(FramePacer& pacer, double now)
+{
+    pacer.dirty = false;
+    pacer.lastPresent = now;
+    pacer.presented++;
+}
+
+/// <summary>
+/// Prints, every kFramePacerReportSeconds, how many frames were presented and how much of the time the loop slept.
+/// </summary>
+inline void ReportFramePacer(FramePacer& pacer, double now, std::ostream& report)
+{
+    double elapsed = now - pacer.reportStart;
+    if (!pacer.enabled || elapsed < kFramePacerReportSeconds)
+    {
+        return;
+    }
+    report << std::fixed << std::setprecision(1) << "On demand: " << pacer.presented << " frames presented in "
+        << elapsed << " s, " << pacer.wakeups << " idle waits, idle " << 100.0 * pacer.idleSeconds / elapsed << "%"
+        << std::defaultfloat << std::endl;
+    pacer.reportStart = now;
+    pacer.idleSeconds = 0.0;
+    pacer.presented = 0;
+    pacer.wakeups = 0;
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Benchmark.h"
+#include "GLStateCache.h"
+#include "ImageEncoder.h"
+#include "MappedFile.h"
+#include "PixelReadback.h"
+#include "Simulation.h"
+
+/// <summary>
+/// Frames read back at once. When all of them are in flight the next frame waits for the oldest,
+/// as a sequence may not skip any.
+/// </summary>
+const int kSequenceReadbackSlots = 4;
+
+/// <summary>
+/// Frames that may wait for each encoder thread before rendering is held back.
+/// </summary>
+const int kSequenceQueuedFramesPerThread = 2;
+
+/// <summary>
+/// An offline render of the camera path at a fixed frame rate, as fast as the machine allows.
+/// Every frame is resolved, read back through a pixel buffer ring and handed to a pool of encoder
+/// threads, which either append it to a Y4M file or write it as a PPM of its own.
+/// </summary>
+struct FrameSequence
+{
+    int frames;
+    int framesPerSecond;
+    int stepsPerFrame;
+    std::string outputPath;
+    ImageFormat format;
+
+    std::vector<CameraPathSegment> path;
+    int frame;
+    float yaw;
+    float pitch;
+
+    OffscreenTarget resolved;
+    PixelReadbackRing readbacks;
+    ImageEncoder encoder;
+
+    // Frames that had to wait for a read to finish, and when the first frame started
+    int readbackWaits;
+    std::chrono::steady_clock::time_point start;
+};
+
+/// <summary>
+/// Creates the targets, opens the output and starts the encoder threads.
+/// </summary>
+/// <param name="outputPath">A .y4m file, or else a directory the frames go to as frame-NNNNN.ppm</param>
+/// <param name="framesPerSecond">Frame rate of the sequence; a divisor of 120 gives every frame the same number of steps</param>
+/// <returns>False if the output could not be created</returns>
+inline bool StartFrameSequence(FrameSequence& sequence, const std::string& outputPath, int frames, int framesPerSecond,
+    int width, int height)
+{
+    sequence.frames = frames;
+    sequence.framesPerSecond = framesPerSecond;
+    sequence.stepsPerFrame = std::max(1, static_cast<int>(std::lround(1.0 / (kSimulationStep * framesPerSecond))));
+    sequence.outputPath = outputPath;
+    bool y4m = outputPath.size() >= 4 && outputPath.compare(outputPath.size() - 4, 4, ".y4m") == 0;
+    sequence.format = y4m ? ImageFormat::Y4m : ImageFormat::Ppm;
+
+    sequence.path = DefaultCameraPath();
+    sequence.frame = 0;
+    CameraPathStart(sequence.yaw, sequence.pitch);
+
+    // The render loop keeps a thread to itself
+    int threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+    if (!y4m && !MakeDirectory(outputPath))
+    {
+        return false;
+    }
+    StartImageEncoder(sequence.encoder, threads, static_cast<size_t>(threads) * kSequenceQueuedFramesPerThread);
+    if (y4m && !OpenImageStream(sequence.encoder, outputPath, width, height, framesPerSecond))
+    {
+        StopImageEncoder(sequence.encoder);
+        return false;
+    }
+
+    sequence.resolved = CreateOffscreenTarget(width, height, 0);
+    sequence.readbacks = CreatePixelReadbackRing(kSequenceReadbackSlots, width, height);
+    sequence.readbackWaits = 0;
+    sequence.start = std::chrono::steady_clock::now();
+    return true;
+}
+
+/// <summary>
+/// Starts a frame: the camera path stands in for the keys and the mouse.
+/// </summary>
+/// <param name="cameraUp">The camera's up direction</param>
+/// <returns>Input for every simulation step of the frame</returns>
+inline SimulationInput BeginSequenceFrame(FrameSequence& sequence, const glm::vec3& cameraUp)
+{
+    return FollowCameraPath(sequence.path, sequence.frame, sequence.yaw, sequence.pitch, cameraUp);
+}
+
+/// <summary>
+/// Hands the oldest read over to the encoder once its copy is done, or waits for it if asked to.
+/// A read that could not be mapped is handed over without pixels, for the encoder to count as
+/// failed and, in a Y4M stream, to let the frames after it through.
+/// </summary>
+/// <returns>False if no read is pending or the oldest one is still in flight</returns>
+inline bool HandOverSequenceFrame(FrameSequence& sequence, bool wait)
+{
+    ImageJob job;
+    int index;
+    if (!FinishPixelReadback(sequence.readbacks, job.pixels, index, wait))
+    {
+        return false;
+    }
+    if (sequence.format == ImageFormat::Ppm)
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/frame-%05d.ppm", index);
+        job.path = sequence.outputPath + name;
+    }
+    job.width = sequence.readbacks.width;
+    job.height = sequence.readbacks.height;
+    job.format = sequence.format;
+    job.streamIndex = static_cast<uint64_t>(index);
+    QueueImage(sequence.encoder, std::move(job));
+    return true;
+}
+
+/// <summary>
+/// Resolves the frame just rendered and starts reading it back, after handing every finished read
+/// over to the encoder. Queueing blocks while the encoders are behind, which is the back-pressure the report shows.
+/// </summary>
+/// <returns>False once the last frame has been rendered</returns>
+inline bool EndSequenceFrame(FrameSequence& sequence, GLStateCache& cache, GLuint sceneFramebuffer)
+{
+    while (HandOverSequenceFrame(sequence, false))
+    {
+    }
+    if (PixelReadbackRingFull(sequence.readbacks))
+    {
+        sequence.readbackWaits++;
+        HandOverSequenceFrame(sequence, true);
+    }
+
+    BlitFramebuffer(cache, sceneFramebuffer, sequence.resolved.framebuffer, sequence.resolved.width, sequence.resolved.height,
+        GL_COLOR_BUFFER_BIT);
+    BeginPixelReadback(sequence.readbacks, cache, sequence.resolved.framebuffer, sequence.frame);
+    sequence.frame++;
+    return sequence.frame < sequence.frames;
+}
+
+/// <summary>
+/// Hands over the reads still in flight, waits for every frame to be written and reports the throughput.
+/// </summary>
+inline void FinishFrameSequence(FrameSequence& sequence, std::ostream& report)
+{
+    while (HandOverSequenceFrame(sequence, true))
+    {
+    }
+    size_t threads = sequence.encoder.threads.size();
+    StopImageEncoder(sequence.encoder);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - sequence.start).count();
+
+    report << std::fixed << std::setprecision(2) << "Sequence: " << sequence.encoder.written << " frames of "
+        << sequence.resolved.width << "x" << sequence.resolved.height << " written to " << sequence.outputPath << " in "
+        << seconds << " s, " << sequence.encoder.written / std::max(seconds, 1.0e-9) << " fps by " << threads
+        << " encoder threads; queue full " << sequence.encoder.fullWaits << " times, rendering held back "
+        << sequence.encoder.fullSeconds << " s (" << 100.0 * sequence.encoder.fullSeconds / std::max(seconds, 1.0e-9)
+        << "%), " << sequence.readbackWaits << " frames waited for a read";
+    if (sequence.encoder.failed != 0)
+    {
+        report << ", " << sequence.encoder.failed << " FAILED to write";
+    }
+    report << std::defaultfloat << std::endl;
+
+    DeleteOffscreenTarget(sequence.resolved);
+    DeletePixelReadbackRing(sequence.readbacks);
+}
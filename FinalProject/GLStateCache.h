@@ -0,0 +1,264 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "RenderStats.h"
+
+/// <summary>
+/// Texture units the cache keeps track of. Binds on higher units always go through.
+/// </summary>
+const int kTrackedTextureUnits = 8;
+
+/// <summary>
+/// Texture targets the cache keeps track of, per unit.
+/// </summary>
+enum class TrackedTarget
+{
+    Texture2D,
+    Texture2DArray,
+    CubeMap,
+    Buffer,
+    Count
+};
+
+/// <summary>
+/// Marks a piece of state whose value is not known, so the next call setting it always goes through.
+/// </summary>
+const GLuint kUnknownState = ~0u;
+
+/// <summary>
+/// Calls made through the cache since the counters were last reset.
+/// </summary>
+struct GLStateCounters
+{
+    int issued;
+    int elided;
+};
+
+/// <summary>
+/// Shadow copy of the GL state the render loop changes. Every change goes through the
+/// functions below, which compare against the copy and drop calls that would change nothing.
+/// </summary>
+struct GLStateCache
+{
+    GLuint program;
+    GLuint vao;
+    GLuint activeUnit;
+    GLuint textures[kTrackedTextureUnits][static_cast<int>(TrackedTarget::Count)];
+    GLuint framebuffer;
+    glm::ivec4 viewport;
+    GLenum depthFunc;
+
+    // GL_TRUE or GL_FALSE once known, and the rectangle
+    GLuint scissorTest;
+    glm::ivec4 scissor;
+
+    GLStateCounters counters;
+};
+
+/// <summary>
+/// Forgets everything the cache knows about the GL state. Call after GL state was changed
+/// behind the cache's back, e.g. by setup code.
+/// </summary>
+inline void InvalidateGLState(GLStateCache& cache)
+{
+    cache.program = kUnknownState;
+    cache.vao = kUnknownState;
+    cache.activeUnit = kUnknownState;
+    for (int unit = 0; unit < kTrackedTextureUnits; unit++)
+    {
+        for (int target = 0; target < static_cast<int>(TrackedTarget::Count); target++)
+        {
+            cache.textures[unit][target] = kUnknownState;
+        }
+    }
+    cache.framebuffer = kUnknownState;
+    cache.viewport = glm::ivec4(-1);
+    cache.depthFunc = kUnknownState;
+    cache.scissorTest = kUnknownState;
+    cache.scissor = glm::ivec4(-1);
+}
+
+/// <summary>
+/// Creates a cache that knows nothing yet, with zeroed counters.
+/// </summary>
+inline GLStateCache CreateGLStateCache()
+{
+    GLStateCache cache;
+    InvalidateGLState(cache);
+    cache.counters = {};
+    return cache;
+}
+
+/// <summary>
+/// Zeroes the counters, at the start of every frame.
+/// </summary>
+inline void ResetGLStateCounters(GLStateCache& cache)
+{
+    cache.counters = {};
+}
+
+/// <summary>
+/// Compares a piece of cached state against the wanted value, updating the counters.
+/// </summary>
+/// <returns>True if the call has to be issued</returns>
+template <typename T>
+bool ChangeState(GLStateCache& cache, T& cached, const T& wanted)
+{
+    if (cached == wanted)
+    {
+        cache.counters.elided++;
+        return false;
+    }
+    cached = wanted;
+    cache.counters.issued++;
+    return true;
+}
+
+inline void UseProgram(GLStateCache& cache, GLuint program)
+{
+    if (ChangeState(cache, cache.program, program))
+    {
+        CountProgramChange();
+        glUseProgram(program);
+    }
+}
+
+inline void BindVertexArray(GLStateCache& cache, GLuint vao)
+{
+    if (ChangeState(cache, cache.vao, vao))
+    {
+        glBindVertexArray(vao);
+    }
+}
+
+/// <summary>
+/// Selects the active texture unit.
+/// </summary>
+/// <param name="cache">State cache</param>
+/// <param name="unit">Unit index, not the GL_TEXTURE0 + unit enum</param>
+inline void ActiveTexture(GLStateCache& cache, GLuint unit)
+{
+    if (ChangeState(cache, cache.activeUnit, unit))
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+}
+
+inline int TrackedTargetIndex(GLenum target)
+{
+    switch (target)
+    {
+    case GL_TEXTURE_2D:
+        return static_cast<int>(TrackedTarget::Texture2D);
+    case GL_TEXTURE_2D_ARRAY:
+        return static_cast<int>(TrackedTarget::Texture2DArray);
+    case GL_TEXTURE_CUBE_MAP:
+        return static_cast<int>(TrackedTarget::CubeMap);
+    case GL_TEXTURE_BUFFER:
+        return static_cast<int>(TrackedTarget::Buffer);
+    default:
+        return -1;
+    }
+}
+
+/// <summary>
+/// Binds a texture to a unit, switching the active unit only if the bind is actually needed.
+/// </summary>
+/// <param name="cache">State cache</param>
+/// <param name="unit">Unit index, not the GL_TEXTURE0 + unit enum</param>
+/// <param name="target">Texture target</param>
+/// <param name="texture">Texture handle</param>
+inline void BindTexture(GLStateCache& cache, GLuint unit, GLenum target, GLuint texture)
+{
+    int targetIndex = TrackedTargetIndex(target);
+    if (unit < static_cast<GLuint>(kTrackedTextureUnits) && targetIndex != -1)
+    {
+        if (!ChangeState(cache, cache.textures[unit][targetIndex], texture))
+        {
+            return;
+        }
+    }
+    else
+    {
+        cache.counters.issued++;
+    }
+    ActiveTexture(cache, unit);
+    CountTextureBind();
+    glBindTexture(target, texture);
+}
+
+inline void BindFramebuffer(GLStateCache& cache, GLuint framebuffer)
+{
+    if (ChangeState(cache, cache.framebuffer, framebuffer))
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    }
+}
+
+/// <summary>
+/// Copies a rectangle from one framebuffer to the same place in another, then leaves the
+/// destination bound for both reading and drawing. The scissor test clips it like any other write.
+/// </summary>
+inline void BlitFramebufferRegion(GLStateCache& cache, GLuint source, GLuint destination, GLint x, GLint y, GLint width, GLint height,
+    GLbitfield mask)
+{
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, source);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, destination);
+    glBlitFramebuffer(x, y, x + width, y + height, x, y, x + width, y + height, mask, GL_NEAREST);
+    cache.counters.issued++;
+
+    // Reading and drawing now go to different framebuffers, which the cache cannot describe
+    cache.framebuffer = kUnknownState;
+    BindFramebuffer(cache, destination);
+}
+
+/// <summary>
+/// Copies a width x height rectangle from the origin of one framebuffer to another,
+/// then leaves the destination bound for both reading and drawing.
+/// </summary>
+inline void BlitFramebuffer(GLStateCache& cache, GLuint source, GLuint destination, GLint width, GLint height, GLbitfield mask)
+{
+    BlitFramebufferRegion(cache, source, destination, 0, 0, width, height, mask);
+}
+
+inline void Viewport(GLStateCache& cache, GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    if (ChangeState(cache, cache.viewport, glm::ivec4(x, y, width, height)))
+    {
+        glViewport(x, y, width, height);
+    }
+}
+
+inline void DepthFunc(GLStateCache& cache, GLenum func)
+{
+    if (ChangeState(cache, cache.depthFunc, func))
+    {
+        glDepthFunc(func);
+    }
+}
+
+inline void ScissorTest(GLStateCache& cache, bool enabled)
+{
+    if (ChangeState(cache, cache.scissorTest, static_cast<GLuint>(enabled ? GL_TRUE : GL_FALSE)))
+    {
+        if (enabled)
+        {
+            glEnable(GL_SCISSOR_TEST);
+        }
+        else
+        {
+            glDisable(GL_SCISSOR_TEST);
+        }
+    }
+}
+
+inline void Scissor(GLStateCache& cache, GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    if (ChangeState(cache, cache.scissor, glm::ivec4(x, y, width, height)))
+    {
+        glScissor(x, y, width, height);
+    }
+}
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <stb_image.h>
+
+#include "Benchmark.h"
+#include "GLStateCache.h"
+#include "ImageFiles.h"
+#include "PixelReadback.h"
+#include "Simulation.h"
+
+/// <summary>
+/// Size the poses are rendered at. Fixed, so the references fit every machine.
+/// </summary>
+const int kGoldenWidth = 400;
+const int kGoldenHeight = 300;
+
+/// <summary>
+/// Largest difference of a color channel, out of 255, that still counts as the same pixel.
+/// Leaves room for drivers rounding and rasterizing edges differently.
+/// </summary>
+const int kGoldenTolerance = 8;
+
+/// <summary>
+/// Fraction of the pixels that may differ by more than kGoldenTolerance before a pose fails.
+/// </summary>
+const double kGoldenMaxFailingFraction = 0.001;
+
+/// <summary>
+/// Poses read back at once; rendering only waits for a read when all of them are in flight.
+/// </summary>
+const int kGoldenReadbackSlots = 3;
+
+/// <summary>
+/// A fixed view of the scene: where the camera is and looks, and the state of everything that moves.
+/// </summary>
+struct GoldenPose
+{
+    const char* name;
+    glm::vec3 cameraPos;
+    glm::vec3 cameraTarget;
+    glm::vec3 movingFacePosition;
+    float movingFaceAngle;
+    double lightTime;
+    bool night;
+    glm::vec3 dayLightColor;
+};
+
+/// <summary>
+/// Views that cover every object, the shadows at near and far cascades, the reflective cube and the day lighting.
+/// </summary>
+inline std::vector<GoldenPose> DefaultGoldenPoses()
+{
+    const glm::vec3 facePosition(1.5f, -1.f, -2.f);
+    return {
+        { "start", glm::vec3(0.0f, 2.0f, 8.0f), glm::vec3(0.0f, 0.0f, 4.0f), facePosition, 0.0f, 0.0, true, glm::vec3(1.0f) },
+        { "cabinet", glm::vec3(1.0f, -2.0f, 1.0f), glm::vec3(3.0f, -4.0f, -4.0f), facePosition, 0.0f, 1.0, true, glm::vec3(1.0f) },
+        { "bed", glm::vec3(-1.0f, -2.0f, 2.0f), glm::vec3(-2.4f, -4.6f, -4.0f), facePosition, 0.0f, 2.0, true, glm::vec3(1.0f) },
+        { "face", glm::vec3(1.5f, 0.5f, 1.0f), facePosition, facePosition, 45.0f, 3.0, true, glm::vec3(1.0f) },
+        { "day", glm::vec3(0.0f, 2.0f, 8.0f), glm::vec3(0.0f, 0.0f, 4.0f), facePosition, 90.0f, 4.0, false, glm::vec3(1.0f, 0.8f, 0.6f) },
+        { "skybox", glm::vec3(0.0f, -3.0f, 0.0f), glm::vec3(0.5f, 2.0f, -1.0f), facePosition, 0.0f, 5.0, true, glm::vec3(1.0f) }
+    };
+}
+
+/// <summary>
+/// How one pose compared to its reference.
+/// </summary>
+struct GoldenResult
+{
+    bool passed;
+    int maxDifference;
+    size_t failingPixels;
+};
+
+/// <summary>
+/// State of the golden image run: renders every pose once, reads it back through a ring of
+/// pixel buffers and compares it with DIRECTORY/NAME.ppm, or writes that file when updating.
+/// </summary>
+struct GoldenRun
+{
+    bool running;
+    bool update;
+    std::string directory;
+    std::vector<GoldenPose> poses;
+
+    // Next pose to render, and poses whose pixels were checked
+    size_t nextPose;
+    size_t finishedPoses;
+    int failures;
+
+    OffscreenTarget resolved;
+    PixelReadbackRing readbacks;
+    std::vector<unsigned char> pixels;
+};
+
+/// <summary>
+/// A run that is not running yet.
+/// </summary>
+inline GoldenRun CreateGoldenRun()
+{
+    GoldenRun run;
+    run.running = false;
+    run.update = false;
+    run.poses = DefaultGoldenPoses();
+    run.nextPose = 0;
+    run.finishedPoses = 0;
+    run.failures = 0;
+    run.resolved = {};
+    return run;
+}
+
+/// <summary>
+/// Creates the single sampled target the poses are resolved into and the readback ring.
+/// </summary>
+inline void StartGoldenRun(GoldenRun& run)
+{
+    run.resolved = CreateOffscreenTarget(kGoldenWidth, kGoldenHeight, 0);
+    run.readbacks = CreatePixelReadbackRing(kGoldenReadbackSlots, kGoldenWidth, kGoldenHeight);
+}
+
+inline void DeleteGoldenRun(GoldenRun& run)
+{
+    DeleteOffscreenTarget(run.resolved);
+    DeletePixelReadbackRing(run.readbacks);
+}
+
+/// <summary>
+/// Puts the scene in the pose to render this frame, the last one once all have been captured.
+/// </summary>
+/// <param name="cameraFront">Receives the direction the camera looks in</param>
+inline void ApplyGoldenPose(const GoldenRun& run, SimulationState& state, glm::vec3& cameraFront)
+{
+    const GoldenPose& pose = run.poses[std::min(run.nextPose, run.poses.size() - 1)];
+    state.cameraPos = pose.cameraPos;
+    state.movingFacePosition = pose.movingFacePosition;
+    state.movingFaceAngle = pose.movingFaceAngle;
+    state.lightTime = pose.lightTime;
+    state.night = pose.night;
+    state.dayLightColor = pose.dayLightColor;
+    cameraFront = glm::normalize(pose.cameraTarget - pose.cameraPos);
+}
+
+/// <summary>
+/// Starts reading back this frame's pose, unless every slot is still in flight,
+/// in which case the same pose is rendered again next frame.
+/// </summary>
+inline void CaptureGoldenFrame(GoldenRun& run, GLStateCache& cache, GLuint sceneFramebuffer)
+{
+    if (run.nextPose >= run.poses.size() || PixelReadbackRingFull(run.readbacks))
+    {
+        return;
+    }
+    BlitFramebuffer(cache, sceneFramebuffer, run.resolved.framebuffer, kGoldenWidth, kGoldenHeight, GL_COLOR_BUFFER_BIT);
+    BeginPixelReadback(run.readbacks, cache, run.resolved.framebuffer, static_cast<int>(run.nextPose));
+    run.nextPose++;
+}
+
+/// <summary>
+/// A heat map of the differences: black where the pixels match, yellow up to the tolerance,
+/// red beyond it, over a dimmed copy of the reference so the place can be recognized.
+/// </summary>
+inline std::vector<unsigned char> GoldenDiffHeatMap(const unsigned char* actual, const unsigned char* reference, size_t pixelCount)
+{
+    std::vector<unsigned char> heat(pixelCount * 4);
+    for (size_t i = 0; i < pixelCount; i++)
+    {
+        const unsigned char* a = actual + i * 4;
+        const unsigned char* r = reference + i * 4;
+        int difference = std::max({ std::abs(a[0] - r[0]), std::abs(a[1] - r[1]), std::abs(a[2] - r[2]) });
+        int background = (r[0] + r[1] + r[2]) / 12;
+        int intensity = std::min(255, 64 + difference * 8);
+        heat[i * 4 + 0] = static_cast<unsigned char>(difference == 0 ? background : intensity);
+        heat[i * 4 + 1] = static_cast<unsigned char>(difference == 0 ? background : difference > kGoldenTolerance ? 0 : intensity);
+        heat[i * 4 + 2] = static_cast<unsigned char>(difference == 0 ? background : 0);
+        heat[i * 4 + 3] = 255;
+    }
+    return heat;
+}
+
+/// <summary>
+/// Compares a pose's pixels with its reference. A pose without a reference fails.
+/// </summary>
+inline GoldenResult CompareGoldenImage(const unsigned char* pixels, const std::string& referencePath, std::vector<unsigned char>& reference)
+{
+    GoldenResult result = { false, 255, static_cast<size_t>(kGoldenWidth) * kGoldenHeight };
+    int width, height, channels;
+    stbi_set_flip_vertically_on_load(false);
+    unsigned char* data = stbi_load(referencePath.c_str(), &width, &height, &channels, 4);
+    if (data == nullptr || width != kGoldenWidth || height != kGoldenHeight)
+    {
+        stbi_image_free(data);
+        reference.clear();
+        return result;
+    }
+    reference.assign(data, data + static_cast<size_t>(width) * height * 4);
+    stbi_image_free(data);
+
+    result.maxDifference = 0;
+    result.failingPixels = 0;
+    for (size_t i = 0; i < reference.size(); i += 4)
+    {
+        int difference = std::max({ std::abs(pixels[i] - reference[i]), std::abs(pixels[i + 1] - reference[i + 1]),
+            std::abs(pixels[i + 2] - reference[i + 2]) });
+        result.maxDifference = std::max(result.maxDifference, difference);
+        if (difference > kGoldenTolerance)
+        {
+            result.failingPixels++;
+        }
+    }
+    result.passed = result.failingPixels <= kGoldenMaxFailingFraction * kGoldenWidth * kGoldenHeight;
+    return result;
+}
+
+/// <summary>
+/// Checks every pose whose pixels have arrived. A failing pose leaves NAME.actual.ppm
+/// and NAME.diff.ppm next to its reference.
+/// </summary>
+/// <param name="wait">Wait for every read in flight, e.g. when the loop ends</param>
+/// <returns>True once every pose has been checked</returns>
+inline bool FinishGoldenReadbacks(GoldenRun& run, bool wait, std::ostream& report)
+{
+    int poseIndex;
+    while (FinishPixelReadback(run.readbacks, run.pixels, poseIndex, wait))
+    {
+        const GoldenPose& pose = run.poses[poseIndex];
+        std::string base = run.directory + "/" + pose.name;
+        run.finishedPoses++;
+        if (run.pixels.empty())
+        {
+            report << "Golden image " << pose.name << ": FAILED to read the frame back" << std::endl;
+            run.failures++;
+            continue;
+        }
+        if (run.update)
+        {
+            if (WritePpm(base + ".ppm", run.pixels.data(), kGoldenWidth, kGoldenHeight))
+            {
+                report << "Golden image " << pose.name << ": reference written to " << base << ".ppm" << std::endl;
+            }
+            else
+            {
+                report << "Golden image " << pose.name << ": FAILED to write " << base << ".ppm" << std::endl;
+                run.failures++;
+            }
+            continue;
+        }
+
+        std::vector<unsigned char> reference;
+        GoldenResult result = CompareGoldenImage(run.pixels.data(), base + ".ppm", reference);
+        if (reference.empty())
+        {
+            report << "Golden image " << pose.name << ": FAILED, no reference " << base << ".ppm of "
+                << kGoldenWidth << "x" << kGoldenHeight << std::endl;
+        }
+        else
+        {
+            report << std::fixed << std::setprecision(3) << "Golden image " << pose.name << ": " << (result.passed ? "passed" : "FAILED")
+                << ", max difference " << result.maxDifference << ", " << result.failingPixels << " pixels ("
+                << 100.0 * result.failingPixels / (kGoldenWidth * kGoldenHeight) << "%) beyond " << kGoldenTolerance
+                << std::defaultfloat << std::endl;
+        }
+        if (!result.passed)
+        {
+            run.failures++;
+            WritePpm(base + ".actual.ppm", run.pixels.data(), kGoldenWidth, kGoldenHeight);
+            if (!reference.empty())
+            {
+                std::vector<unsigned char> heat = GoldenDiffHeatMap(run.pixels.data(), reference.data(), reference.size() / 4);
+                WritePpm(base + ".diff.ppm", heat.data(), kGoldenWidth, kGoldenHeight);
+            }
+        }
+    }
+    return run.finishedPoses == run.poses.size();
+}
@@ -0,0 +1,369 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Frames a frame's timestamp queries wait before they are read. By then the GPU has long
+/// finished them, so reading never stalls; a frame whose results are still not in is dropped.
+/// </summary>
+const int kGpuProfilerLatency = 4;
+
+/// <summary>
+/// Samples per scope the rolling min/avg/p99 are computed over.
+/// </summary>
+const int kGpuProfilerWindow = 256;
+
+/// <summary>
+/// Frames between two prints of the statistics.
+/// </summary>
+const int kGpuProfilerReportFrames = 300;
+
+/// <summary>
+/// Most scopes a trace keeps, so a long run cannot use up the memory.
+/// </summary>
+const size_t kMaxGpuTraceEvents = 1 << 18;
+
+/// <summary>
+/// Rolling GPU times of one named scope, in milliseconds.
+/// </summary>
+struct GpuScopeStats
+{
+    const char* name;
+    std::vector<double> samples;
+    size_t next;
+};
+
+/// <summary>
+/// One scope of a frame: the indices of its begin and end timestamp queries in the frame's pool.
+/// </summary>
+struct GpuScopeRecord
+{
+    int scope;
+    int depth;
+    size_t beginQuery;
+    size_t endQuery;
+};
+
+/// <summary>
+/// The queries of one frame in flight. The pool only grows, so after the first frames no queries are created.
+/// </summary>
+struct GpuProfilerFrame
+{
+    std::vector<GLuint> queries;
+    size_t usedQueries;
+    std::vector<GpuScopeRecord> records;
+    bool pending;
+};
+
+/// <summary>
+/// A resolved scope, kept for the Chrome trace.
+/// </summary>
+struct GpuTraceEvent
+{
+    int scope;
+    int depth;
+    GLuint64 begin;
+    GLuint64 end;
+};
+
+/// <summary>
+/// Times nested scopes of the render loop on the GPU with GL_TIMESTAMP queries, reading every
+/// frame's results kGpuProfilerLatency frames later.
+/// </summary>
+struct GpuProfiler
+{
+    std::vector<GpuScopeStats> scopes;
+    GpuProfilerFrame frames[kGpuProfilerLatency];
+    uint64_t frameIndex;
+    std::vector<size_t> openRecords;
+
+    int framesSinceReport;
+    int droppedFrames;
+
+    bool tracing;
+    std::vector<GpuTraceEvent> trace;
+};
+
+inline GpuProfiler CreateGpuProfiler(bool tracing)
+{
+    GpuProfiler profiler;
+    for (GpuProfilerFrame& frame : profiler.frames)
+    {
+        frame.usedQueries = 0;
+        frame.pending = false;
+    }
+    profiler.frameIndex = 0;
+    profiler.framesSinceReport = 0;
+    profiler.droppedFrames = 0;
+    profiler.tracing = tracing;
+    return profiler;
+}
+
+inline void DeleteGpuProfiler(GpuProfiler& profiler)
+{
+    for (GpuProfilerFrame& frame : profiler.frames)
+    {
+        if (!frame.queries.empty())
+        {
+            glDeleteQueries(static_cast<GLsizei>(frame.queries.size()), frame.queries.data());
+        }
+        frame.queries.clear();
+    }
+}
+
+/// <summary>
+/// Index of a scope name, adding it the first time it is seen. Names are string literals,
+/// so they are compared by address first.
+/// </summary>
+inline int GpuScopeIndex(GpuProfiler& profiler, const char* name)
+{
+    for (size_t i = 0; i < profiler.scopes.size(); i++)
+    {
+        if (profiler.scopes[i].name == name || std::strcmp(profiler.scopes[i].name, name) == 0)
+        {
+            return static_cast<int>(i);
+        }
+    }
+    profiler.scopes.push_back({ name, {}, 0 });
+    return static_cast<int>(profiler.scopes.size() - 1);
+}
+
+inline GpuProfilerFrame& CurrentGpuFrame(GpuProfiler& profiler)
+{
+    return profiler.frames[profiler.frameIndex % kGpuProfilerLatency];
+}
+
+/// <summary>
+/// Writes a timestamp into the next free query of this frame's pool.
+/// </summary>
+/// <returns>Index of the query in the pool</returns>
+inline size_t WriteGpuTimestamp(GpuProfilerFrame& frame)
+{
+    if (frame.usedQueries == frame.queries.size())
+    {
+        GLuint query;
+        glGenQueries(1, &query);
+        frame.queries.push_back(query);
+    }
+    glQueryCounter(frame.queries[frame.usedQueries], GL_TIMESTAMP);
+    return frame.usedQueries++;
+}
+
+/// <summary>
+/// Opens a scope. Scopes nest; every BeginGpuScope needs an EndGpuScope in the same frame.
+/// </summary>
+/// <param name="profiler">Profiler, or nullptr to do nothing</param>
+/// <param name="name">Static name of the scope</param>
+inline void BeginGpuScope(GpuProfiler* profiler, const char* name)
+{
+    if (profiler == nullptr)
+    {
+        return;
+    }
+    GpuProfilerFrame& frame = CurrentGpuFrame(*profiler);
+    GpuScopeRecord record;
+    record.scope = GpuScopeIndex(*profiler, name);
+    record.depth = static_cast<int>(profiler->openRecords.size());
+    record.beginQuery = WriteGpuTimestamp(frame);
+    record.endQuery = record.beginQuery;
+    profiler->openRecords.push_back(frame.records.size());
+    frame.records.push_back(record);
+}
+
+/// <summary>
+/// Closes the innermost open scope.
+/// </summary>
+inline void EndGpuScope(GpuProfiler* profiler)
+{
+    if (profiler == nullptr || profiler->openRecords.empty())
+    {
+        return;
+    }
+    GpuProfilerFrame& frame = CurrentGpuFrame(*profiler);
+    frame.records[profiler->openRecords.back()].endQuery = WriteGpuTimestamp(frame);
+    profiler->openRecords.pop_back();
+}
+
+/// <summary>
+/// Opens a scope for the lifetime of the object.
+/// </summary>
+struct GpuScope
+{
+    GpuProfiler* profiler;
+
+    GpuScope(GpuProfiler* profiler, const char* name) : profiler(profiler)
+    {
+        BeginGpuScope(profiler, name);
+    }
+
+    ~GpuScope()
+    {
+        EndGpuScope(profiler);
+    }
+};
+
+/// <summary>
+/// Reads the results of the frame that last used the current slot, if they are in.
+/// </summary>
+inline void ResolveGpuFrame(GpuProfiler& profiler, GpuProfilerFrame& frame)
+{
+    if (!frame.pending)
+    {
+        return;
+    }
+    frame.pending = false;
+
+    // Queries finish in order, so the last one being available means they all are
+    GLint available = GL_FALSE;
+    glGetQueryObjectiv(frame.queries[frame.usedQueries - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available != GL_TRUE)
+    {
+        profiler.droppedFrames++;
+        return;
+    }
+
+    std::vector<GLuint64> timestamps(frame.usedQueries);
+    for (size_t i = 0; i < frame.usedQueries; i++)
+    {
+        glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &timestamps[i]);
+    }
+    for (const GpuScopeRecord& record : frame.records)
+    {
+        GLuint64 begin = timestamps[record.beginQuery];
+        GLuint64 end = std::max(timestamps[record.endQuery], begin);
+        GpuScopeStats& stats = profiler.scopes[record.scope];
+        double milliseconds = (end - begin) / 1.0e6;
+        if (stats.samples.size() < static_cast<size_t>(kGpuProfilerWindow))
+        {
+            stats.samples.push_back(milliseconds);
+        }
+        else
+        {
+            stats.samples[stats.next] = milliseconds;
+        }
+        stats.next = (stats.next + 1) % kGpuProfilerWindow;
+
+        if (profiler.tracing && profiler.trace.size() < kMaxGpuTraceEvents)
+        {
+            profiler.trace.push_back({ record.scope, record.depth, begin, end });
+        }
+    }
+}
+
+/// <summary>
+/// Starts recording a frame into the oldest slot, after reading what that slot held.
+/// </summary>
+inline void BeginGpuFrame(GpuProfiler& profiler)
+{
+    GpuProfilerFrame& frame = CurrentGpuFrame(profiler);
+    ResolveGpuFrame(profiler, frame);
+    frame.usedQueries = 0;
+    frame.records.clear();
+    profiler.openRecords.clear();
+}
+
+/// <summary>
+/// Ends the frame, leaving its queries to be read kGpuProfilerLatency frames from now.
+/// </summary>
+inline void EndGpuFrame(GpuProfiler& profiler)
+{
+    GpuProfilerFrame& frame = CurrentGpuFrame(profiler);
+    frame.pending = frame.usedQueries != 0;
+    profiler.frameIndex++;
+    profiler.framesSinceReport++;
+}
+
+/// <summary>
+/// Waits for the GPU and reads every frame still in flight, oldest first, e.g. before writing a trace.
+/// </summary>
+inline void FlushGpuProfiler(GpuProfiler& profiler)
+{
+    glFinish();
+    for (int i = 0; i < kGpuProfilerLatency; i++)
+    {
+        ResolveGpuFrame(profiler, profiler.frames[(profiler.frameIndex + i) % kGpuProfilerLatency]);
+    }
+}
+
+/// <summary>
+/// GPU time of a scope in the latest frame read back, kGpuProfilerLatency frames behind the one being rendered.
+/// </summary>
+/// <returns>Milliseconds, or 0 if the scope has not been read back yet</returns>
+inline double LatestGpuScopeMilliseconds(const GpuProfiler& profiler, const char* name)
+{
+    for (const GpuScopeStats& stats : profiler.scopes)
+    {
+        if (!stats.samples.empty() && (stats.name == name || std::strcmp(stats.name, name) == 0))
+        {
+            return stats.samples[(stats.next + stats.samples.size() - 1) % stats.samples.size()];
+        }
+    }
+    return 0.0;
+}
+
+/// <summary>
+/// Prints min/avg/p99 of every scope over the last kGpuProfilerWindow frames, every kGpuProfilerReportFrames frames.
+/// </summary>
+inline void ReportGpuProfiler(GpuProfiler& profiler, std::ostream& report)
+{
+    if (profiler.framesSinceReport < kGpuProfilerReportFrames)
+    {
+        return;
+    }
+    profiler.framesSinceReport = 0;
+
+    report << std::fixed << std::setprecision(3) << "GPU time (ms, min/avg/p99 over the last " << kGpuProfilerWindow << " frames):";
+    for (const GpuScopeStats& stats : profiler.scopes)
+    {
+        if (stats.samples.empty())
+        {
+            continue;
+        }
+        std::vector<double> sorted = stats.samples;
+        std::sort(sorted.begin(), sorted.end());
+        double total = 0.0;
+        for (double sample : sorted)
+        {
+            total += sample;
+        }
+        size_t p99 = (sorted.size() * 99 + 99) / 100 - 1;
+        report << " " << stats.name << " " << sorted.front() << "/" << total / sorted.size() << "/" << sorted[p99] << ";";
+    }
+    if (profiler.droppedFrames != 0)
+    {
+        report << " " << profiler.droppedFrames << " frames dropped";
+    }
+    report << std::defaultfloat << std::endl;
+}
+
+/// <summary>
+/// Writes the traced scopes as Chrome trace JSON, for chrome://tracing or Perfetto.
+/// </summary>
+/// <returns>False if the file could not be written</returns>
+inline bool WriteGpuTrace(const GpuProfiler& profiler, const std::string& path)
+{
+    std::ofstream file(path);
+    if (!file)
+    {
+        return false;
+    }
+    GLuint64 origin = profiler.trace.empty() ? 0 : profiler.trace.front().begin;
+    file << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n";
+    for (size_t i = 0; i < profiler.trace.size(); i++)
+    {
+        const GpuTraceEvent& event = profiler.trace[i];
+        file << "{\"name\":\"" << profiler.scopes[event.scope].name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":\"GPU\""
+            << ",\"ts\":" << (event.begin - origin) / 1000.0 << ",\"dur\":" << (event.end - event.begin) / 1000.0
+            << ",\"args\":{\"depth\":" << event.depth << "}}" << (i + 1 < profiler.trace.size() ? ",\n" : "\n");
+    }
+    file << "],\"displayTimeUnit\":\"ms\"}\n";
+    return static_cast<bool>(file);
+}
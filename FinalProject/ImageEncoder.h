@@ -0,0 +1,239 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "CpuProfiler.h"
+#include "ImageFiles.h"
+
+/// <summary>
+/// File formats the encoder writes.
+/// </summary>
+enum class ImageFormat
+{
+    Ppm,
+    Png,
+
+    // Frames of the encoder's Y4M stream rather than files of their own
+    Y4m
+};
+
+inline const char* ImageFormatExtension(ImageFormat format)
+{
+    switch (format)
+    {
+    case ImageFormat::Png:
+        return ".png";
+    case ImageFormat::Y4m:
+        return ".y4m";
+    default:
+        return ".ppm";
+    }
+}
+
+/// <summary>
+/// An image waiting to be written: RGBA8 pixels, top row first.
+/// </summary>
+struct ImageJob
+{
+    std::string path;
+    std::vector<unsigned char> pixels;
+    int width;
+    int height;
+    ImageFormat format;
+
+    // Position of a Y4M frame in the stream, counting from 0
+    uint64_t streamIndex;
+};
+
+/// <summary>
+/// Writes images to disk on threads of its own, so the render loop only hands the pixels over.
+/// The threads take jobs in the order they were queued. With a capacity, queueing blocks while
+/// that many jobs wait, which holds a renderer faster than the disk back instead of filling the memory.
+/// </summary>
+struct ImageEncoder
+{
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable space;
+    std::deque<ImageJob> jobs;
+    size_t capacity;
+    std::vector<std::thread> threads;
+    bool stopping;
+
+    // Y4M frames are converted in parallel but appended to the stream one at a time, in order
+    std::ofstream stream;
+    uint64_t nextStreamIndex;
+    std::condition_variable streamTurn;
+
+    // Guarded by the mutex
+    int written;
+    int failed;
+
+    // Back-pressure: how often and how long queueing waited for room
+    int fullWaits;
+    double fullSeconds;
+};
+
+/// <summary>
+/// Writes an image file. A job without pixels, whose read back failed, fails.
+/// </summary>
+inline bool EncodeImage(const ImageJob& job)
+{
+    CPU_ZONE("Image encoding");
+    if (job.pixels.empty())
+    {
+        return false;
+    }
+    if (job.format == ImageFormat::Png)
+    {
+        return WritePng(job.path, job.pixels.data(), job.width, job.height);
+    }
+    return WritePpm(job.path, job.pixels.data(), job.width, job.height);
+}
+
+/// <summary>
+/// Converts a frame of the stream, then waits for the frames before it to be written and appends it.
+/// A job without pixels, whose read back failed, still takes its turn so the frames after it are
+/// not held up, but fails without writing anything. Called without the encoder's mutex held.
+/// </summary>
+inline bool EncodeStreamFrame(ImageEncoder& encoder, const ImageJob& job)
+{
+    std::vector<unsigned char> yuv;
+    if (!job.pixels.empty())
+    {
+        CPU_ZONE("Image encoding");
+        RgbaToYuv420(job.pixels.data(), job.width, job.height, yuv);
+    }
+    {
+        std::unique_lock<std::mutex> lock(encoder.mutex);
+        encoder.streamTurn.wait(lock, [&encoder, &job] { return encoder.nextStreamIndex == job.streamIndex; });
+    }
+
+    // Until the index moves on no other thread touches the stream
+    bool succeeded = false;
+    if (!yuv.empty())
+    {
+        WriteY4mFrame(encoder.stream, yuv);
+        succeeded = static_cast<bool>(encoder.stream);
+    }
+    {
+        std::lock_guard<std::mutex> lock(encoder.mutex);
+        encoder.nextStreamIndex++;
+    }
+    encoder.streamTurn.notify_all();
+    return succeeded;
+}
+
+/// <summary>
+/// Takes jobs until the encoder stops and nothing is left to write.
+/// </summary>
+inline void RunImageEncoder(ImageEncoder& encoder)
+{
+    NameCpuProfilerThread("Image encoder");
+    std::unique_lock<std::mutex> lock(encoder.mutex);
+    for (;;)
+    {
+        encoder.wake.wait(lock, [&encoder] { return encoder.stopping || !encoder.jobs.empty(); });
+        if (encoder.jobs.empty())
+        {
+            return;
+        }
+        ImageJob job = std::move(encoder.jobs.front());
+        encoder.jobs.pop_front();
+        encoder.space.notify_one();
+
+        lock.unlock();
+        bool succeeded = job.format == ImageFormat::Y4m ? EncodeStreamFrame(encoder, job) : EncodeImage(job);
+        lock.lock();
+        (succeeded ? encoder.written : encoder.failed)++;
+    }
+}
+
+/// <summary>
+/// Starts the threads. The encoder holds a mutex, so it is started where it lives instead of being returned.
+/// </summary>
+/// <param name="capacity">Most jobs waiting before QueueImage blocks, 0 for no limit</param>
+inline void StartImageEncoder(ImageEncoder& encoder, int threadCount, size_t capacity = 0)
+{
+    encoder.capacity = capacity;
+    encoder.stopping = false;
+    encoder.nextStreamIndex = 0;
+    encoder.written = 0;
+    encoder.failed = 0;
+    encoder.fullWaits = 0;
+    encoder.fullSeconds = 0.0;
+    for (int i = 0; i < threadCount; i++)
+    {
+        encoder.threads.emplace_back(RunImageEncoder, std::ref(encoder));
+    }
+}
+
+/// <summary>
+/// Creates the Y4M file the encoder appends ImageFormat::Y4m jobs to, and writes its header.
+/// Call before queueing any of them.
+/// </summary>
+/// <returns>False if the file could not be created</returns>
+inline bool OpenImageStream(ImageEncoder& encoder, const std::string& path, int width, int height, int framesPerSecond)
+{
+    encoder.stream.open(path, std::ios::binary);
+    if (!encoder.stream)
+    {
+        return false;
+    }
+    WriteY4mHeader(encoder.stream, width, height, framesPerSecond);
+    return static_cast<bool>(encoder.stream);
+}
+
+/// <summary>
+/// Hands an image over to the threads, taking its pixels. Blocks while the queue is at capacity.
+/// </summary>
+inline void QueueImage(ImageEncoder& encoder, ImageJob&& job)
+{
+    {
+        std::unique_lock<std::mutex> lock(encoder.mutex);
+        if (encoder.capacity != 0 && encoder.jobs.size() >= encoder.capacity)
+        {
+            CPU_ZONE("Encoder queue full");
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            encoder.space.wait(lock, [&encoder] { return encoder.jobs.size() < encoder.capacity; });
+            encoder.fullWaits++;
+            encoder.fullSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        encoder.jobs.push_back(std::move(job));
+    }
+    encoder.wake.notify_one();
+}
+
+/// <summary>
+/// Writes every image still queued, then stops the threads.
+/// </summary>
+inline void StopImageEncoder(ImageEncoder& encoder)
+{
+    {
+        std::lock_guard<std::mutex> lock(encoder.mutex);
+        encoder.stopping = true;
+    }
+    encoder.wake.notify_all();
+    for (std::thread& thread : encoder.threads)
+    {
+        thread.join();
+    }
+    encoder.threads.clear();
+    if (encoder.stream.is_open())
+    {
+        encoder.stream.close();
+        if (encoder.stream.fail())
+        {
+            encoder.failed++;
+        }
+    }
+}
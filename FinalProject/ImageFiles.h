@@ -0,0 +1,224 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Writes RGBA8 pixels, top row first, as a binary PPM. The alpha channel is dropped.
+/// </summary>
+/// <returns>False if the file could not be written</returns>
+inline bool WritePpm(const std::string& path, const unsigned char* pixels, int width, int height)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    file << "P6\n" << width << " " << height << "\n255\n";
+    std::vector<char> row(static_cast<size_t>(width) * 3);
+    for (int y = 0; y < height; y++)
+    {
+        const unsigned char* source = pixels + static_cast<size_t>(y) * width * 4;
+        for (int x = 0; x < width; x++)
+        {
+            row[x * 3 + 0] = static_cast<char>(source[x * 4 + 0]);
+            row[x * 3 + 1] = static_cast<char>(source[x * 4 + 1]);
+            row[x * 3 + 2] = static_cast<char>(source[x * 4 + 2]);
+        }
+        file.write(row.data(), row.size());
+    }
+    return static_cast<bool>(file);
+}
+
+/// <summary>
+/// CRC-32 of the PNG chunks, continuing from the CRC of the bytes before.
+/// </summary>
+inline uint32_t Crc32(const unsigned char* data, size_t size, uint32_t crc = 0)
+{
+    // Built once, on whichever thread gets here first; the others wait for it
+    static const std::vector<uint32_t> table = [] {
+        std::vector<uint32_t> values(256);
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                value = (value & 1) != 0 ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+            }
+            values[i] = value;
+        }
+        return values;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+inline void AppendBigEndian(std::vector<unsigned char>& bytes, uint32_t value)
+{
+    bytes.push_back(static_cast<unsigned char>(value >> 24));
+    bytes.push_back(static_cast<unsigned char>(value >> 16));
+    bytes.push_back(static_cast<unsigned char>(value >> 8));
+    bytes.push_back(static_cast<unsigned char>(value));
+}
+
+/// <summary>
+/// Writes a PNG chunk: its length, type, data and the CRC of the type and data.
+/// </summary>
+inline void WritePngChunk(std::ofstream& file, const char type[4], const std::vector<unsigned char>& data)
+{
+    std::vector<unsigned char> chunk;
+    AppendBigEndian(chunk, static_cast<uint32_t>(data.size()));
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    AppendBigEndian(chunk, Crc32(chunk.data() + 4, chunk.size() - 4));
+    file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+}
+
+/// <summary>
+/// Writes RGBA8 pixels, top row first, as an RGB PNG. The alpha channel is dropped.
+/// The image data goes into stored deflate blocks without compressing it: the file is about as
+/// big as a PPM, but it is written as fast and every viewer opens it.
+/// </summary>
+/// <returns>False if the file could not be written</returns>
+inline bool WritePng(const std::string& path, const unsigned char* pixels, int width, int height)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+    // Width, height, 8 bits per channel, RGB, deflate, adaptive filters, not interlaced
+    std::vector<unsigned char> header;
+    AppendBigEndian(header, static_cast<uint32_t>(width));
+    AppendBigEndian(header, static_cast<uint32_t>(height));
+    header.insert(header.end(), { 8, 2, 0, 0, 0 });
+    WritePngChunk(file, "IHDR", header);
+
+    // Every row starts with its filter type, 0 for none
+    size_t rowBytes = static_cast<size_t>(width) * 3 + 1;
+    std::vector<unsigned char> rows(rowBytes * height);
+    for (int y = 0; y < height; y++)
+    {
+        unsigned char* row = &rows[y * rowBytes];
+        const unsigned char* source = pixels + static_cast<size_t>(y) * width * 4;
+        row[0] = 0;
+        for (int x = 0; x < width; x++)
+        {
+            row[1 + x * 3 + 0] = source[x * 4 + 0];
+            row[1 + x * 3 + 1] = source[x * 4 + 1];
+            row[1 + x * 3 + 2] = source[x * 4 + 2];
+        }
+    }
+
+    // A zlib stream of stored blocks of at most 65535 bytes, each with its length and the length's complement
+    std::vector<unsigned char> zlib = { 0x78, 0x01 };
+    uint32_t adlerLow = 1;
+    uint32_t adlerHigh = 0;
+    for (size_t offset = 0;; offset += 65535)
+    {
+        size_t length = std::min<size_t>(rows.size() - offset, 65535);
+        bool last = offset + length == rows.size();
+        zlib.push_back(last ? 1 : 0);
+        zlib.push_back(static_cast<unsigned char>(length));
+        zlib.push_back(static_cast<unsigned char>(length >> 8));
+        zlib.push_back(static_cast<unsigned char>(~length));
+        zlib.push_back(static_cast<unsigned char>(~length >> 8));
+        zlib.insert(zlib.end(), rows.begin() + offset, rows.begin() + offset + length);
+        for (size_t i = offset; i < offset + length; i++)
+        {
+            adlerLow = (adlerLow + rows[i]) % 65521;
+            adlerHigh = (adlerHigh + adlerLow) % 65521;
+        }
+        if (last)
+        {
+            break;
+        }
+    }
+    AppendBigEndian(zlib, (adlerHigh << 16) | adlerLow);
+    WritePngChunk(file, "IDAT", zlib);
+    WritePngChunk(file, "IEND", {});
+    return static_cast<bool>(file);
+}
+
+/// <summary>
+/// Converts RGBA8 pixels, top row first, to the planes of a 4:2:0 frame: full resolution Y, then U and V
+/// at half the width and height, rounded up. Full range BT.601, as Y4M's C420jpeg expects.
+/// </summary>
+inline void RgbaToYuv420(const unsigned char* pixels, int width, int height, std::vector<unsigned char>& yuv)
+{
+    int chromaWidth = (width + 1) / 2;
+    int chromaHeight = (height + 1) / 2;
+    size_t lumaSize = static_cast<size_t>(width) * height;
+    size_t chromaSize = static_cast<size_t>(chromaWidth) * chromaHeight;
+    yuv.resize(lumaSize + 2 * chromaSize);
+    unsigned char* u = &yuv[lumaSize];
+    unsigned char* v = &yuv[lumaSize + chromaSize];
+
+    auto clamp = [](int value) {
+        return static_cast<unsigned char>(std::min(std::max(value, 0), 255));
+    };
+    for (int y = 0; y < height; y++)
+    {
+        const unsigned char* row = pixels + static_cast<size_t>(y) * width * 4;
+        for (int x = 0; x < width; x++)
+        {
+            // Fixed point, 8 fractional bits
+            int luma = (77 * row[x * 4] + 150 * row[x * 4 + 1] + 29 * row[x * 4 + 2] + 128) >> 8;
+            yuv[static_cast<size_t>(y) * width + x] = clamp(luma);
+        }
+    }
+
+    // Chroma of every 2x2 block from its average color
+    for (int cy = 0; cy < chromaHeight; cy++)
+    {
+        for (int cx = 0; cx < chromaWidth; cx++)
+        {
+            int sum[3] = { 0, 0, 0 };
+            int count = 0;
+            for (int y = cy * 2; y < std::min(cy * 2 + 2, height); y++)
+            {
+                for (int x = cx * 2; x < std::min(cx * 2 + 2, width); x++)
+                {
+                    const unsigned char* pixel = pixels + (static_cast<size_t>(y) * width + x) * 4;
+                    sum[0] += pixel[0];
+                    sum[1] += pixel[1];
+                    sum[2] += pixel[2];
+                    count++;
+                }
+            }
+            int r = sum[0] / count;
+            int g = sum[1] / count;
+            int b = sum[2] / count;
+            u[cy * chromaWidth + cx] = clamp(((-43 * r - 85 * g + 128 * b + 128) >> 8) + 128);
+            v[cy * chromaWidth + cx] = clamp(((128 * r - 107 * g - 21 * b + 128) >> 8) + 128);
+        }
+    }
+}
+
+/// <summary>
+/// Writes the header of a Y4M stream of 4:2:0 frames, the raw video format ffmpeg and most players read.
+/// </summary>
+inline void WriteY4mHeader(std::ostream& file, int width, int height, int framesPerSecond)
+{
+    file << "YUV4MPEG2 W" << width << " H" << height << " F" << framesPerSecond << ":1 Ip A1:1 C420jpeg\n";
+}
+
+/// <summary>
+/// Appends a frame converted by RgbaToYuv420 to a Y4M stream.
+/// </summary>
+inline void WriteY4mFrame(std::ostream& file, const std::vector<unsigned char>& yuv)
+{
+    file << "FRAME\n";
+    file.write(reinterpret_cast<const char*>(yuv.data()), yuv.size());
+}
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Simulation.h"
+
+/// <summary>
+/// Keys the scene reads, as bits of InputFrame::keys.
+/// </summary>
+const uint32_t kInputKeyW = 1u << 0;
+const uint32_t kInputKeyS = 1u << 1;
+const uint32_t kInputKeyD = 1u << 2;
+const uint32_t kInputKeyA = 1u << 3;
+const uint32_t kInputKeyUp = 1u << 4;
+const uint32_t kInputKeyDown = 1u << 5;
+const uint32_t kInputKeyRight = 1u << 6;
+const uint32_t kInputKeyLeft = 1u << 7;
+const uint32_t kInputKeySpace = 1u << 8;
+
+/// <summary>
+/// Set in a recorded frame's key bits when a cursor delta follows them.
+/// </summary>
+const uint32_t kInputCursorMoved = 1u << 9;
+
+/// <summary>
+/// First bytes of a recording, and the version of the format after them.
+/// </summary>
+const char kInputRecordingMagic[4] = { 'G', 'D', 'I', 'R' };
+const uint32_t kInputRecordingVersion = 1;
+
+/// <summary>
+/// Everything that reached the scene in one frame: the keys held, how far the cursor moved and how
+/// long the frame took. A frame replayed from these runs the same steps with the same input.
+/// </summary>
+struct InputFrame
+{
+    uint32_t keys;
+
+    // In pixels, x to the right and y up, summed over the frame's cursor events
+    glm::vec2 cursorDelta;
+
+    // Time since the previous frame, in ticks of the recording's timer
+    uint64_t elapsedTicks;
+};
+
+/// <summary>
+/// The input the simulation steps of a frame see. Forward wins over back and right over left.
+/// </summary>
+inline SimulationInput SimulationInputFromFrame(const InputFrame& frame, const glm::vec3& cameraFront, const glm::vec3& cameraUp)
+{
+    auto axis = [&frame](uint32_t positiveKey, uint32_t negativeKey) {
+        if ((frame.keys & positiveKey) != 0) {
+            return 1;
+        }
+        return (frame.keys & negativeKey) != 0 ? -1 : 0;
+    };
+
+    SimulationInput input;
+    input.cameraForward = axis(kInputKeyW, kInputKeyS);
+    input.cameraRight = axis(kInputKeyD, kInputKeyA);
+    input.faceForward = axis(kInputKeyUp, kInputKeyDown);
+    input.faceRight = axis(kInputKeyRight, kInputKeyLeft);
+    input.toggleNight = (frame.keys & kInputKeySpace) != 0;
+    input.cameraFront = cameraFront;
+    input.cameraUp = cameraUp;
+    return input;
+}
+
+/// <summary>
+/// Length of a frame in seconds, computed exactly as SimulationClock does so that a replay runs the same steps.
+/// </summary>
+inline double InputFrameSeconds(const InputFrame& frame, uint64_t frequency)
+{
+    return static_cast<double>(frame.elapsedTicks) / static_cast<double>(frequency);
+}
+
+/// <summary>
+/// Writes the input of every frame to a file as it happens.
+/// The file starts with the magic, the version, the timer frequency and the simulation seed.
+/// Each frame is then the key bits and the elapsed ticks as variable length integers,
+/// followed by the cursor delta as two floats if the cursor moved. An idle frame takes about five bytes.
+/// </summary>
+struct InputRecorder
+{
+    std::ofstream file;
+    uint64_t frames;
+};
+
+/// <summary>
+/// Writes an unsigned integer seven bits per byte, low bits first, the high bit set on all but the last byte.
+/// </summary>
+inline void WriteVarint(std::ostream& file, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        file.put(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    file.put(static_cast<char>(value));
+}
+
+/// <summary>
+/// Writes the bytes of a value little endian first, whatever the machine's byte order.
+/// </summary>
+inline void WriteLittleEndian(std::ostream& file, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        file.put(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+inline void WriteLittleEndianFloat(std::ostream& file, float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    WriteLittleEndian(file, bits, 4);
+}
+
+/// <summary>
+/// Creates the file and writes its header.
+/// </summary>
+/// <returns>False if the file could not be created</returns>
+inline bool OpenInputRecorder(InputRecorder& recorder, const std::string& path, uint64_t frequency, uint32_t seed)
+{
+    recorder.file.open(path, std::ios::binary);
+    recorder.frames = 0;
+    if (!recorder.file)
+    {
+        return false;
+    }
+    recorder.file.write(kInputRecordingMagic, sizeof(kInputRecordingMagic));
+    WriteLittleEndian(recorder.file, kInputRecordingVersion, 4);
+    WriteLittleEndian(recorder.file, frequency, 8);
+    WriteLittleEndian(recorder.file, seed, 4);
+    return static_cast<bool>(recorder.file);
+}
+
+inline void RecordInputFrame(InputRecorder& recorder, const InputFrame& frame)
+{
+    bool cursorMoved = frame.cursorDelta != glm::vec2(0.0f);
+    WriteVarint(recorder.file, frame.keys | (cursorMoved ? kInputCursorMoved : 0u));
+    WriteVarint(recorder.file, frame.elapsedTicks);
+    if (cursorMoved)
+    {
+        WriteLittleEndianFloat(recorder.file, frame.cursorDelta.x);
+        WriteLittleEndianFloat(recorder.file, frame.cursorDelta.y);
+    }
+    recorder.frames++;
+}
+
+/// <summary>
+/// Flushes and closes the file.
+/// </summary>
+/// <returns>False if any of it could not be written</returns>
+inline bool CloseInputRecorder(InputRecorder& recorder)
+{
+    recorder.file.close();
+    return !recorder.file.fail();
+}
+
+/// <summary>
+/// A recording read back, handing out its frames in order.
+/// </summary>
+struct InputReplay
+{
+    uint64_t frequency;
+    uint32_t seed;
+    std::vector<InputFrame> frames;
+    size_t next;
+};
+
+/// <summary>
+/// Reads a whole recording.
+/// </summary>
+/// <param name="error">Receives why the file could not be read</param>
+/// <returns>False if the file is missing or of another format</returns>
+inline bool LoadInputReplay(InputReplay& replay, const std::string& path, std::string& error)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (!file.is_open())
+    {
+        error = "cannot open the file";
+        return false;
+    }
+
+    size_t offset = 0;
+    bool truncated = false;
+    auto readLittleEndian = [&](int count) {
+        uint64_t value = 0;
+        for (int i = 0; i < count; i++)
+        {
+            if (offset >= bytes.size())
+            {
+                truncated = true;
+                return value;
+            }
+            value |= static_cast<uint64_t>(bytes[offset++]) << (8 * i);
+        }
+        return value;
+    };
+    auto readVarint = [&]() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            if (offset >= bytes.size())
+            {
+                truncated = true;
+                return value;
+            }
+            unsigned char byte = bytes[offset++];
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                break;
+            }
+        }
+        return value;
+    };
+    auto readFloat = [&]() {
+        uint32_t bits = static_cast<uint32_t>(readLittleEndian(4));
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    };
+
+    if (bytes.size() < sizeof(kInputRecordingMagic) || std::memcmp(bytes.data(), kInputRecordingMagic, sizeof(kInputRecordingMagic)) != 0)
+    {
+        error = "not an input recording";
+        return false;
+    }
+    offset = sizeof(kInputRecordingMagic);
+    if (readLittleEndian(4) != kInputRecordingVersion)
+    {
+        error = "unsupported version";
+        return false;
+    }
+    replay.frequency = readLittleEndian(8);
+    replay.seed = static_cast<uint32_t>(readLittleEndian(4));
+    if (truncated || replay.frequency == 0)
+    {
+        error = "bad header";
+        return false;
+    }
+
+    replay.frames.clear();
+    replay.next = 0;
+    while (offset < bytes.size())
+    {
+        InputFrame frame;
+        uint64_t keys = readVarint();
+        frame.keys = static_cast<uint32_t>(keys) & ~kInputCursorMoved;
+        frame.elapsedTicks = readVarint();
+        frame.cursorDelta = glm::vec2(0.0f);
+        if ((keys & kInputCursorMoved) != 0)
+        {
+            frame.cursorDelta.x = readFloat();
+            frame.cursorDelta.y = readFloat();
+        }
+        if (truncated)
+        {
+            // The recording ended mid-frame, e.g. the program crashed: replay what is complete
+            break;
+        }
+        replay.frames.push_back(frame);
+    }
+    return true;
+}
+
+/// <summary>
+/// Hands out the next recorded frame.
+/// </summary>
+/// <returns>False once every frame has been replayed</returns>
+inline bool NextReplayFrame(InputReplay& replay, InputFrame& frame)
+{
+    if (replay.next >= replay.frames.size())
+    {
+        return false;
+    }
+    frame = replay.frames[replay.next++];
+    return true;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+/// <summary>
+/// Per-instance data of the instanced programs (main.vsh and depth.vsh).
+/// </summary>
+struct InstanceData
+{
+    glm::mat4 transform;
+    glm::ivec2 lightRange;
+};
+
+/// <summary>
+/// First attribute location of the per-instance data. The transform takes four
+/// locations, one per column, and the light range the one after them.
+/// </summary>
+const GLuint kInstanceTransformLocation = 4;
+const GLuint kInstanceLightRangeLocation = 8;
+
+/// <summary>
+/// Turns on the per-instance attributes of a vertex array object, advancing once per instance.
+/// Where they read from is set by PointInstanceAttributes right before each instanced draw.
+/// </summary>
+/// <param name="vao">Vertex array object used with an instanced program</param>
+inline void EnableInstanceAttributes(GLuint vao)
+{
+    glBindVertexArray(vao);
+    for (GLuint column = 0; column < 4; column++)
+    {
+        glEnableVertexAttribArray(kInstanceTransformLocation + column);
+        glVertexAttribDivisor(kInstanceTransformLocation + column, 1);
+    }
+    glEnableVertexAttribArray(kInstanceLightRangeLocation);
+    glVertexAttribDivisor(kInstanceLightRangeLocation, 1);
+    glBindVertexArray(0);
+}
+
+/// <summary>
+/// Points the per-instance attributes of the bound vertex array object at a run of instances.
+/// GL 3.3 has no base instance parameter on the draw calls, so the attribute offsets move instead.
+/// </summary>
+/// <param name="buffer">Buffer holding the InstanceData of the frame</param>
+/// <param name="firstInstance">Index of the first instance of the draw inside the buffer</param>
+inline void PointInstanceAttributes(GLuint buffer, GLint firstInstance)
+{
+    size_t base = firstInstance * sizeof(InstanceData);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    for (GLuint column = 0; column < 4; column++)
+    {
+        glVertexAttribPointer(kInstanceTransformLocation + column, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+            (void*)(base + offsetof(InstanceData, transform) + column * sizeof(glm::vec4)));
+    }
+    glVertexAttribIPointer(kInstanceLightRangeLocation, 2, GL_INT, sizeof(InstanceData),
+        (void*)(base + offsetof(InstanceData, lightRange)));
+}
@@ -0,0 +1,347 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <ostream>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "GLStateCache.h"
+#include "RenderStats.h"
+
+/// <summary>
+/// Most point lights a single frame can hold.
+/// </summary>
+const int kMaxPointLights = 1024;
+
+/// <summary>
+/// Texture units the light buffers are sampled from in main.fsh.
+/// </summary>
+const int kPointLightTextureUnit = 3;
+const int kLightIndexTextureUnit = 4;
+
+/// <summary>
+/// A light contributes nothing visible once its attenuated intensity drops below this.
+/// </summary>
+const float kLightCutoff = 1.0f / 256.0f;
+
+struct PointLight
+{
+    glm::vec3 position;
+    glm::vec3 ambient;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+    float constant;
+    float linear;
+    float quadratic;
+};
+
+/// <summary>
+/// GPU layout of one point light: four RGBA32F texels in the light texture buffer.
+/// FetchPointLight in main.fsh unpacks it in the same order.
+/// </summary>
+struct PackedPointLight
+{
+    glm::vec4 positionRadius;
+    glm::vec4 ambientConstant;
+    glm::vec4 diffuseLinear;
+    glm::vec4 specularQuadratic;
+};
+
+struct BoundingSphere
+{
+    glm::vec3 center;
+    float radius;
+};
+
+/// <summary>
+/// The point lights of one frame, plus the per-object lists of which lights reach which object.
+/// Both live in texture buffers so the shader can loop over any number of them.
+/// </summary>
+struct LightList
+{
+    GLuint lightBuffer;
+    GLuint lightTexture;
+    GLuint indexBuffer;
+    GLuint indexTexture;
+    GLsizeiptr indexCapacity;
+
+    std::vector<PackedPointLight> lights;
+    std::vector<GLint> indices;
+};
+
+/// <summary>
+/// Distance at which a light's attenuation pushes its brightest channel below kLightCutoff.
+/// </summary>
+/// <param name="light">Point light</param>
+/// <returns>Radius of influence of the light</returns>
+inline float PointLightRadius(const PointLight& light)
+{
+    // Colours can go negative (the lamp's sin() colour cycle), which darkens just as far
+    glm::vec3 brightest = glm::max(glm::max(glm::abs(light.ambient), glm::abs(light.diffuse)), glm::abs(light.specular));
+    float intensity = std::max(std::max(brightest.x, brightest.y), brightest.z);
+
+    // Solve quadratic * d^2 + linear * d + constant = intensity / cutoff for d
+    float c = light.constant - intensity / kLightCutoff;
+    if (c >= 0.0f)
+    {
+        return 0.0f;
+    }
+    if (light.quadratic <= 0.0f)
+    {
+        return light.linear > 0.0f ? -c / light.linear : 1e30f;
+    }
+    return (-light.linear + std::sqrt(light.linear * light.linear - 4.0f * light.quadratic * c)) / (2.0f * light.quadratic);
+}
+
+/// <summary>
+/// Creates the texture buffers that hold the light list.
+/// </summary>
+/// <returns>Light list with empty GPU buffers</returns>
+inline LightList CreateLightList()
+{
+    LightList list;
+
+    glGenBuffers(1, &list.lightBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, list.lightBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, kMaxPointLights * sizeof(PackedPointLight), nullptr, GL_DYNAMIC_DRAW);
+    glGenTextures(1, &list.lightTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, list.lightTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, list.lightBuffer);
+
+    list.indexCapacity = kMaxPointLights * sizeof(GLint);
+    glGenBuffers(1, &list.indexBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, list.indexBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, list.indexCapacity, nullptr, GL_DYNAMIC_DRAW);
+    glGenTextures(1, &list.indexTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, list.indexTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32I, list.indexBuffer);
+
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    list.lights.reserve(kMaxPointLights);
+    return list;
+}
+
+inline void DeleteLightList(LightList& list)
+{
+    glDeleteTextures(1, &list.lightTexture);
+    glDeleteTextures(1, &list.indexTexture);
+    glDeleteBuffers(1, &list.lightBuffer);
+    glDeleteBuffers(1, &list.indexBuffer);
+}
+
+/// <summary>
+/// Empties the list at the start of a frame.
+/// </summary>
+inline void ClearLightList(LightList& list)
+{
+    list.lights.clear();
+    list.indices.clear();
+}
+
+/// <summary>
+/// Adds a point light to this frame's list. Lights past kMaxPointLights are dropped.
+/// </summary>
+/// <returns>Index of the light, or -1 if the list is full</returns>
+inline int AddPointLight(LightList& list, const PointLight& light)
+{
+    if (static_cast<int>(list.lights.size()) >= kMaxPointLights)
+    {
+        return -1;
+    }
+
+    PackedPointLight packed;
+    packed.positionRadius = glm::vec4(light.position, PointLightRadius(light));
+    packed.ambientConstant = glm::vec4(light.ambient, light.constant);
+    packed.diffuseLinear = glm::vec4(light.diffuse, light.linear);
+    packed.specularQuadratic = glm::vec4(light.specular, light.quadratic);
+    list.lights.push_back(packed);
+    return static_cast<int>(list.lights.size()) - 1;
+}
+
+/// <summary>
+/// Appends the indices of every light that reaches the provided bounds.
+/// </summary>
+/// <param name="list">Light list holding all of this frame's lights</param>
+/// <param name="bounds">World-space bounds of the object</param>
+/// <returns>Offset and count of the object's lights inside the index buffer, for the lightRange uniform</returns>
+inline glm::ivec2 GatherLights(LightList& list, const BoundingSphere& bounds)
+{
+    glm::ivec2 range(static_cast<int>(list.indices.size()), 0);
+    for (size_t i = 0; i < list.lights.size(); i++)
+    {
+        const glm::vec4& positionRadius = list.lights[i].positionRadius;
+        float reach = positionRadius.w + bounds.radius;
+        glm::vec3 offset = glm::vec3(positionRadius) - bounds.center;
+        if (glm::dot(offset, offset) <= reach * reach)
+        {
+            list.indices.push_back(static_cast<GLint>(i));
+            range.y++;
+        }
+    }
+    return range;
+}
+
+/// <summary>
+/// Uploads the frame's lights with one buffer update, and the gathered per-object indices with another.
+/// </summary>
+inline void UploadLightList(LightList& list)
+{
+    glBindBuffer(GL_TEXTURE_BUFFER, list.lightBuffer);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, list.lights.size() * sizeof(PackedPointLight), list.lights.data());
+
+    GLsizeiptr indexBytes = list.indices.size() * sizeof(GLint);
+    glBindBuffer(GL_TEXTURE_BUFFER, list.indexBuffer);
+    if (indexBytes > list.indexCapacity)
+    {
+        // Growing the store keeps the texture buffer attached to it
+        list.indexCapacity = std::max(indexBytes, list.indexCapacity * 2);
+        glBufferData(GL_TEXTURE_BUFFER, list.indexCapacity, nullptr, GL_DYNAMIC_DRAW);
+    }
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, indexBytes, list.indices.data());
+    CountBufferUpload(list.lights.size() * sizeof(PackedPointLight) + indexBytes);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+/// <summary>
+/// Binds the light list texture buffers to their texture units.
+/// </summary>
+inline void BindLightList(GLStateCache& cache, const LightList& list)
+{
+    BindTexture(cache, kPointLightTextureUnit, GL_TEXTURE_BUFFER, list.lightTexture);
+    BindTexture(cache, kLightIndexTextureUnit, GL_TEXTURE_BUFFER, list.indexTexture);
+}
+
+/// <summary>
+/// Object-space bounds of a range of vertices.
+/// </summary>
+/// <param name="positions">Pointer to the x coordinate of the first vertex</param>
+/// <param name="stride">Distance in bytes between consecutive vertices</param>
+/// <param name="first">Index of the first vertex of the range</param>
+/// <param name="count">Number of vertices in the range</param>
+/// <returns>Sphere enclosing the range</returns>
+inline BoundingSphere ComputeBounds(const GLfloat* positions, size_t stride, int first, int count)
+{
+    const unsigned char* base = reinterpret_cast<const unsigned char*>(positions);
+    glm::vec3 minimum(1e30f);
+    glm::vec3 maximum(-1e30f);
+    for (int i = first; i < first + count; i++)
+    {
+        const GLfloat* p = reinterpret_cast<const GLfloat*>(base + i * stride);
+        minimum = glm::min(minimum, glm::vec3(p[0], p[1], p[2]));
+        maximum = glm::max(maximum, glm::vec3(p[0], p[1], p[2]));
+    }
+    BoundingSphere bounds;
+    bounds.center = (minimum + maximum) * 0.5f;
+    bounds.radius = glm::length(maximum - minimum) * 0.5f;
+    return bounds;
+}
+
+/// <summary>
+/// Moves object-space bounds into world space.
+/// </summary>
+inline BoundingSphere TransformBounds(const glm::mat4& transform, const BoundingSphere& bounds)
+{
+    float scale = std::max(std::max(glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1]))),
+        glm::length(glm::vec3(transform[2])));
+
+    BoundingSphere world;
+    world.center = glm::vec3(transform * glm::vec4(bounds.center, 1.0f));
+    world.radius = bounds.radius * scale;
+    return world;
+}
+
+/// <summary>
+/// Whether world-space bounds reach into the view frustum, tested against the six planes of the view-projection matrix.
+/// </summary>
+inline bool SphereInFrustum(const glm::mat4& viewProjection, const BoundingSphere& bounds)
+{
+    glm::mat4 rows = glm::transpose(viewProjection);
+    const glm::vec4 planes[6] = { rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1], rows[3] - rows[1],
+        rows[3] + rows[2], rows[3] - rows[2] };
+    for (const glm::vec4& plane : planes)
+    {
+        if (glm::dot(glm::vec3(plane), bounds.center) + plane.w < -bounds.radius * glm::length(glm::vec3(plane)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// <summary>
+/// State of the light scaling benchmark: renders the scene with 1, 2, 4, ... kMaxPointLights
+/// point lights and reports the average frame time at each step.
+/// </summary>
+struct LightBenchmark
+{
+    bool running;
+    int lightCount;
+    int frame;
+    double totalSeconds;
+};
+
+/// <summary>
+/// Frames rendered per step before timing starts, and frames timed per step.
+/// </summary>
+const int kLightBenchmarkWarmupFrames = 10;
+const int kLightBenchmarkFrames = 60;
+
+/// <summary>
+/// Fills the list with count small lamps scattered over the room.
+/// The positions only depend on the index, so every run is identical.
+/// </summary>
+inline void AddBenchmarkLights(LightList& list, int count)
+{
+    unsigned int state = 12345u;
+    auto next = [&state]() {
+        state = state * 1664525u + 1013904223u;
+        return static_cast<float>(state >> 8) / static_cast<float>(1 << 24);
+    };
+
+    for (int i = 0; i < count; i++)
+    {
+        PointLight lamp;
+        lamp.position = glm::vec3(next() * 10.0f - 5.0f, next() * 3.5f - 4.5f, next() * 10.0f - 5.0f);
+        lamp.diffuse = glm::vec3(next(), next(), next()) * 0.5f;
+        lamp.ambient = lamp.diffuse * 0.1f;
+        lamp.specular = lamp.diffuse;
+        lamp.constant = 1.0f;
+        lamp.linear = 0.7f;
+        lamp.quadratic = 1.8f;
+        AddPointLight(list, lamp);
+    }
+}
+
+/// <summary>
+/// Records the duration of one benchmark frame and moves on to the next light count when a step is done.
+/// </summary>
+/// <param name="bench">Benchmark state</param>
+/// <param name="frameSeconds">Duration of the frame that just finished</param>
+/// <param name="uploadedLights">Lights in the frame's list, the scene's own among them and those past kMaxPointLights dropped</param>
+/// <returns>False once the last step has been reported</returns>
+inline bool AdvanceLightBenchmark(LightBenchmark& bench, double frameSeconds, int uploadedLights, std::ostream& report)
+{
+    bench.frame++;
+    if (bench.frame > kLightBenchmarkWarmupFrames)
+    {
+        bench.totalSeconds += frameSeconds;
+    }
+    if (bench.frame < kLightBenchmarkWarmupFrames + kLightBenchmarkFrames)
+    {
+        return true;
+    }
+
+    report << "lights " << uploadedLights << " (" << bench.lightCount << " added): " << bench.totalSeconds * 1000.0 / kLightBenchmarkFrames << " ms/frame" << std::endl;
+    bench.frame = 0;
+    bench.totalSeconds = 0.0;
+    bench.lightCount *= 2;
+    bench.running = bench.lightCount <= kMaxPointLights;
+    return bench.running;
+}
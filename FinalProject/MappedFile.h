@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <direct.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/// <summary>
+/// Bytes between the addresses touched to fault a mapping in, no larger than any page size in use.
+/// </summary>
+const size_t kMappedFilePageBytes = 4096;
+
+/// <summary>
+/// A file mapped read-only into memory. The file itself is closed once mapped; the mapping stays
+/// valid until it is unmapped.
+/// </summary>
+struct MappedFile
+{
+    const unsigned char* data;
+    size_t size;
+};
+
+/// <summary>
+/// Maps the whole of a file.
+/// </summary>
+/// <returns>False if the file could not be opened or mapped, or is empty</returns>
+inline bool MapFile(MappedFile& file, const std::string& path)
+{
+    file.data = nullptr;
+    file.size = 0;
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    LARGE_INTEGER size;
+    HANDLE mapping = nullptr;
+    if (GetFileSizeEx(handle, &size) && size.QuadPart > 0)
+    {
+        mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    }
+    CloseHandle(handle);
+    if (mapping == nullptr)
+    {
+        return false;
+    }
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (view == nullptr)
+    {
+        return false;
+    }
+    file.data = static_cast<const unsigned char*>(view);
+    file.size = static_cast<size_t>(size.QuadPart);
+#else
+    int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0)
+    {
+        return false;
+    }
+    struct stat status;
+    void* view = MAP_FAILED;
+    if (fstat(descriptor, &status) == 0 && status.st_size > 0)
+    {
+        view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+    }
+    close(descriptor);
+    if (view == MAP_FAILED)
+    {
+        return false;
+    }
+    file.data = static_cast<const unsigned char*>(view);
+    file.size = static_cast<size_t>(status.st_size);
+#endif
+    return true;
+}
+
+/// <summary>
+/// Reads a byte of every page of the mapping, so the pages are in memory before anything that
+/// cannot wait on the disk, such as an upload on the render thread, reads them.
+/// </summary>
+inline void PrefetchMappedFile(const MappedFile& file)
+{
+#ifndef _WIN32
+    madvise(const_cast<unsigned char*>(file.data), file.size, MADV_WILLNEED);
+#endif
+    volatile unsigned char sink = 0;
+    for (size_t offset = 0; offset < file.size; offset += kMappedFilePageBytes)
+    {
+        sink = sink + file.data[offset];
+    }
+}
+
+inline void UnmapFile(MappedFile& file)
+{
+    if (file.data == nullptr)
+    {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(file.data);
+#else
+    munmap(const_cast<unsigned char*>(file.data), file.size);
+#endif
+    file.data = nullptr;
+    file.size = 0;
+}
+
+/// <summary>
+/// Creates a directory unless it exists. Its parent has to exist already.
+/// </summary>
+/// <returns>False if there is no directory at the path afterwards</returns>
+inline bool MakeDirectory(const std::string& path)
+{
+#ifdef _WIN32
+    _mkdir(path.c_str());
+    DWORD attributes = GetFileAttributesA(path.c_str());
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+    mkdir(path.c_str(), 0755);
+    struct stat status;
+    return stat(path.c_str(), &status) == 0 && S_ISDIR(status.st_mode);
+#endif
+}
+
+/// <summary>
+/// Reads a file's size and when it was last written, in a unit of the platform's own.
+/// </summary>
+/// <returns>False if the file does not exist</returns>
+inline bool FileStamp(const std::string& path, unsigned long long& size, long long& modified)
+{
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &attributes))
+    {
+        return false;
+    }
+    size = static_cast<unsigned long long>(attributes.nFileSizeHigh) << 32 | attributes.nFileSizeLow;
+    modified = static_cast<long long>(static_cast<unsigned long long>(attributes.ftLastWriteTime.dwHighDateTime) << 32
+        | attributes.ftLastWriteTime.dwLowDateTime);
+    return true;
+#else
+    struct stat status;
+    if (stat(path.c_str(), &status) != 0)
+    {
+        return false;
+    }
+    size = static_cast<unsigned long long>(status.st_size);
+    modified = static_cast<long long>(status.st_mtime);
+    return true;
+#endif
+}
@@ -0,0 +1,405 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+/// <summary>
+/// Size of the FIFO post-transform cache the ACMR is measured against.
+/// </summary>
+const int kVertexCacheSize = 16;
+
+/// <summary>
+/// Size of the LRU cache the triangle ordering scores vertices against.
+/// </summary>
+const int kVertexCacheScoringSize = 32;
+
+/// <summary>
+/// How much worse than the cache-ordered result the overdraw ordering may make the ACMR before it is thrown away.
+/// </summary>
+const float kOverdrawAcmrThreshold = 1.05f;
+
+/// <summary>
+/// Range of one mesh inside the shared index buffer.
+/// </summary>
+struct MeshRange
+{
+    GLint firstIndex;
+    GLsizei indexCount;
+};
+
+/// <summary>
+/// Byte offset of a mesh's first index, for the indices argument of glDrawElements.
+/// </summary>
+inline const void* MeshIndexOffset(const MeshRange& mesh)
+{
+    return reinterpret_cast<const void*>(mesh.firstIndex * sizeof(GLushort));
+}
+
+/// <summary>
+/// What building a mesh did, for the startup report.
+/// </summary>
+struct MeshStats
+{
+    int sourceVertices;
+    int uniqueVertices;
+    float acmrWelded;
+    float acmrOrdered;
+    size_t bytesBefore;
+    size_t bytesAfter;
+};
+
+/// <summary>
+/// Vertices and indices of every mesh, built one mesh at a time and uploaded together.
+/// Indices are 16-bit, so all meshes together can hold up to 65536 distinct vertices.
+/// </summary>
+template <typename V>
+struct MeshBuilder
+{
+    std::vector<V> vertices;
+    std::vector<GLushort> indices;
+};
+
+/// <summary>
+/// Average cache miss ratio of a triangle list: vertex shader runs per triangle
+/// with a FIFO post-transform cache of kVertexCacheSize entries.
+/// 3.0 is a triangle soup, the best a closed mesh can reach is about 0.5.
+/// </summary>
+inline float ComputeAcmr(const GLushort* indices, size_t indexCount)
+{
+    if (indexCount == 0)
+    {
+        return 0.0f;
+    }
+
+    GLushort cache[kVertexCacheSize];
+    int cacheCount = 0;
+    int cacheHead = 0;
+    int misses = 0;
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        if (std::find(cache, cache + cacheCount, indices[i]) != cache + cacheCount)
+        {
+            continue;
+        }
+        misses++;
+        cache[cacheHead] = indices[i];
+        cacheHead = (cacheHead + 1) % kVertexCacheSize;
+        cacheCount = std::min(cacheCount + 1, kVertexCacheSize);
+    }
+    return static_cast<float>(misses) / (indexCount / 3);
+}
+
+/// <summary>
+/// Score of a vertex in Tom Forsyth's "Linear-Speed Vertex Cache Optimisation".
+/// Vertices in the cache score higher, and so do vertices with few triangles left,
+/// so that lone triangles are not left behind.
+/// </summary>
+/// <param name="cachePosition">Position in the LRU cache, or -1 if not in it</param>
+/// <param name="remainingTriangles">Number of not yet emitted triangles using the vertex</param>
+inline float VertexCacheScore(int cachePosition, int remainingTriangles)
+{
+    if (remainingTriangles == 0)
+    {
+        return -1.0f;
+    }
+
+    float score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        if (cachePosition < 3)
+        {
+            // The triangle that was just emitted; using it again right away is no better than any other cached vertex
+            score = 0.75f;
+        }
+        else
+        {
+            float scaled = 1.0f - static_cast<float>(cachePosition - 3) / (kVertexCacheScoringSize - 3);
+            score = std::pow(scaled, 1.5f);
+        }
+    }
+    return score + 2.0f / std::sqrt(static_cast<float>(remainingTriangles));
+}
+
+/// <summary>
+/// Reorders the triangles of an indexed mesh so that consecutive triangles reuse
+/// the vertices still in the post-transform cache.
+/// </summary>
+/// <param name="indices">Triangle list to reorder in place</param>
+/// <param name="vertexCount">Number of vertices the indices refer to, starting at 0</param>
+inline void OptimizeVertexCache(std::vector<GLushort>& indices, size_t vertexCount)
+{
+    size_t triangleCount = indices.size() / 3;
+
+    // Triangles using each vertex
+    std::vector<int> remaining(vertexCount, 0);
+    for (GLushort index : indices)
+    {
+        remaining[index]++;
+    }
+    std::vector<size_t> triangleOffsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        triangleOffsets[v + 1] = triangleOffsets[v] + remaining[v];
+    }
+    std::vector<size_t> triangleLists(indices.size());
+    std::vector<size_t> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+        triangleLists[fill[indices[i]]++] = i / 3;
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        vertexScore[v] = VertexCacheScore(-1, remaining[v]);
+    }
+    std::vector<float> triangleScore(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+    }
+
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<GLushort> output;
+    output.reserve(indices.size());
+    std::vector<GLushort> cache;
+    size_t nextUnemitted = 0;
+
+    while (output.size() < indices.size())
+    {
+        // Best triangle touching the cache; the rest of the mesh can only score lower than that
+        size_t best = triangleCount;
+        float bestScore = -1.0f;
+        for (GLushort v : cache)
+        {
+            for (size_t i = triangleOffsets[v]; i < triangleOffsets[v + 1]; i++)
+            {
+                size_t t = triangleLists[i];
+                if (!emitted[t] && triangleScore[t] > bestScore)
+                {
+                    best = t;
+                    bestScore = triangleScore[t];
+                }
+            }
+        }
+        if (best == triangleCount)
+        {
+            while (emitted[nextUnemitted])
+            {
+                nextUnemitted++;
+            }
+            best = nextUnemitted;
+        }
+
+        emitted[best] = true;
+        std::vector<GLushort> newCache;
+        for (int corner = 0; corner < 3; corner++)
+        {
+            GLushort v = indices[best * 3 + corner];
+            output.push_back(v);
+            remaining[v]--;
+            newCache.push_back(v);
+        }
+        for (GLushort v : cache)
+        {
+            if (std::find(newCache.begin(), newCache.end(), v) == newCache.end())
+            {
+                newCache.push_back(v);
+            }
+        }
+
+        // Rescore everything that entered, moved in or fell out of the cache, then their triangles
+        for (GLushort v : cache)
+        {
+            cachePosition[v] = -1;
+        }
+        for (size_t i = 0; i < newCache.size(); i++)
+        {
+            cachePosition[newCache[i]] = i < static_cast<size_t>(kVertexCacheScoringSize) ? static_cast<int>(i) : -1;
+        }
+        for (GLushort v : newCache)
+        {
+            vertexScore[v] = VertexCacheScore(cachePosition[v], remaining[v]);
+        }
+        for (GLushort v : newCache)
+        {
+            for (size_t i = triangleOffsets[v]; i < triangleOffsets[v + 1]; i++)
+            {
+                size_t t = triangleLists[i];
+                triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+            }
+        }
+
+        if (newCache.size() > static_cast<size_t>(kVertexCacheScoringSize))
+        {
+            newCache.resize(kVertexCacheScoringSize);
+        }
+        cache.swap(newCache);
+    }
+    indices.swap(output);
+}
+
+/// <summary>
+/// Reorders clusters of a cache-ordered triangle list so that outward-facing clusters are drawn first
+/// and occlude the rest, after Sander et al. "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw".
+/// A cluster starts wherever a triangle misses the cache on all three vertices, so the cache order inside
+/// each cluster is kept. The new order is only kept if it costs less than kOverdrawAcmrThreshold in ACMR.
+/// </summary>
+/// <param name="indices">Cache-ordered triangle list to reorder in place</param>
+/// <param name="positions">Position of every vertex the indices refer to</param>
+inline void OptimizeOverdraw(std::vector<GLushort>& indices, const std::vector<glm::vec3>& positions)
+{
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount < 2)
+    {
+        return;
+    }
+
+    // Split into clusters at hard cache boundaries
+    std::vector<size_t> clusterStarts;
+    GLushort cache[kVertexCacheSize];
+    int cacheCount = 0;
+    int cacheHead = 0;
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        int misses = 0;
+        for (int corner = 0; corner < 3; corner++)
+        {
+            GLushort v = indices[t * 3 + corner];
+            if (std::find(cache, cache + cacheCount, v) == cache + cacheCount)
+            {
+                misses++;
+                cache[cacheHead] = v;
+                cacheHead = (cacheHead + 1) % kVertexCacheSize;
+                cacheCount = std::min(cacheCount + 1, kVertexCacheSize);
+            }
+        }
+        if (t == 0 || misses == 3)
+        {
+            clusterStarts.push_back(t);
+        }
+    }
+    clusterStarts.push_back(triangleCount);
+
+    glm::vec3 meshCenter(0.0f);
+    for (const glm::vec3& position : positions)
+    {
+        meshCenter += position;
+    }
+    meshCenter /= static_cast<float>(positions.size());
+
+    // Clusters facing away from the center of the mesh are the ones in front, so they go first
+    size_t clusterCount = clusterStarts.size() - 1;
+    std::vector<float> clusterSortKey(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        glm::vec3 centroid(0.0f);
+        glm::vec3 normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++)
+        {
+            const glm::vec3& a = positions[indices[t * 3]];
+            const glm::vec3& b = positions[indices[t * 3 + 1]];
+            const glm::vec3& c2 = positions[indices[t * 3 + 2]];
+            glm::vec3 weightedNormal = glm::cross(b - a, c2 - a);
+            float triangleArea = glm::length(weightedNormal);
+            centroid += (a + b + c2) * (triangleArea / 3.0f);
+            normal += weightedNormal;
+            area += triangleArea;
+        }
+        centroid = area > 0.0f ? centroid / area : centroid;
+        float normalLength = glm::length(normal);
+        clusterSortKey[c] = normalLength > 0.0f ? glm::dot(centroid - meshCenter, normal / normalLength) : 0.0f;
+    }
+
+    std::vector<size_t> clusterOrder(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        clusterOrder[c] = c;
+    }
+    std::stable_sort(clusterOrder.begin(), clusterOrder.end(),
+        [&clusterSortKey](size_t a, size_t b) { return clusterSortKey[a] > clusterSortKey[b]; });
+
+    std::vector<GLushort> output;
+    output.reserve(indices.size());
+    for (size_t c : clusterOrder)
+    {
+        output.insert(output.end(), indices.begin() + clusterStarts[c] * 3, indices.begin() + clusterStarts[c + 1] * 3);
+    }
+
+    if (ComputeAcmr(output.data(), output.size()) <= ComputeAcmr(indices.data(), indices.size()) * kOverdrawAcmrThreshold)
+    {
+        indices.swap(output);
+    }
+}
+
+/// <summary>
+/// Adds a range of a non-indexed triangle list to the builder: identical vertices are welded into one,
+/// then the triangles are ordered for the vertex cache and for overdraw.
+/// V needs x, y and z position members and an operator==; Hash hashes a V.
+/// </summary>
+/// <param name="builder">Builder to add the mesh to</param>
+/// <param name="source">Triangle list the mesh is taken from</param>
+/// <param name="first">Index of the first vertex of the mesh in source</param>
+/// <param name="count">Number of vertices of the mesh, three per triangle</param>
+/// <param name="stats">Filled with what welding and reordering achieved</param>
+/// <returns>Range of the mesh in the builder's indices</returns>
+template <typename Hash, typename V>
+MeshRange AddMesh(MeshBuilder<V>& builder, const V* source, int first, int count, MeshStats& stats)
+{
+    size_t baseVertex = builder.vertices.size();
+
+    // Weld: each distinct vertex is stored once, triangles refer to it by index
+    std::unordered_map<V, GLushort, Hash> welded;
+    std::vector<GLushort> indices;
+    std::vector<glm::vec3> positions;
+    for (int i = first; i < first + count; i++)
+    {
+        auto found = welded.find(source[i]);
+        if (found == welded.end())
+        {
+            found = welded.emplace(source[i], static_cast<GLushort>(positions.size())).first;
+            builder.vertices.push_back(source[i]);
+            positions.push_back(glm::vec3(source[i].x, source[i].y, source[i].z));
+        }
+        indices.push_back(found->second);
+    }
+
+    stats.acmrWelded = ComputeAcmr(indices.data(), indices.size());
+    OptimizeVertexCache(indices, positions.size());
+    OptimizeOverdraw(indices, positions);
+
+    MeshRange range;
+    range.firstIndex = static_cast<GLint>(builder.indices.size());
+    range.indexCount = static_cast<GLsizei>(indices.size());
+    for (GLushort index : indices)
+    {
+        builder.indices.push_back(static_cast<GLushort>(baseVertex + index));
+    }
+
+    stats.sourceVertices = count;
+    stats.uniqueVertices = static_cast<int>(positions.size());
+    stats.acmrOrdered = ComputeAcmr(indices.data(), indices.size());
+    stats.bytesBefore = count * sizeof(V);
+    stats.bytesAfter = positions.size() * sizeof(V) + indices.size() * sizeof(GLushort);
+    return range;
+}
+
+/// <summary>
+/// Prints one line of the mesh report. Without indices every vertex is shaded, an ACMR of 3.
+/// </summary>
+inline void ReportMesh(std::ostream& report, const char* name, const MeshStats& stats)
+{
+    report << "Mesh " << name << ": " << stats.sourceVertices << " -> " << stats.uniqueVertices << " vertices, ACMR 3 -> "
+        << stats.acmrWelded << " welded -> " << stats.acmrOrdered << " ordered, " << stats.bytesBefore << " -> " << stats.bytesAfter
+        << " bytes (" << static_cast<long>(stats.bytesBefore) - static_cast<long>(stats.bytesAfter) << " saved)" << std::endl;
+}
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIP_CHAIN_SSE2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define MIP_CHAIN_NEON 1
+#endif
+
+/// <summary>
+/// How each level of a chain is averaged from the one above it.
+/// </summary>
+enum class MipFilter
+{
+    // Averages the stored values, right for data such as bump maps
+    Box,
+
+    // Averages the light the sRGB values stand for and stores it as sRGB again, so colour images
+    // do not darken towards the smaller levels. Alpha is averaged as is.
+    Gamma
+};
+
+/// <summary>
+/// One level of a texture's chain, RGBA8 with tightly packed rows.
+/// </summary>
+struct TextureLevel
+{
+    int width;
+    int height;
+    std::vector<unsigned char> pixels;
+};
+
+/// <summary>
+/// Linear light of every sRGB value, in 14 bits so four of them add up without overflowing 16.
+/// Built once by whichever thread asks first; the others wait for it.
+/// </summary>
+inline const uint16_t* SrgbToLinearTable()
+{
+    static const std::vector<uint16_t> table = [] {
+        std::vector<uint16_t> values(256);
+        for (int i = 0; i < 256; i++)
+        {
+            double srgb = i / 255.0;
+            double linear = srgb <= 0.04045 ? srgb / 12.92 : std::pow((srgb + 0.055) / 1.055, 2.4);
+            values[i] = static_cast<uint16_t>(std::lround(linear * 16383.0));
+        }
+        return values;
+    }();
+    return table.data();
+}
+
+/// <summary>
+/// The sRGB value of every 14-bit linear light value.
+/// </summary>
+inline const unsigned char* LinearToSrgbTable()
+{
+    static const std::vector<unsigned char> table = [] {
+        std::vector<unsigned char> values(16384);
+        for (int i = 0; i < 16384; i++)
+        {
+            double linear = i / 16383.0;
+            double srgb = linear <= 0.0031308 ? linear * 12.92 : 1.055 * std::pow(linear, 1.0 / 2.4) - 0.055;
+            values[i] = static_cast<unsigned char>(std::lround(srgb * 255.0));
+        }
+        return values;
+    }();
+    return table.data();
+}
+
+/// <summary>
+/// Averages 2x2 blocks of two RGBA8 rows into one row of the given width, rounding to nearest.
+/// </summary>
+inline void DownsampleRowsBox(const unsigned char* row0, const unsigned char* row1, unsigned char* out, int width)
+{
+    int x = 0;
+#if MIP_CHAIN_SSE2
+    // Four output pixels from eight of each row: sum the rows in 16 bits, then each pixel with its neighbour
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8));
+        __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8 + 16));
+        __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8));
+        __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8 + 16));
+        __m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+        __m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+        __m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+        __m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+        __m128i q0 = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+        __m128i q1 = _mm_add_epi16(_mm_unpacklo_epi64(s2, s3), _mm_unpackhi_epi64(s2, s3));
+        q0 = _mm_srli_epi16(_mm_add_epi16(q0, two), 2);
+        q1 = _mm_srli_epi16(_mm_add_epi16(q1, two), 2);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * 4), _mm_packus_epi16(q0, q1));
+    }
+#elif MIP_CHAIN_NEON
+    // Four output pixels from eight of each row, split into even and odd pixels as they load
+    for (; x + 4 <= width; x += 4)
+    {
+        uint32x4x2_t a = vld2q_u32(reinterpret_cast<const uint32_t*>(row0 + x * 8));
+        uint32x4x2_t b = vld2q_u32(reinterpret_cast<const uint32_t*>(row1 + x * 8));
+        uint8x16_t ae = vreinterpretq_u8_u32(a.val[0]);
+        uint8x16_t ao = vreinterpretq_u8_u32(a.val[1]);
+        uint8x16_t be = vreinterpretq_u8_u32(b.val[0]);
+        uint8x16_t bo = vreinterpretq_u8_u32(b.val[1]);
+        uint16x8_t low = vaddw_u8(vaddw_u8(vaddl_u8(vget_low_u8(ae), vget_low_u8(ao)), vget_low_u8(be)), vget_low_u8(bo));
+        uint16x8_t high = vaddw_u8(vaddw_u8(vaddl_u8(vget_high_u8(ae), vget_high_u8(ao)), vget_high_u8(be)), vget_high_u8(bo));
+        vst1q_u8(out + x * 4, vcombine_u8(vrshrn_n_u16(low, 2), vrshrn_n_u16(high, 2)));
+    }
+#endif
+    for (; x < width; x++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            out[x * 4 + c] = static_cast<unsigned char>((row0[x * 8 + c] + row0[x * 8 + 4 + c] + row1[x * 8 + c] + row1[x * 8 + 4 + c] + 2) / 4);
+        }
+    }
+}
+
+/// <summary>
+/// Sums 2x2 blocks of two rows of 14-bit linear RGBA into one row of the given width, without dividing.
+/// </summary>
+inline void SumRowsLinear(const uint16_t* row0, const uint16_t* row1, uint16_t* out, int width)
+{
+    int x = 0;
+#if MIP_CHAIN_SSE2
+    // Two output pixels from four of each row
+    for (; x + 2 <= width; x += 2)
+    {
+        __m128i s0 = _mm_add_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8)));
+        __m128i s1 = _mm_add_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8 + 8)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8 + 8)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * 4),
+            _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1)));
+    }
+#elif MIP_CHAIN_NEON
+    // Two output pixels from four of each row
+    for (; x + 2 <= width; x += 2)
+    {
+        uint16x8_t s0 = vaddq_u16(vld1q_u16(row0 + x * 8), vld1q_u16(row1 + x * 8));
+        uint16x8_t s1 = vaddq_u16(vld1q_u16(row0 + x * 8 + 8), vld1q_u16(row1 + x * 8 + 8));
+        vst1q_u16(out + x * 4, vcombine_u16(vadd_u16(vget_low_u16(s0), vget_high_u16(s0)),
+            vadd_u16(vget_low_u16(s1), vget_high_u16(s1))));
+    }
+#endif
+    for (; x < width; x++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            out[x * 4 + c] = static_cast<uint16_t>(row0[x * 8 + c] + row0[x * 8 + 4 + c] + row1[x * 8 + c] + row1[x * 8 + 4 + c]);
+        }
+    }
+}
+
+/// <summary>
+/// Converts a row of RGBA8 to 14-bit linear light, alpha scaled to the same range.
+/// </summary>
+inline void LinearizeRow(const unsigned char* row, uint16_t* out, int width)
+{
+    const uint16_t* toLinear = SrgbToLinearTable();
+    for (int x = 0; x < width; x++)
+    {
+        out[x * 4] = toLinear[row[x * 4]];
+        out[x * 4 + 1] = toLinear[row[x * 4 + 1]];
+        out[x * 4 + 2] = toLinear[row[x * 4 + 2]];
+        out[x * 4 + 3] = static_cast<uint16_t>(row[x * 4 + 3] * 16383 / 255);
+    }
+}
+
+/// <summary>
+/// Halves a level with a 2x2 filter. An odd last row or column is left out, as the levels GL
+/// expects are half the size rounded down, except that a side of 1 stays 1.
+/// </summary>
+inline TextureLevel DownsampleTextureLevel(const TextureLevel& source, MipFilter filter)
+{
+    TextureLevel level;
+    level.width = std::max(1, source.width / 2);
+    level.height = std::max(1, source.height / 2);
+    level.pixels.resize(static_cast<size_t>(level.width) * level.height * 4);
+
+    // A side of 1 is averaged with itself by reading each pixel twice from a widened copy
+    std::vector<unsigned char> widened;
+    const unsigned char* pixels = source.pixels.data();
+    size_t stride = static_cast<size_t>(source.width) * 4;
+    if (source.width == 1)
+    {
+        widened.resize(static_cast<size_t>(source.height) * 8);
+        for (int y = 0; y < source.height; y++)
+        {
+            std::copy(pixels + y * 4, pixels + y * 4 + 4, &widened[y * 8]);
+            std::copy(pixels + y * 4, pixels + y * 4 + 4, &widened[y * 8 + 4]);
+        }
+        pixels = widened.data();
+        stride = 8;
+    }
+
+    std::vector<uint16_t> linear0;
+    std::vector<uint16_t> linear1;
+    std::vector<uint16_t> sums;
+    if (filter == MipFilter::Gamma)
+    {
+        linear0.resize(static_cast<size_t>(level.width) * 8);
+        linear1.resize(static_cast<size_t>(level.width) * 8);
+        sums.resize(static_cast<size_t>(level.width) * 4);
+    }
+    const unsigned char* toSrgb = LinearToSrgbTable();
+    for (int y = 0; y < level.height; y++)
+    {
+        const unsigned char* row0 = pixels + static_cast<size_t>(std::min(2 * y, source.height - 1)) * stride;
+        const unsigned char* row1 = pixels + static_cast<size_t>(std::min(2 * y + 1, source.height - 1)) * stride;
+        unsigned char* out = &level.pixels[static_cast<size_t>(y) * level.width * 4];
+        if (filter == MipFilter::Box)
+        {
+            DownsampleRowsBox(row0, row1, out, level.width);
+            continue;
+        }
+        LinearizeRow(row0, linear0.data(), level.width * 2);
+        LinearizeRow(row1, linear1.data(), level.width * 2);
+        SumRowsLinear(linear0.data(), linear1.data(), sums.data(), level.width);
+        for (int x = 0; x < level.width * 4; x += 4)
+        {
+            out[x] = toSrgb[(sums[x] + 2) >> 2];
+            out[x + 1] = toSrgb[(sums[x + 1] + 2) >> 2];
+            out[x + 2] = toSrgb[(sums[x + 2] + 2) >> 2];
+            out[x + 3] = static_cast<unsigned char>((((sums[x + 3] + 2) >> 2) * 255 + 8191) / 16383);
+        }
+    }
+    return level;
+}
+
+/// <summary>
+/// Builds the chain of an RGBA8 image, from its full size down to 1x1.
+/// </summary>
+inline std::vector<TextureLevel> BuildMipChain(const unsigned char* pixels, int width, int height, MipFilter filter)
+{
+    std::vector<TextureLevel> levels(1);
+    levels[0].width = width;
+    levels[0].height = height;
+    levels[0].pixels.assign(pixels, pixels + static_cast<size_t>(width) * height * 4);
+    while (levels.back().width > 1 || levels.back().height > 1)
+    {
+        levels.push_back(DownsampleTextureLevel(levels.back(), filter));
+    }
+    return levels;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstring>
+#include <vector>
+
+#include "GLStateCache.h"
+
+/// <summary>
+/// One pixel buffer object of the ring and the fence that tells when the copy into it is done.
+/// </summary>
+struct PixelReadbackSlot
+{
+    GLuint buffer;
+    GLsync fence;
+    bool pending;
+
+    // Whatever the caller wants handed back with the pixels, e.g. an index
+    int tag;
+};
+
+/// <summary>
+/// Reads framebuffers back without stalling: glReadPixels goes into a pixel buffer object, which is
+/// only mapped frames later, once its fence has signaled. Slots are used and finished in order.
+/// </summary>
+struct PixelReadbackRing
+{
+    std::vector<PixelReadbackSlot> slots;
+    size_t next;
+    size_t oldest;
+    int width;
+    int height;
+};
+
+/// <summary>
+/// Creates a ring reading back width x height RGBA8 images, with the provided number of reads in flight.
+/// </summary>
+inline PixelReadbackRing CreatePixelReadbackRing(int slotCount, int width, int height)
+{
+    PixelReadbackRing ring;
+    ring.next = 0;
+    ring.oldest = 0;
+    ring.width = width;
+    ring.height = height;
+    ring.slots.resize(slotCount);
+    for (PixelReadbackSlot& slot : ring.slots)
+    {
+        glGenBuffers(1, &slot.buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<GLsizeiptr>(width) * height * 4, nullptr, GL_STREAM_READ);
+        slot.fence = nullptr;
+        slot.pending = false;
+        slot.tag = 0;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return ring;
+}
+
+inline void DeletePixelReadbackRing(PixelReadbackRing& ring)
+{
+    for (PixelReadbackSlot& slot : ring.slots)
+    {
+        if (slot.fence != nullptr)
+        {
+            glDeleteSync(slot.fence);
+        }
+        glDeleteBuffers(1, &slot.buffer);
+    }
+    ring.slots.clear();
+}
+
+/// <summary>
+/// Whether every slot holds a read that has not been finished, so no new read can start.
+/// </summary>
+inline bool PixelReadbackRingFull(const PixelReadbackRing& ring)
+{
+    return ring.slots[ring.next].pending;
+}
+
+inline bool PixelReadbackPending(const PixelReadbackRing& ring)
+{
+    return ring.slots[ring.oldest].pending;
+}
+
+/// <summary>
+/// Starts copying a framebuffer's color into the next free slot, leaving the framebuffer bound.
+/// A framebuffer object has to be single sampled, and the ring must not be full.
+/// </summary>
+/// <param name="framebuffer">Framebuffer object, or 0 for the window's back buffer</param>
+inline void BeginPixelReadback(PixelReadbackRing& ring, GLStateCache& cache, GLuint framebuffer, int tag)
+{
+    PixelReadbackSlot& slot = ring.slots[ring.next];
+    ring.next = (ring.next + 1) % ring.slots.size();
+
+    BindFramebuffer(cache, framebuffer);
+    glReadBuffer(framebuffer == 0 ? GL_BACK : GL_COLOR_ATTACHMENT0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, ring.width, ring.height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.pending = true;
+    slot.tag = tag;
+}
+
+/// <summary>
+/// Finishes the oldest read if its copy is done, or waits for it if asked to.
+/// </summary>
+/// <param name="pixels">Receives width * height RGBA8 pixels, top row first, or nothing if the buffer could not be mapped</param>
+/// <param name="tag">Receives the tag the read was started with</param>
+/// <param name="wait">Block until the copy is done instead of returning false</param>
+/// <returns>False if no read is pending or the oldest one is still in flight; the slot is free again otherwise</returns>
+inline bool FinishPixelReadback(PixelReadbackRing& ring, std::vector<unsigned char>& pixels, int& tag, bool wait)
+{
+    PixelReadbackSlot& slot = ring.slots[ring.oldest];
+    if (!slot.pending)
+    {
+        return false;
+    }
+    GLenum status = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? GL_TIMEOUT_IGNORED : 0);
+    if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+    {
+        return false;
+    }
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+    slot.pending = false;
+    ring.oldest = (ring.oldest + 1) % ring.slots.size();
+
+    size_t rowBytes = static_cast<size_t>(ring.width) * 4;
+    pixels.resize(rowBytes * ring.height);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    const unsigned char* mapped = static_cast<const unsigned char*>(
+        glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, static_cast<GLsizeiptr>(pixels.size()), GL_MAP_READ_BIT));
+    if (mapped != nullptr)
+    {
+        // GL rows start at the bottom, image files at the top
+        for (int y = 0; y < ring.height; y++)
+        {
+            std::memcpy(&pixels[y * rowBytes], mapped + (ring.height - 1 - y) * rowBytes, rowBytes);
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    else
+    {
+        pixels.clear();
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    tag = slot.tag;
+    return true;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+/// <summary>
+/// What the renderer did in one frame. Counted by the functions that issue the GL calls,
+/// so every pass and overlay is included without the render loop adding anything up.
+/// </summary>
+struct RenderStats
+{
+    int drawCalls;
+    uint64_t triangles;
+
+    // Calls that reached GL; the ones the state cache dropped are not counted
+    int programChanges;
+    int textureBinds;
+
+    int uniformUploads;
+    uint64_t bufferBytes;
+
+    // Program, vertex array, texture and pass changes of the main pass's draws in the order they were
+    // queued and in the order the queue sorted them into
+    int submittedStateChanges;
+    int sortedStateChanges;
+
+    // Calls the GL state cache let through and the redundant ones it dropped
+    int glCallsIssued;
+    int glCallsElided;
+
+    // From the start of the frame to the end of its submission, and the GPU time of
+    // the latest frame the GPU profiler has read back
+    double cpuMilliseconds;
+    double gpuMilliseconds;
+};
+
+/// <summary>
+/// The frame being counted and the last finished one. Only the thread that owns the GL context counts.
+/// </summary>
+struct RenderStatsCollector
+{
+    RenderStats frame;
+    RenderStats last;
+    std::chrono::steady_clock::time_point frameStart;
+};
+
+inline RenderStatsCollector& GetRenderStatsCollector()
+{
+    static RenderStatsCollector collector = {};
+    return collector;
+}
+
+/// <summary>
+/// Zeroes the counters, at the start of every frame.
+/// </summary>
+inline void BeginRenderStatsFrame()
+{
+    RenderStatsCollector& collector = GetRenderStatsCollector();
+    collector.frame = {};
+    collector.frameStart = std::chrono::steady_clock::now();
+}
+
+/// <summary>
+/// Finishes the frame once everything is submitted, making its counters the ones LastRenderStats returns.
+/// </summary>
+/// <param name="gpuMilliseconds">GPU time of the latest frame read back</param>
+inline void EndRenderStatsFrame(double gpuMilliseconds)
+{
+    RenderStatsCollector& collector = GetRenderStatsCollector();
+    collector.frame.cpuMilliseconds = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - collector.frameStart).count();
+    collector.frame.gpuMilliseconds = gpuMilliseconds;
+    collector.last = collector.frame;
+}
+
+/// <summary>
+/// Counters of the last finished frame, e.g. for the overlay or the benchmark report.
+/// </summary>
+inline const RenderStats& LastRenderStats()
+{
+    return GetRenderStatsCollector().last;
+}
+
+/// <param name="triangles">Triangles of one instance</param>
+/// <param name="instances">Instances drawn</param>
+inline void CountDrawCall(uint64_t triangles, uint64_t instances)
+{
+    RenderStats& stats = GetRenderStatsCollector().frame;
+    stats.drawCalls++;
+    stats.triangles += triangles * instances;
+}
+
+inline void CountProgramChange()
+{
+    GetRenderStatsCollector().frame.programChanges++;
+}
+
+inline void CountTextureBind()
+{
+    GetRenderStatsCollector().frame.textureBinds++;
+}
+
+inline void CountUniformUpload()
+{
+    GetRenderStatsCollector().frame.uniformUploads++;
+}
+
+inline void CountBufferUpload(uint64_t bytes)
+{
+    GetRenderStatsCollector().frame.bufferBytes += bytes;
+}
+
+/// <summary>
+/// Records the state changes the main pass's draw queue needed before and after sorting.
+/// </summary>
+inline void CountSortedStateChanges(int submitted, int sorted)
+{
+    RenderStats& stats = GetRenderStatsCollector().frame;
+    stats.submittedStateChanges = submitted;
+    stats.sortedStateChanges = sorted;
+}
+
+/// <summary>
+/// Records the frame's calls through the GL state cache, once it has made all of them.
+/// </summary>
+inline void CountGLStateCalls(int issued, int elided)
+{
+    RenderStats& stats = GetRenderStatsCollector().frame;
+    stats.glCallsIssued = issued;
+    stats.glCallsElided = elided;
+}
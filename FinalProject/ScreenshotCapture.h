@@ -0,0 +1,148 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "GLStateCache.h"
+#include "ImageEncoder.h"
+#include "MappedFile.h"
+#include "PixelReadback.h"
+
+/// <summary>
+/// Frames read back at once. A read is only mapped once its fence has signaled, a frame or more
+/// after it started, so taking a screenshot never waits on the copy.
+/// </summary>
+const int kScreenshotReadbackSlots = 3;
+
+/// <summary>
+/// Frames a burst captures, one after the other.
+/// </summary>
+const int kScreenshotBurstFrames = 60;
+
+/// <summary>
+/// Takes screenshots of the back buffer: the pixels come back through a pixel buffer ring and are
+/// written by a thread of their own, so neither the read nor the encoding holds up rendering.
+/// </summary>
+struct ScreenshotCapture
+{
+    std::string directory;
+    ImageFormat format;
+
+    PixelReadbackRing readbacks;
+    ImageEncoder encoder;
+
+    // Frames still to capture, frames skipped because every slot was in flight, and the next file's number
+    int remaining;
+    int skipped;
+    int nextIndex;
+};
+
+/// <summary>
+/// Creates the readback ring for the back buffer's size and starts the encoding thread.
+/// </summary>
+/// <param name="directory">Where the files go, as screenshot-NNNN.png or .ppm</param>
+/// <param name="width">Width of the back buffer in pixels, from glfwGetFramebufferSize</param>
+/// <param name="height">Height of the back buffer in pixels</param>
+inline void StartScreenshotCapture(ScreenshotCapture& capture, const std::string& directory, ImageFormat format, int width, int height)
+{
+    capture.directory = directory;
+    capture.format = format;
+    MakeDirectory(directory);
+    capture.readbacks = CreatePixelReadbackRing(kScreenshotReadbackSlots, width, height);
+    capture.remaining = 0;
+    capture.skipped = 0;
+    capture.nextIndex = 0;
+    StartImageEncoder(capture.encoder, 1);
+}
+
+/// <summary>
+/// Asks for the next frames to be captured, on top of any burst still running.
+/// </summary>
+inline void RequestScreenshots(ScreenshotCapture& capture, int frames)
+{
+    capture.remaining += frames;
+}
+
+/// <summary>
+/// Starts reading back the frame just rendered, before it is swapped. A frame that finds every
+/// slot still in flight is skipped rather than waited for.
+/// </summary>
+inline void CaptureScreenshotFrame(ScreenshotCapture& capture, GLStateCache& cache)
+{
+    if (capture.remaining == 0)
+    {
+        return;
+    }
+    capture.remaining--;
+    if (PixelReadbackRingFull(capture.readbacks))
+    {
+        capture.skipped++;
+        return;
+    }
+    BeginPixelReadback(capture.readbacks, cache, 0, capture.nextIndex++);
+}
+
+/// <summary>
+/// Hands every read whose copy is done over to the encoder.
+/// </summary>
+/// <param name="wait">Wait for every read in flight, e.g. when the loop ends</param>
+inline void FinishScreenshots(ScreenshotCapture& capture, bool wait)
+{
+    ImageJob job;
+    int index;
+    while (FinishPixelReadback(capture.readbacks, job.pixels, index, wait))
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "screenshot-%04d", index);
+        job.path = capture.directory + "/" + name + ImageFormatExtension(capture.format);
+        job.width = capture.readbacks.width;
+        job.height = capture.readbacks.height;
+        job.format = capture.format;
+        job.streamIndex = 0;
+        QueueImage(capture.encoder, std::move(job));
+        job = ImageJob();
+    }
+}
+
+/// <summary>
+/// Makes the readback ring match the back buffer once its size changed. The reads in flight are
+/// of the old size, so they are finished and handed over first.
+/// </summary>
+inline void ResizeScreenshotCapture(ScreenshotCapture& capture, int width, int height)
+{
+    if (capture.readbacks.width == width && capture.readbacks.height == height)
+    {
+        return;
+    }
+    FinishScreenshots(capture, true);
+    DeletePixelReadbackRing(capture.readbacks);
+    capture.readbacks = CreatePixelReadbackRing(kScreenshotReadbackSlots, width, height);
+}
+
+/// <summary>
+/// Finishes the reads in flight, waits for every file to be written and reports how many were.
+/// </summary>
+inline void StopScreenshotCapture(ScreenshotCapture& capture, std::ostream& report)
+{
+    FinishScreenshots(capture, true);
+    StopImageEncoder(capture.encoder);
+    DeletePixelReadbackRing(capture.readbacks);
+    if (capture.nextIndex != 0)
+    {
+        report << "Screenshots: " << capture.encoder.written << " written to " << capture.directory;
+        if (capture.encoder.failed != 0)
+        {
+            report << ", " << capture.encoder.failed << " FAILED to write";
+        }
+        if (capture.skipped != 0)
+        {
+            report << ", " << capture.skipped << " frames skipped with every read in flight";
+        }
+        report << std::endl;
+    }
+}
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "CascadedShadows.h"
+#include "GLStateCache.h"
+#include "LightList.h"
+#include "RenderStats.h"
+#include "UniformTable.h"
+
+/// <summary>
+/// Texels of the static depth per texel of a cascade, as the one layer spans every static caster
+/// while the nearest cascade only spans the slice of the view closest to the camera.
+/// </summary>
+const int kStaticShadowResolutionScale = 2;
+
+/// <summary>
+/// The static depth as last reprojected into one cascade, kept while neither moves.
+/// </summary>
+struct StaticShadowLayer
+{
+    glm::mat4 lightSpace;
+
+    // Texels of the layer under the static casters' box: x, y, width, height
+    glm::ivec4 footprint;
+    bool valid;
+};
+
+/// <summary>
+/// Depth of the shadow casters that never move, rendered once along the light into a box fitted
+/// around them. The box does not follow the camera, so the depth stays valid as the camera moves.
+/// Each frame it is reprojected into every cascade the box overlaps, or copied from the last
+/// reprojection if the cascade did not move, before the moving casters are drawn on top.
+/// </summary>
+struct StaticShadowCache
+{
+    GLuint texture;
+    GLuint framebuffer;
+    int resolution;
+
+    // Projection * view of the light the cached depth was rendered with, and whether it is still usable
+    glm::mat4 lightSpace;
+    bool valid;
+
+    // The reprojection into each cascade, laid out like the frame's shadow map
+    ShadowMap composited;
+    StaticShadowLayer layers[kMaxCascades];
+
+    // shadowComposite.vsh and .fsh, drawing a triangle over a cascade's layer without any vertex buffer
+    GLuint program;
+    UniformTable uniforms;
+    GLuint vao;
+};
+
+/// <summary>
+/// Creates the cache's depth textures and framebuffers. Leaves framebuffer 0 bound.
+/// </summary>
+/// <param name="settings">Cascade settings, whose resolution the cache's is a multiple of</param>
+/// <param name="program">Program made of shadowComposite.vsh and shadowComposite.fsh</param>
+inline StaticShadowCache CreateStaticShadowCache(const CascadeSettings& settings, GLuint program)
+{
+    StaticShadowCache cache = {};
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    cache.resolution = std::min(settings.resolution * kStaticShadowResolutionScale, static_cast<int>(maxSize));
+
+    glGenTextures(1, &cache.texture);
+    glBindTexture(GL_TEXTURE_2D, cache.texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, cache.resolution, cache.resolution, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    cache.framebuffer = CreateDepthOnlyFramebuffer();
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, cache.texture, 0);
+    cache.composited = CreateShadowMap(settings.resolution, settings.count);
+
+    cache.lightSpace = glm::mat4(0.0f);
+    cache.valid = false;
+    cache.program = program;
+    cache.uniforms = ResolveUniforms(program);
+    glGenVertexArrays(1, &cache.vao);
+
+    // The cached depth always sits on unit 0
+    glUseProgram(program);
+    SetUniform(cache.uniforms, Uniform::StaticDepth, 0);
+    glUseProgram(0);
+    return cache;
+}
+
+inline void DeleteStaticShadowCache(StaticShadowCache& cache)
+{
+    DeleteShadowMap(cache.composited);
+    glDeleteVertexArrays(1, &cache.vao);
+    glDeleteFramebuffers(1, &cache.framebuffer);
+    glDeleteTextures(1, &cache.texture);
+}
+
+/// <summary>
+/// Forces the static casters to be rendered again, e.g. after one of them was added, removed or moved.
+/// </summary>
+inline void InvalidateStaticShadows(StaticShadowCache& cache)
+{
+    cache.valid = false;
+    for (StaticShadowLayer& layer : cache.layers)
+    {
+        layer.valid = false;
+    }
+}
+
+/// <summary>
+/// Fits an orthographic light projection around the world-space bounds of the static casters,
+/// looking along the light like the cascades do so the depth can be carried across to them.
+/// The same casters always give the same box, whatever the camera does.
+/// </summary>
+/// <param name="lightDirection">Direction the light shines in</param>
+/// <param name="casters">World-space bounds of every static caster</param>
+inline glm::mat4 FitStaticShadows(const glm::vec3& lightDirection, const std::vector<BoundingSphere>& casters)
+{
+    glm::mat4 lightView = ShadowLightView(lightDirection);
+    glm::vec3 minimum(0.0f);
+    glm::vec3 maximum(0.0f);
+    for (size_t i = 0; i < casters.size(); i++)
+    {
+        glm::vec3 center = glm::vec3(lightView * glm::vec4(casters[i].center, 1.0f));
+        glm::vec3 extent(casters[i].radius);
+        minimum = i == 0 ? center - extent : glm::min(minimum, center - extent);
+        maximum = i == 0 ? center + extent : glm::max(maximum, center + extent);
+    }
+
+    // The light looks down -z, so the near plane is the negated largest z
+    return glm::ortho(minimum.x, maximum.x, minimum.y, maximum.y, -maximum.z, -minimum.z) * lightView;
+}
+
+/// <summary>
+/// Whether the cached depth has to be rendered again this frame: only when it was invalidated or
+/// the static casters' box changed, which the camera moving never does.
+/// </summary>
+/// <param name="cache">Static shadow cache</param>
+/// <param name="lightSpace">This frame's box around the static casters, from FitStaticShadows</param>
+inline bool StaticShadowsDirty(const StaticShadowCache& cache, const glm::mat4& lightSpace)
+{
+    return !cache.valid || cache.lightSpace != lightSpace;
+}
+
+/// <summary>
+/// Binds the cache's framebuffer and viewport and clears it, for the static casters to be drawn
+/// through depth.gsh with an empty cascadeRange and cacheLightSpace set to lightSpace.
+/// </summary>
+inline void BeginStaticShadows(GLStateCache& glState, const StaticShadowCache& cache)
+{
+    BindFramebuffer(glState, cache.framebuffer);
+    Viewport(glState, 0, 0, cache.resolution, cache.resolution);
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+/// <summary>
+/// Records that the static casters were just rendered into the cache with the provided projection.
+/// </summary>
+inline void MarkStaticShadowsRendered(StaticShadowCache& cache, const glm::mat4& lightSpace)
+{
+    InvalidateStaticShadows(cache);
+    cache.lightSpace = lightSpace;
+    cache.valid = true;
+}
+
+/// <summary>
+/// The texels of a cascade's layer the static casters' box covers, rounded outwards: x, y, width, height.
+/// </summary>
+inline glm::ivec4 StaticShadowFootprint(const glm::mat4& staticToCascade, int resolution)
+{
+    glm::vec2 corner0 = glm::vec2(staticToCascade * glm::vec4(-1.0f, -1.0f, 0.0f, 1.0f));
+    glm::vec2 corner1 = glm::vec2(staticToCascade * glm::vec4(1.0f, 1.0f, 0.0f, 1.0f));
+    glm::vec2 texels = glm::vec2(static_cast<float>(resolution));
+    glm::ivec2 first = glm::clamp(glm::ivec2(glm::floor((glm::min(corner0, corner1) * 0.5f + 0.5f) * texels)), 0, resolution);
+    glm::ivec2 last = glm::clamp(glm::ivec2(glm::ceil((glm::max(corner0, corner1) * 0.5f + 0.5f) * texels)), 0, resolution);
+    return glm::ivec4(first, last - first);
+}
+
+/// <summary>
+/// Starts one cascade's layer of the frame's shadow map from the static depth. The layer is cleared
+/// and only the texels under the static casters' box are written: copied from the last reprojection
+/// if neither the cache nor the cascade moved since, else reprojected and kept for the next frame.
+/// </summary>
+inline void CompositeStaticShadowLayer(GLStateCache& glState, StaticShadowCache& cache, const Cascades& cascades, int cascade,
+    const ShadowMap& shadowMap)
+{
+    StaticShadowLayer& layer = cache.layers[cascade];
+    GLuint target = shadowMap.layerFramebuffers[cascade];
+    BindFramebuffer(glState, target);
+    ScissorTest(glState, false);
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    bool reused = layer.valid && layer.lightSpace == cascades.lightSpace[cascade];
+    // Both projections look along the light, so this is a scale and offset on each axis
+    glm::mat4 cascadeToStatic = cache.lightSpace * glm::inverse(cascades.lightSpace[cascade]);
+    glm::mat4 staticToCascade = glm::inverse(cascadeToStatic);
+    if (!reused)
+    {
+        layer.lightSpace = cascades.lightSpace[cascade];
+        layer.footprint = StaticShadowFootprint(staticToCascade, shadowMap.resolution);
+        layer.valid = true;
+    }
+
+    // A cascade the box does not reach keeps nothing but the clear
+    const glm::ivec4& footprint = layer.footprint;
+    if (footprint.z == 0 || footprint.w == 0)
+    {
+        return;
+    }
+    ScissorTest(glState, true);
+    Scissor(glState, footprint.x, footprint.y, footprint.z, footprint.w);
+    GLuint kept = cache.composited.layerFramebuffers[cascade];
+    if (reused)
+    {
+        BlitFramebufferRegion(glState, kept, target, footprint.x, footprint.y, footprint.z, footprint.w, GL_DEPTH_BUFFER_BIT);
+        return;
+    }
+    UseProgram(glState, cache.program);
+    BindVertexArray(glState, cache.vao);
+    BindTexture(glState, 0, GL_TEXTURE_2D, cache.texture);
+    DepthFunc(glState, GL_ALWAYS);
+    SetUniform(cache.uniforms, Uniform::CascadeToStatic, cascadeToStatic);
+    SetUniform(cache.uniforms, Uniform::StaticToCascade, staticToCascade);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    CountDrawCall(1, 1);
+    BlitFramebufferRegion(glState, target, kept, footprint.x, footprint.y, footprint.z, footprint.w, GL_DEPTH_BUFFER_BIT);
+}
+
+/// <summary>
+/// Starts every cascade of the frame's shadow map from the static depth, leaving the layered
+/// framebuffer bound with the cascade viewport for the moving casters.
+/// </summary>
+/// <param name="glState">State cache</param>
+/// <param name="cache">Static shadow cache</param>
+/// <param name="cascades">This frame's cascades</param>
+/// <param name="shadowMap">The frame's shadow map</param>
+/// <param name="timer">Times each cascade's composite on its own if not nullptr</param>
+inline void CompositeStaticShadows(GLStateCache& glState, StaticShadowCache& cache, const Cascades& cascades,
+    const ShadowMap& shadowMap, ShadowTimer* timer)
+{
+    Viewport(glState, 0, 0, shadowMap.resolution, shadowMap.resolution);
+    for (int i = 0; i < cascades.count; i++)
+    {
+        BeginShadowTimer(timer, CompositeShadowQuery(i));
+        CompositeStaticShadowLayer(glState, cache, cascades, i, shadowMap);
+        EndShadowTimer(timer);
+    }
+    ScissorTest(glState, false);
+    DepthFunc(glState, GL_LESS);
+    BindFramebuffer(glState, shadowMap.framebuffer);
+}
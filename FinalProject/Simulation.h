@@ -0,0 +1,293 @@
+#pragma once
+
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+
+#include <glm/glm.hpp>
+
+/// <summary>
+/// Length of one simulation step, in seconds. Everything that moves advances in steps of exactly
+/// this much, however fast or slow frames are rendered.
+/// </summary>
+const double kSimulationStep = 1.0 / 120.0;
+
+/// <summary>
+/// Most steps one frame may run. After a long stall (a breakpoint, a dragged window) the simulation
+/// drops the time it cannot catch up on instead of taking ever longer frames to catch up.
+/// </summary>
+const int kMaxSimulationSteps = 12;
+
+/// <summary>
+/// Speeds, in units and degrees per second. The old per-frame values at 60 frames a second.
+/// </summary>
+const float kCameraSpeed = 0.3f;
+const float kMovingFaceSpeed = 0.3f;
+const float kMovingFaceSpin = 30.0f;
+
+/// <summary>
+/// Seconds the space bar is ignored after toggling between night and day.
+/// </summary>
+const double kNightToggleCooldown = 400.0 / 60.0;
+
+/// <summary>
+/// Steps between two prints of the simulation and render timings.
+/// </summary>
+const int kSimulationReportSteps = 600;
+
+/// <summary>
+/// Input sampled once per frame and held for every step the frame runs.
+/// </summary>
+struct SimulationInput
+{
+    // W/S and D/A
+    int cameraForward;
+    int cameraRight;
+
+    // Arrow keys
+    int faceForward;
+    int faceRight;
+
+    bool toggleNight;
+
+    // Set by the mouse callback
+    glm::vec3 cameraFront;
+    glm::vec3 cameraUp;
+};
+
+/// <summary>
+/// Whether any key the simulation reads is held, i.e. whether the steps change more than the animations.
+/// </summary>
+inline bool SimulationInputActive(const SimulationInput& input)
+{
+    return input.cameraForward != 0 || input.cameraRight != 0 || input.faceForward != 0 || input.faceRight != 0
+        || input.toggleNight;
+}
+
+/// <summary>
+/// Everything the simulation advances. Two copies are kept, the last two steps,
+/// and rendering draws a blend of them.
+/// </summary>
+struct SimulationState
+{
+    glm::vec3 cameraPos;
+    glm::vec3 movingFacePosition;
+    float movingFaceAngle;
+
+    // Drives the lamp's color cycle
+    double lightTime;
+
+    bool night;
+    double sinceNightToggle;
+    glm::vec3 dayLightColor;
+
+    // State of the generator the day colors come from
+    uint32_t random;
+};
+
+/// <summary>
+/// The next number, in [0, 1), of the simulation's own generator. Unlike rand() it is part of the
+/// state, so the seed alone decides every random choice of a run.
+/// </summary>
+inline float NextSimulationRandom(uint32_t& state)
+{
+    state = state * 1664525u + 1013904223u;
+    return static_cast<float>(state >> 8) / static_cast<float>(1 << 24);
+}
+
+inline SimulationState CreateSimulationState(uint32_t seed)
+{
+    SimulationState state;
+    state.cameraPos = glm::vec3(0.0f, 2.0f, 8.0f);
+    state.movingFacePosition = glm::vec3(1.5f, -1.f, -2.f);
+    state.movingFaceAngle = 0.0f;
+    state.lightTime = 0.0;
+    state.night = true;
+    state.sinceNightToggle = 0.0;
+    state.dayLightColor = glm::vec3(1.0f);
+    state.random = seed;
+    return state;
+}
+
+/// <summary>
+/// Advances the state by one step of kSimulationStep seconds.
+/// </summary>
+inline void StepSimulation(SimulationState& state, const SimulationInput& input)
+{
+    float step = static_cast<float>(kSimulationStep);
+
+    glm::vec3 cameraRight = glm::normalize(glm::cross(input.cameraFront, input.cameraUp));
+    state.cameraPos += input.cameraFront * (kCameraSpeed * step * input.cameraForward);
+    state.cameraPos += cameraRight * (kCameraSpeed * step * input.cameraRight);
+
+    state.movingFacePosition += glm::vec3(0.0f, 0.0f, -1.0f) * (kMovingFaceSpeed * step * input.faceForward);
+    state.movingFacePosition += glm::vec3(1.0f, 0.0f, 0.0f) * (kMovingFaceSpeed * step * input.faceRight);
+    state.movingFaceAngle += kMovingFaceSpin * step;
+
+    state.lightTime += kSimulationStep;
+
+    state.sinceNightToggle += kSimulationStep;
+    if (input.toggleNight && state.sinceNightToggle > kNightToggleCooldown)
+    {
+        state.sinceNightToggle = 0.0;
+        state.night = !state.night;
+        if (!state.night)
+        {
+            // Every day gets a color of its own
+            state.dayLightColor.x = NextSimulationRandom(state.random);
+            state.dayLightColor.y = NextSimulationRandom(state.random);
+            state.dayLightColor.z = NextSimulationRandom(state.random);
+        }
+    }
+}
+
+/// <summary>
+/// The state to render: continuous values blended between the last two steps, everything else from the latest.
+/// </summary>
+/// <param name="previous">State before the last step</param>
+/// <param name="current">State after the last step</param>
+/// <param name="alpha">How far rendering is past the last step, in steps</param>
+inline SimulationState InterpolateSimulation(const SimulationState& previous, const SimulationState& current, double alpha)
+{
+    float blend = static_cast<float>(alpha);
+    SimulationState state = current;
+    state.cameraPos = glm::mix(previous.cameraPos, current.cameraPos, blend);
+    state.movingFacePosition = glm::mix(previous.movingFacePosition, current.movingFacePosition, blend);
+    state.movingFaceAngle = glm::mix(previous.movingFaceAngle, current.movingFaceAngle, blend);
+    state.lightTime = previous.lightTime + (current.lightTime - previous.lightTime) * alpha;
+    return state;
+}
+
+/// <summary>
+/// Turns the time between frames into a whole number of simulation steps, carrying the rest over.
+/// Reads a high resolution tick counter, e.g. glfwGetTimerValue.
+/// </summary>
+struct SimulationClock
+{
+    uint64_t frequency;
+    uint64_t lastTicks;
+    double accumulator;
+
+    // Where the time since the last report went
+    uint64_t steps;
+    uint64_t frames;
+    uint64_t droppedSteps;
+    double simulationSeconds;
+    double idleSeconds;
+    double frameSeconds;
+};
+
+inline SimulationClock CreateSimulationClock(uint64_t ticks, uint64_t frequency)
+{
+    SimulationClock clock = {};
+    clock.frequency = frequency;
+    clock.lastTicks = ticks;
+    return clock;
+}
+
+inline double TicksToSeconds(const SimulationClock& clock, uint64_t ticks)
+{
+    return static_cast<double>(ticks) / static_cast<double>(clock.frequency);
+}
+
+/// <summary>
+/// Starts a frame that advances the simulation by the provided time instead of the time that really
+/// passed, e.g. a recorded frame's. The real time still goes into the report.
+/// </summary>
+/// <returns>Number of steps to run this frame</returns>
+inline int BeginSimulationFrame(SimulationClock& clock, uint64_t ticks, double stepSeconds)
+{
+    clock.frameSeconds += TicksToSeconds(clock, ticks - clock.lastTicks);
+    clock.lastTicks = ticks;
+
+    clock.accumulator += stepSeconds;
+    int steps = static_cast<int>(clock.accumulator / kSimulationStep);
+    if (steps > kMaxSimulationSteps)
+    {
+        clock.droppedSteps += steps - kMaxSimulationSteps;
+        clock.accumulator -= (steps - kMaxSimulationSteps) * kSimulationStep;
+        steps = kMaxSimulationSteps;
+    }
+    clock.accumulator -= steps * kSimulationStep;
+    return steps;
+}
+
+/// <summary>
+/// Starts a frame: adds the time since the last one to the accumulator.
+/// </summary>
+/// <returns>Number of steps to run this frame</returns>
+inline int BeginSimulationFrame(SimulationClock& clock, uint64_t ticks)
+{
+    return BeginSimulationFrame(clock, ticks, TicksToSeconds(clock, ticks - clock.lastTicks));
+}
+
+/// <summary>
+/// Starts a frame that runs a fixed number of steps, however long it took, so that a run shows the
+/// same frames on every machine. The time is still recorded for the report.
+/// </summary>
+/// <returns>Number of steps to run this frame</returns>
+inline int BeginFixedSimulationFrame(SimulationClock& clock, uint64_t ticks, int steps)
+{
+    clock.frameSeconds += TicksToSeconds(clock, ticks - clock.lastTicks);
+    clock.lastTicks = ticks;
+    clock.accumulator = 0.0;
+    return steps;
+}
+
+/// <summary>
+/// Records how long this frame's steps took, measured by the caller with the same tick counter.
+/// </summary>
+inline void EndSimulationSteps(SimulationClock& clock, int steps, uint64_t stepTicks)
+{
+    clock.steps += steps;
+    clock.simulationSeconds += TicksToSeconds(clock, stepTicks);
+}
+
+/// <summary>
+/// Counts a frame that was rendered; loop iterations that only slept are not frames.
+/// </summary>
+inline void CountRenderedFrame(SimulationClock& clock)
+{
+    clock.frames++;
+}
+
+/// <summary>
+/// Records time the loop spent sleeping, so it is not counted as rendering.
+/// </summary>
+inline void RecordSimulationIdle(SimulationClock& clock, double seconds)
+{
+    clock.idleSeconds += seconds;
+}
+
+/// <summary>
+/// How far between the last step and the next one this frame is rendered, in [0, 1).
+/// </summary>
+inline double SimulationAlpha(const SimulationClock& clock)
+{
+    return clock.accumulator / kSimulationStep;
+}
+
+/// <summary>
+/// Prints, every kSimulationReportSteps steps, how the time split between simulating and rendering.
+/// </summary>
+inline void ReportSimulationClock(SimulationClock& clock, std::ostream& report)
+{
+    if (clock.steps < static_cast<uint64_t>(kSimulationReportSteps) || clock.frames == 0)
+    {
+        return;
+    }
+    report << std::fixed << std::setprecision(3) << "Simulation: " << clock.steps << " steps in " << clock.frames << " frames, "
+        << clock.simulationSeconds * 1.0e6 / clock.steps << " us per step, "
+        << (clock.frameSeconds - clock.simulationSeconds - clock.idleSeconds) * 1000.0 / clock.frames << " ms per frame rendering";
+    if (clock.droppedSteps != 0)
+    {
+        report << ", " << clock.droppedSteps << " steps dropped";
+    }
+    report << std::defaultfloat << std::endl;
+    clock.steps = 0;
+    clock.frames = 0;
+    clock.droppedSteps = 0;
+    clock.simulationSeconds = 0.0;
+    clock.idleSeconds = 0.0;
+    clock.frameSeconds = 0.0;
+}
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "GLStateCache.h"
+#include "RenderStats.h"
+#include "UniformTable.h"
+
+/// <summary>
+/// Characters the overlay font has, in atlas order. Anything else is drawn as a space.
+/// </summary>
+const char kOverlayGlyphs[] = " 0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ.:/-";
+
+/// <summary>
+/// Rows of every glyph, top first, the leftmost pixel in bit 4.
+/// </summary>
+const unsigned char kOverlayFont[][7] =
+{
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E },
+    { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E },
+    { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F },
+    { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E },
+    { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 },
+    { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E },
+    { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E },
+    { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },
+    { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E },
+    { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C },
+    { 0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11 },
+    { 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E },
+    { 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E },
+    { 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C },
+    { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F },
+    { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 },
+    { 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F },
+    { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 },
+    { 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E },
+    { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C },
+    { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 },
+    { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F },
+    { 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 },
+    { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 },
+    { 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E },
+    { 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 },
+    { 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D },
+    { 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 },
+    { 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E },
+    { 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 },
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E },
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 },
+    { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A },
+    { 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 },
+    { 0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04 },
+    { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C },
+    { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 },
+    { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 },
+    { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 }
+};
+
+/// <summary>
+/// Size of a glyph's cell in the atlas, the glyph plus a column and a row of spacing.
+/// After the glyphs comes one solid cell, which the panel behind the text samples.
+/// </summary>
+const int kOverlayCellWidth = 6;
+const int kOverlayCellHeight = 8;
+const int kOverlayGlyphCount = sizeof(kOverlayGlyphs) - 1;
+
+/// <summary>
+/// Screen pixels per font pixel, and the distance of the panel from the top left corner.
+/// </summary>
+const int kOverlayScale = 2;
+const int kOverlayMargin = 8;
+
+/// <summary>
+/// Vertex of overlay.vsh: a clip space position, the atlas coordinate and a color.
+/// </summary>
+struct OverlayVertex
+{
+    GLfloat x, y;
+    GLfloat u, v;
+    GLubyte r, g, b, a;
+};
+
+/// <summary>
+/// On-screen overlay of the render stats. The panel and all of its text are rebuilt on the CPU
+/// every frame and go out as a single draw, after everything else has been drawn.
+/// </summary>
+struct StatsOverlay
+{
+    bool visible;
+    GLuint program;
+    GLuint vao;
+    GLuint vbo;
+    GLuint atlas;
+    GLsizeiptr capacity;
+    std::vector<OverlayVertex> vertices;
+};
+
+/// <summary>
+/// Creates the font atlas and the vertex array of the overlay.
+/// </summary>
+/// <param name="program">Program made of overlay.vsh and overlay.fsh</param>
+inline StatsOverlay CreateStatsOverlay(GLuint program)
+{
+    StatsOverlay overlay;
+    overlay.visible = false;
+    overlay.program = program;
+    overlay.capacity = 0;
+
+    int atlasWidth = (kOverlayGlyphCount + 1) * kOverlayCellWidth;
+    std::vector<unsigned char> texels(static_cast<size_t>(atlasWidth) * kOverlayCellHeight, 0);
+    for (int glyph = 0; glyph <= kOverlayGlyphCount; glyph++)
+    {
+        for (int y = 0; y < kOverlayCellHeight; y++)
+        {
+            for (int x = 0; x < kOverlayCellWidth; x++)
+            {
+                bool solid = glyph == kOverlayGlyphCount
+                    || (y < 7 && x < 5 && (kOverlayFont[glyph][y] & (0x10 >> x)) != 0);
+                texels[y * atlasWidth + glyph * kOverlayCellWidth + x] = solid ? 255 : 0;
+            }
+        }
+    }
+    glGenTextures(1, &overlay.atlas);
+    glBindTexture(GL_TEXTURE_2D, overlay.atlas);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, atlasWidth, kOverlayCellHeight, 0, GL_RED, GL_UNSIGNED_BYTE, texels.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenVertexArrays(1, &overlay.vao);
+    glGenBuffers(1, &overlay.vbo);
+    glBindVertexArray(overlay.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, overlay.vbo);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(OverlayVertex), reinterpret_cast<void*>(offsetof(OverlayVertex, x)));
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(OverlayVertex), reinterpret_cast<void*>(offsetof(OverlayVertex, u)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(OverlayVertex), reinterpret_cast<void*>(offsetof(OverlayVertex, r)));
+    glEnableVertexAttribArray(2);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // The atlas always sits on unit 0
+    glUseProgram(program);
+    SetUniform(ResolveUniforms(program), Uniform::Tex, 0);
+    glUseProgram(0);
+    return overlay;
+}
+
+inline void DeleteStatsOverlay(StatsOverlay& overlay)
+{
+    glDeleteTextures(1, &overlay.atlas);
+    glDeleteBuffers(1, &overlay.vbo);
+    glDeleteVertexArrays(1, &overlay.vao);
+}
+
+/// <summary>
+/// Adds a rectangle showing one atlas cell, in pixels from the top left corner of the screen.
+/// </summary>
+inline void AddOverlayQuad(StatsOverlay& overlay, int x, int y, int width, int height, int cell, const GLubyte color[4],
+    int screenWidth, int screenHeight)
+{
+    float left = 2.0f * x / screenWidth - 1.0f;
+    float right = 2.0f * (x + width) / screenWidth - 1.0f;
+    float top = 1.0f - 2.0f * y / screenHeight;
+    float bottom = 1.0f - 2.0f * (y + height) / screenHeight;
+    float u0 = static_cast<float>(cell) / (kOverlayGlyphCount + 1);
+    float u1 = static_cast<float>(cell + 1) / (kOverlayGlyphCount + 1);
+
+    // The atlas' first row is the top of the glyphs
+    OverlayVertex corners[4] = {
+        { left, top, u0, 0.0f, color[0], color[1], color[2], color[3] },
+        { right, top, u1, 0.0f, color[0], color[1], color[2], color[3] },
+        { right, bottom, u1, 1.0f, color[0], color[1], color[2], color[3] },
+        { left, bottom, u0, 1.0f, color[0], color[1], color[2], color[3] }
+    };
+    const int triangles[6] = { 0, 1, 2, 0, 2, 3 };
+    for (int corner : triangles)
+    {
+        overlay.vertices.push_back(corners[corner]);
+    }
+}
+
+/// <summary>
+/// Draws the last finished frame's stats over whatever is bound, one line per counter.
+/// Goes through the cache like every other draw, so its own draw counts towards the stats.
+/// </summary>
+/// <param name="screenWidth">Width of the viewport in pixels</param>
+/// <param name="screenHeight">Height of the viewport in pixels</param>
+inline void DrawStatsOverlay(StatsOverlay& overlay, GLStateCache& cache, const RenderStats& stats, int screenWidth, int screenHeight)
+{
+    char lines[10][48];
+    std::snprintf(lines[0], sizeof(lines[0]), "DRAW CALLS %d", stats.drawCalls);
+    std::snprintf(lines[1], sizeof(lines[1]), "TRIANGLES %llu", static_cast<unsigned long long>(stats.triangles));
+    std::snprintf(lines[2], sizeof(lines[2]), "PROGRAMS %d", stats.programChanges);
+    std::snprintf(lines[3], sizeof(lines[3]), "TEXTURE BINDS %d", stats.textureBinds);
+    std::snprintf(lines[4], sizeof(lines[4]), "UNIFORMS %d", stats.uniformUploads);
+    std::snprintf(lines[5], sizeof(lines[5]), "UPLOADED %.1f KB", stats.bufferBytes / 1024.0);
+    std::snprintf(lines[6], sizeof(lines[6]), "QUEUE CHANGES %d SORTED %d", stats.submittedStateChanges, stats.sortedStateChanges);
+    std::snprintf(lines[7], sizeof(lines[7]), "GL CALLS %d ELIDED %d", stats.glCallsIssued, stats.glCallsElided);
+    std::snprintf(lines[8], sizeof(lines[8]), "CPU %.2f MS", stats.cpuMilliseconds);
+    std::snprintf(lines[9], sizeof(lines[9]), "GPU %.2f MS", stats.gpuMilliseconds);
+
+    const int cellWidth = kOverlayCellWidth * kOverlayScale;
+    const int cellHeight = kOverlayCellHeight * kOverlayScale;
+    size_t longest = 0;
+    for (const char* line : lines)
+    {
+        longest = std::max(longest, std::strlen(line));
+    }
+
+    const GLubyte panelColor[4] = { 0, 0, 0, 160 };
+    const GLubyte textColor[4] = { 255, 255, 160, 255 };
+    overlay.vertices.clear();
+    AddOverlayQuad(overlay, kOverlayMargin, kOverlayMargin, static_cast<int>(longest + 2) * cellWidth, 12 * cellHeight,
+        kOverlayGlyphCount, panelColor, screenWidth, screenHeight);
+    for (int line = 0; line < 10; line++)
+    {
+        for (int i = 0; lines[line][i] != '\0'; i++)
+        {
+            const char* glyph = std::strchr(kOverlayGlyphs, lines[line][i]);
+            int cell = glyph != nullptr ? static_cast<int>(glyph - kOverlayGlyphs) : 0;
+            if (cell != 0)
+            {
+                AddOverlayQuad(overlay, kOverlayMargin + (i + 1) * cellWidth, kOverlayMargin + (line + 1) * cellHeight,
+                    cellWidth, cellHeight, cell, textColor, screenWidth, screenHeight);
+            }
+        }
+    }
+
+    // Orphan the store like the instance buffer, then upload the whole overlay at once
+    GLsizeiptr bytes = overlay.vertices.size() * sizeof(OverlayVertex);
+    glBindBuffer(GL_ARRAY_BUFFER, overlay.vbo);
+    overlay.capacity = std::max(bytes, overlay.capacity);
+    glBufferData(GL_ARRAY_BUFFER, overlay.capacity, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, overlay.vertices.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    CountBufferUpload(bytes);
+
+    UseProgram(cache, overlay.program);
+    BindVertexArray(cache, overlay.vao);
+    BindTexture(cache, 0, GL_TEXTURE_2D, overlay.atlas);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(overlay.vertices.size()));
+    CountDrawCall(overlay.vertices.size() / 3, 1);
+    glDisable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+    BindVertexArray(cache, 0);
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "BlockCompression.h"
+#include "MappedFile.h"
+#include "MipChain.h"
+
+/// <summary>
+/// One level of one face of a chain, in the chain's format.
+/// </summary>
+struct TextureImage
+{
+    int width;
+    int height;
+    const unsigned char* data;
+    size_t size;
+};
+
+/// <summary>
+/// Every level of every face of a texture as the GPU takes them, and whatever holds their bytes:
+/// the levels built when the files were decoded, the blocks they were encoded to, or a container
+/// mapped into memory, which the images point straight into. A zeroed chain has no levels.
+/// </summary>
+struct TextureChain
+{
+    // Format the GPU stores the texels in, and the format and type of the data, both 0 if it is block-compressed
+    GLenum internalFormat;
+    GLenum format;
+    GLenum type;
+
+    int faceCount;
+    int levelCount;
+
+    // Level by level, the faces of each in turn: images[level * faceCount + face]
+    std::vector<TextureImage> images;
+
+    // Owners of the bytes, whichever the chain came from
+    std::vector<TextureLevel> levels;
+    std::vector<std::vector<unsigned char>> blocks;
+    MappedFile file;
+
+    // Of block-compressed data against the images it was encoded from, in decibels; 0 if unknown or uncompressed
+    float psnr;
+};
+
+inline const TextureImage& ChainImage(const TextureChain& chain, int level, int face)
+{
+    return chain.images[static_cast<size_t>(level) * chain.faceCount + face];
+}
+
+inline bool ChainCompressed(const TextureChain& chain)
+{
+    return chain.format == 0;
+}
+
+/// <summary>
+/// Takes the chains of decoded faces, all the same size, as an RGBA8 chain the GPU stores as RGB8.
+/// </summary>
+inline TextureChain MakeTextureChain(std::vector<std::vector<TextureLevel>> faces)
+{
+    TextureChain chain = {};
+    chain.internalFormat = GL_RGB8;
+    chain.format = GL_RGBA;
+    chain.type = GL_UNSIGNED_BYTE;
+    chain.faceCount = static_cast<int>(faces.size());
+    chain.levelCount = static_cast<int>(faces.front().size());
+    for (int level = 0; level < chain.levelCount; level++)
+    {
+        for (std::vector<TextureLevel>& face : faces)
+        {
+            chain.levels.push_back(std::move(face[level]));
+        }
+    }
+    // Pointers into the levels stay valid as the chain moves, the pixels being on the heap
+    for (const TextureLevel& level : chain.levels)
+    {
+        chain.images.push_back({ level.width, level.height, level.pixels.data(), level.pixels.size() });
+    }
+    return chain;
+}
+
+/// <summary>
+/// Takes the encoded blocks of every image of a chain, in the same order, as a chain of its own.
+/// </summary>
+/// <param name="psnr">Error of the blocks against the source chain</param>
+inline TextureChain MakeCompressedChain(const TextureChain& source, BlockFormat format, std::vector<std::vector<unsigned char>> blocks,
+    float psnr)
+{
+    TextureChain chain = {};
+    chain.internalFormat = BlockInternalFormat(format);
+    chain.faceCount = source.faceCount;
+    chain.levelCount = source.levelCount;
+    chain.blocks = std::move(blocks);
+    for (size_t i = 0; i < source.images.size(); i++)
+    {
+        chain.images.push_back({ source.images[i].width, source.images[i].height, chain.blocks[i].data(), chain.blocks[i].size() });
+    }
+    chain.psnr = psnr;
+    return chain;
+}
+
+/// <summary>
+/// Frees the levels or blocks or unmaps the container, leaving the chain without levels.
+/// </summary>
+inline void ReleaseTextureChain(TextureChain& chain)
+{
+    UnmapFile(chain.file);
+    chain = TextureChain();
+}
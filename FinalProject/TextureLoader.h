@@ -0,0 +1,684 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stb_image.h>
+
+#include "BakedTexture.h"
+#include "BlockCompression.h"
+#include "CpuProfiler.h"
+#include "GLStateCache.h"
+#include "MipChain.h"
+#include "TextureChain.h"
+
+// Anisotropic filtering is core since GL 4.6 and an extension before, under the same values
+#ifndef GL_TEXTURE_MAX_ANISOTROPY
+#define GL_TEXTURE_MAX_ANISOTROPY 0x84FE
+#endif
+#ifndef GL_MAX_TEXTURE_MAX_ANISOTROPY
+#define GL_MAX_TEXTURE_MAX_ANISOTROPY 0x84FF
+#endif
+
+/// <summary>
+/// Anisotropy the material textures ask for unless they say otherwise.
+/// </summary>
+const float kMaterialAnisotropy = 8.0f;
+
+/// <summary>
+/// Rows of 4x4 blocks a loader thread encodes at a time, so the images of one large texture are
+/// shared out between every thread.
+/// </summary>
+const int kBlockRowsPerJob = 16;
+
+/// <summary>
+/// A texture to load: one image file, or six for the faces of a cube map, and how it is sampled.
+/// </summary>
+struct TextureDesc
+{
+    GLenum target;
+
+    // One path for GL_TEXTURE_2D, +X, -X, +Y, -Y, +Z, -Z for GL_TEXTURE_CUBE_MAP
+    std::vector<std::string> paths;
+
+    // Whether the rows are flipped so the first one is the bottom, as GL texture coordinates expect
+    bool flip;
+    GLint magFilter;
+    GLint minFilter;
+    GLint wrap;
+
+    // Most anisotropy to sample with where the driver supports it, 1 for none
+    float anisotropy;
+
+    // How the levels of the chain are averaged
+    MipFilter mipFilter;
+
+    // What the data is, to compress it on the GPU
+    TextureCompression compression;
+};
+
+/// <summary>
+/// A material texture as the scene samples them: bottom row first, trilinear and anisotropic,
+/// repeating, with colour levels averaged in linear light and compressed as colour.
+/// </summary>
+inline TextureDesc MaterialTextureDesc(const std::string& path, GLint magFilter = GL_LINEAR)
+{
+    return { GL_TEXTURE_2D, { path }, true, magFilter, GL_LINEAR_MIPMAP_LINEAR, GL_REPEAT, kMaterialAnisotropy, MipFilter::Gamma,
+        TextureCompression::Color };
+}
+
+/// <summary>
+/// A cube map as the skybox samples it: rows as stored, linear, clamped at the edges. The skybox is
+/// never drawn smaller than its faces, so it samples the top level only.
+/// </summary>
+inline TextureDesc CubeMapTextureDesc(const std::vector<std::string>& facePaths)
+{
+    return { GL_TEXTURE_CUBE_MAP, facePaths, false, GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, 1.0f, MipFilter::Gamma,
+        TextureCompression::Color };
+}
+
+inline bool MinFilterUsesMipmaps(GLint minFilter)
+{
+    return minFilter != GL_LINEAR && minFilter != GL_NEAREST;
+}
+
+/// <summary>
+/// The largest anisotropy the driver samples with, or 1 if it cannot filter anisotropically.
+/// </summary>
+inline float MaxTextureAnisotropy()
+{
+    GLint major = 0;
+    GLint minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    bool supported = major > 4 || (major == 4 && minor >= 6);
+    GLint extensionCount = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+    for (GLint i = 0; i < extensionCount && !supported; i++)
+    {
+        std::string extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+        supported = extension == "GL_EXT_texture_filter_anisotropic" || extension == "GL_ARB_texture_filter_anisotropic";
+    }
+    GLfloat anisotropy = 1.0f;
+    if (supported)
+    {
+        glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY, &anisotropy);
+    }
+    return anisotropy;
+}
+
+/// <summary>
+/// Rows of blocks of one image of a chain, encoded by one job.
+/// </summary>
+struct BlockBand
+{
+    size_t image;
+    int firstRow;
+    int rowCount;
+};
+
+/// <summary>
+/// Where a texture's chain came from.
+/// </summary>
+enum class TextureSource
+{
+    // Its files, decoded and, if it is compressed, encoded at load
+    Decoded,
+
+    // The cache of chains encoded by earlier runs
+    Cached,
+
+    // The container baked beside its files
+    Baked
+};
+
+/// <summary>
+/// A requested texture. Its handle exists from the request on, showing a placeholder texel until
+/// its chain is loaded and the images are uploaded into it.
+/// </summary>
+struct TextureAsset
+{
+    TextureDesc desc;
+    GLuint texture;
+
+    // Where the requester keeps the texture, handed back with it once it is loaded
+    uint32_t slot;
+
+    // Written by the workers under the loader's mutex: the bytes of the files if they were read to
+    // be hashed, decoded from memory then, and the chain of each file until all of them are decoded
+    std::vector<std::vector<unsigned char>> files;
+    std::vector<std::vector<TextureLevel>> faces;
+    size_t imagesLeft;
+    bool opaque;
+
+    // Blocks of every image of the chain while they are encoded, the bands of them still to encode
+    // and the error of those done
+    BlockFormat blockFormat;
+    std::vector<std::vector<unsigned char>> blocks;
+    std::vector<BlockBand> bands;
+    size_t bandsLeft;
+    uint64_t squaredError;
+
+    // The texture's chain, no levels if a file could not be decoded, and where it came from
+    TextureChain chain;
+    TextureSource source;
+
+    // The cache entry the encoded chain goes to, and containers that were turned down or could not be written
+    std::string cachePath;
+    std::string staleBakedPath;
+    bool cacheWriteFailed;
+
+    // Summed over the files and bands, or the time the container took to map and read in
+    double decodeMilliseconds;
+    double mipMilliseconds;
+    double encodeMilliseconds;
+    double mapMilliseconds;
+
+    std::chrono::steady_clock::time_point requested;
+};
+
+/// <summary>
+/// What a loader thread does for a texture.
+/// </summary>
+enum class TextureJobKind
+{
+    // Maps its baked container, else its entry in the cache, else queues its files
+    Open,
+
+    // Decodes one of its files and builds that file's chain
+    Decode,
+
+    // Encodes one band of blocks of its chain
+    Encode
+};
+
+struct TextureJob
+{
+    TextureAsset* asset;
+    TextureJobKind kind;
+
+    // The file to decode or the band to encode
+    size_t index;
+};
+
+/// <summary>
+/// Loads textures in the background: a pool of threads maps, decodes and encodes them in parallel while
+/// the render loop carries on, and the thread owning the GL context takes whatever is loaded to upload it.
+/// </summary>
+struct TextureLoader
+{
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable decoded;
+    std::vector<std::thread> threads;
+    bool stopping;
+
+    // Whether chains are mapped from the containers baked beside the files where there are any, and
+    // where encoded chains are cached, empty to encode them on every run
+    bool baked;
+    std::string cacheDirectory;
+
+    // Work for the threads, and assets whose chain is loaded
+    std::deque<TextureJob> jobs;
+    std::deque<TextureAsset*> finished;
+
+    // Only touched by the context thread
+    std::vector<std::unique_ptr<TextureAsset>> assets;
+    size_t takenCount;
+    std::chrono::steady_clock::time_point firstRequest;
+};
+
+inline uint32_t TextureAssetFlags(const TextureAsset& asset)
+{
+    return BakedTextureFlags(asset.desc.flip, asset.desc.mipFilter, asset.desc.compression);
+}
+
+/// <summary>
+/// Hands a loaded asset to the context thread.
+/// </summary>
+inline void FinishTextureAsset(TextureLoader& loader, TextureAsset* asset)
+{
+    loader.finished.push_back(asset);
+    loader.decoded.notify_all();
+}
+
+inline void QueueTextureFiles(TextureLoader& loader, TextureAsset* asset)
+{
+    for (size_t i = 0; i < asset->desc.paths.size(); i++)
+    {
+        loader.jobs.push_back({ asset, TextureJobKind::Decode, i });
+    }
+    loader.wake.notify_all();
+}
+
+/// <summary>
+/// Maps the asset's baked container, or else reads its files to look their hash up in the cache,
+/// and reads in whichever it maps, off the thread that uploads from it. Failing both, the files
+/// are queued for decoding.
+/// </summary>
+inline void OpenTextureAsset(TextureLoader& loader, TextureAsset* asset, std::unique_lock<std::mutex>& lock)
+{
+    std::string bakedPath = loader.baked ? BakedTexturePath(asset->desc.paths.front()) : std::string();
+    bool cached = asset->desc.compression != TextureCompression::None && !loader.cacheDirectory.empty();
+    std::string cacheDirectory = loader.cacheDirectory;
+    std::vector<std::string> paths = asset->desc.paths;
+    uint32_t flags = TextureAssetFlags(*asset);
+    int faces = static_cast<int>(paths.size());
+    lock.unlock();
+
+    TextureChain chain = {};
+    TextureSource source = TextureSource::Decoded;
+    std::string staleBakedPath;
+    std::vector<std::vector<unsigned char>> files;
+    std::string cachePath;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    {
+        CPU_ZONE("Texture map");
+        bool missing;
+        if (!bakedPath.empty())
+        {
+            // A container baked before one of the images was edited is passed over for the image
+            if (OpenBakedTexture(bakedPath, flags, faces, SourceFilesStamp(paths), chain, missing))
+            {
+                source = TextureSource::Baked;
+            }
+            else if (!missing)
+            {
+                staleBakedPath = bakedPath;
+            }
+        }
+        if (source == TextureSource::Decoded && cached)
+        {
+            files.resize(paths.size());
+            bool read = true;
+            for (size_t i = 0; i < paths.size() && read; i++)
+            {
+                read = ReadFileBytes(paths[i], files[i]);
+            }
+            if (read)
+            {
+                cachePath = CachedTexturePath(cacheDirectory, files, flags);
+                if (OpenBakedTexture(cachePath, flags, faces, 0, chain, missing))
+                {
+                    source = TextureSource::Cached;
+                    files.clear();
+                }
+            }
+            else
+            {
+                // Decoded from the paths, which reports the file that is missing
+                files.clear();
+            }
+        }
+        if (source != TextureSource::Decoded)
+        {
+            PrefetchMappedFile(chain.file);
+        }
+    }
+    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    lock.lock();
+    asset->staleBakedPath = staleBakedPath;
+    asset->source = source;
+    if (source != TextureSource::Decoded)
+    {
+        asset->chain = std::move(chain);
+        asset->faces.clear();
+        asset->mapMilliseconds = milliseconds;
+        FinishTextureAsset(loader, asset);
+        return;
+    }
+    if (!files.empty())
+    {
+        asset->files = std::move(files);
+    }
+    asset->cachePath = cachePath;
+    QueueTextureFiles(loader, asset);
+}
+
+/// <summary>
+/// Splits every image of the asset's chain into bands of block rows and queues them for encoding.
+/// </summary>
+inline void QueueBlockEncoding(TextureLoader& loader, TextureAsset* asset)
+{
+    asset->blockFormat = ChooseBlockFormat(asset->desc.compression, asset->opaque);
+    asset->squaredError = 0;
+    for (size_t i = 0; i < asset->chain.images.size(); i++)
+    {
+        const TextureImage& image = asset->chain.images[i];
+        asset->blocks.emplace_back(BlockImageBytes(image.width, image.height, asset->blockFormat));
+        for (int row = 0; row < BlockCount(image.height); row += kBlockRowsPerJob)
+        {
+            asset->bands.push_back({ i, row, std::min(kBlockRowsPerJob, BlockCount(image.height) - row) });
+        }
+    }
+    asset->bandsLeft = asset->bands.size();
+    for (size_t i = 0; i < asset->bands.size(); i++)
+    {
+        loader.jobs.push_back({ asset, TextureJobKind::Encode, i });
+    }
+    loader.wake.notify_all();
+}
+
+/// <summary>
+/// Decodes one of the asset's files and builds its chain. Once every file is in, the chain is
+/// queued for encoding, or handed over if it is not compressed.
+/// </summary>
+inline void DecodeTextureFile(TextureLoader& loader, TextureAsset* asset, size_t index, std::unique_lock<std::mutex>& lock)
+{
+    std::string path = asset->desc.paths[index];
+    std::vector<unsigned char> file;
+    if (!asset->files.empty())
+    {
+        file = std::move(asset->files[index]);
+    }
+    bool flip = asset->desc.flip;
+    MipFilter mipFilter = asset->desc.mipFilter;
+    lock.unlock();
+
+    std::vector<TextureLevel> levels;
+    unsigned char* pixels;
+    int width;
+    int height;
+    bool opaque = true;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    {
+        CPU_ZONE("Texture decode");
+        int channels;
+        stbi_set_flip_vertically_on_load_thread(flip);
+        if (file.empty())
+        {
+            pixels = stbi_load(path.c_str(), &width, &height, &channels, 4);
+        }
+        else
+        {
+            pixels = stbi_load_from_memory(file.data(), static_cast<int>(file.size()), &width, &height, &channels, 4);
+            file = std::vector<unsigned char>();
+        }
+    }
+    std::chrono::steady_clock::time_point decoded = std::chrono::steady_clock::now();
+    if (pixels != nullptr)
+    {
+        CPU_ZONE("Mip chain");
+        levels = BuildMipChain(pixels, width, height, mipFilter);
+        for (size_t i = 3; i < levels.front().pixels.size() && opaque; i += 4)
+        {
+            opaque = levels.front().pixels[i] == 255;
+        }
+        stbi_image_free(pixels);
+    }
+    std::chrono::steady_clock::time_point built = std::chrono::steady_clock::now();
+
+    lock.lock();
+    asset->faces[index] = std::move(levels);
+    asset->opaque = asset->opaque && opaque;
+    asset->decodeMilliseconds += std::chrono::duration<double, std::milli>(decoded - start).count();
+    asset->mipMilliseconds += std::chrono::duration<double, std::milli>(built - decoded).count();
+    if (--asset->imagesLeft != 0)
+    {
+        return;
+    }
+
+    // Faces that failed stay behind empty for the report
+    bool complete = true;
+    for (const std::vector<TextureLevel>& face : asset->faces)
+    {
+        complete = complete && !face.empty();
+    }
+    asset->files.clear();
+    if (!complete)
+    {
+        FinishTextureAsset(loader, asset);
+        return;
+    }
+    asset->chain = MakeTextureChain(std::move(asset->faces));
+    asset->faces.clear();
+    if (asset->desc.compression == TextureCompression::None)
+    {
+        FinishTextureAsset(loader, asset);
+        return;
+    }
+    QueueBlockEncoding(loader, asset);
+}
+
+/// <summary>
+/// Encodes one band of the asset's chain. The last band swaps the chain for its blocks, writes them
+/// to the cache and hands the asset over.
+/// </summary>
+inline void EncodeTextureBand(TextureLoader& loader, TextureAsset* asset, size_t index, std::unique_lock<std::mutex>& lock)
+{
+    BlockBand band = asset->bands[index];
+    const TextureImage& image = asset->chain.images[band.image];
+    unsigned char* blocks = asset->blocks[band.image].data();
+    BlockFormat format = asset->blockFormat;
+    lock.unlock();
+
+    // The bands write blocks of their own and only read the chain, which stays put until the last is done
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint64_t squaredError;
+    {
+        CPU_ZONE("Block encode");
+        squaredError = EncodeBlockRows(image.data, image.width, image.height, format, band.firstRow, band.rowCount, blocks);
+    }
+    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    lock.lock();
+    asset->squaredError += squaredError;
+    asset->encodeMilliseconds += milliseconds;
+    if (--asset->bandsLeft != 0)
+    {
+        return;
+    }
+    lock.unlock();
+
+    // No other thread holds the asset any more until it is handed over
+    uint64_t samples = 0;
+    for (const TextureImage& level : asset->chain.images)
+    {
+        samples += static_cast<uint64_t>(level.width) * level.height * BlockChannels(format);
+    }
+    TextureChain chain = MakeCompressedChain(asset->chain, format, std::move(asset->blocks),
+        static_cast<float>(PeakSignalToNoise(asset->squaredError, samples)));
+    ReleaseTextureChain(asset->chain);
+    asset->chain = std::move(chain);
+    asset->blocks.clear();
+    asset->bands.clear();
+    if (!asset->cachePath.empty())
+    {
+        CPU_ZONE("Texture cache write");
+        asset->cacheWriteFailed = !WriteBakedTexture(asset->cachePath, asset->chain, TextureAssetFlags(*asset), 0);
+    }
+
+    lock.lock();
+    FinishTextureAsset(loader, asset);
+}
+
+/// <summary>
+/// Runs jobs until the loader stops. Every thread keeps a flip setting of its own, so assets that
+/// flip and ones that do not can be decoded side by side.
+/// </summary>
+inline void RunTextureLoader(TextureLoader& loader)
+{
+    NameCpuProfilerThread("Texture loader");
+    std::unique_lock<std::mutex> lock(loader.mutex);
+    for (;;)
+    {
+        loader.wake.wait(lock, [&loader] { return loader.stopping || !loader.jobs.empty(); });
+        if (loader.stopping)
+        {
+            return;
+        }
+        TextureJob job = loader.jobs.front();
+        loader.jobs.pop_front();
+        switch (job.kind)
+        {
+        case TextureJobKind::Open:
+            OpenTextureAsset(loader, job.asset, lock);
+            break;
+        case TextureJobKind::Decode:
+            DecodeTextureFile(loader, job.asset, job.index, lock);
+            break;
+        case TextureJobKind::Encode:
+            EncodeTextureBand(loader, job.asset, job.index, lock);
+            break;
+        }
+    }
+}
+
+/// <summary>
+/// Starts the threads. The loader holds a mutex, so it is started where it lives instead of being returned.
+/// </summary>
+/// <param name="baked">Whether to map chains from the containers baked beside the files where there are any</param>
+/// <param name="cacheDirectory">Where encoded chains are cached, created if need be; empty for no cache</param>
+inline void StartTextureLoader(TextureLoader& loader, int threadCount, bool baked, const std::string& cacheDirectory)
+{
+    loader.stopping = false;
+    loader.baked = baked;
+    loader.cacheDirectory = cacheDirectory;
+    if (!cacheDirectory.empty())
+    {
+        MakeDirectory(cacheDirectory);
+    }
+    loader.takenCount = 0;
+    for (int i = 0; i < threadCount; i++)
+    {
+        loader.threads.emplace_back(RunTextureLoader, std::ref(loader));
+    }
+}
+
+/// <summary>
+/// Stops the threads once their current job is done, dropping the jobs not started yet and the
+/// chains not taken.
+/// </summary>
+inline void StopTextureLoader(TextureLoader& loader)
+{
+    {
+        std::lock_guard<std::mutex> lock(loader.mutex);
+        loader.stopping = true;
+        loader.jobs.clear();
+    }
+    loader.wake.notify_all();
+    for (std::thread& thread : loader.threads)
+    {
+        thread.join();
+    }
+    loader.threads.clear();
+    for (const std::unique_ptr<TextureAsset>& asset : loader.assets)
+    {
+        ReleaseTextureChain(asset->chain);
+    }
+    loader.finished.clear();
+}
+
+/// <summary>
+/// Binds a texture on unit 0 to upload into it, through the cache once rendering has started.
+/// </summary>
+inline void BindTextureForUpload(GLStateCache* cache, GLenum target, GLuint texture)
+{
+    if (cache != nullptr)
+    {
+        BindTexture(*cache, 0, target, texture);
+    }
+    else
+    {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(target, texture);
+    }
+}
+
+/// <summary>
+/// Creates the texture with a single grey texel per face, sets how it is sampled and queues it for
+/// loading: straight to decoding its files, unless a container or the cache may hold its chain.
+/// </summary>
+/// <param name="slot">Where the requester keeps the texture, returned in the asset</param>
+/// <param name="cache">State cache once rendering has started, nullptr during setup</param>
+/// <returns>Handle of the texture, usable right away</returns>
+inline GLuint RequestTexture(TextureLoader& loader, const TextureDesc& desc, uint32_t slot, GLStateCache* cache = nullptr)
+{
+    std::unique_ptr<TextureAsset> asset(new TextureAsset());
+    asset->desc = desc;
+    asset->slot = slot;
+    asset->faces.resize(desc.paths.size());
+    asset->opaque = true;
+    asset->imagesLeft = desc.paths.size();
+    asset->requested = std::chrono::steady_clock::now();
+    if (loader.assets.empty())
+    {
+        loader.firstRequest = asset->requested;
+    }
+
+    glGenTextures(1, &asset->texture);
+    BindTextureForUpload(cache, desc.target, asset->texture);
+    const unsigned char placeholder[4] = { 128, 128, 128, 255 };
+    for (size_t i = 0; i < desc.paths.size(); i++)
+    {
+        GLenum imageTarget = desc.target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + static_cast<GLenum>(i) : desc.target;
+        glTexImage2D(imageTarget, 0, GL_RGB8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+    }
+    glTexParameteri(desc.target, GL_TEXTURE_MAG_FILTER, desc.magFilter);
+    glTexParameteri(desc.target, GL_TEXTURE_MIN_FILTER, desc.minFilter);
+    glTexParameteri(desc.target, GL_TEXTURE_WRAP_S, desc.wrap);
+    glTexParameteri(desc.target, GL_TEXTURE_WRAP_T, desc.wrap);
+    if (desc.target == GL_TEXTURE_CUBE_MAP)
+    {
+        glTexParameteri(desc.target, GL_TEXTURE_WRAP_R, desc.wrap);
+    }
+    glTexParameteri(desc.target, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(desc.target, GL_TEXTURE_MAX_LEVEL, 0);
+    if (desc.anisotropy > 1.0f)
+    {
+        glTexParameterf(desc.target, GL_TEXTURE_MAX_ANISOTROPY, desc.anisotropy);
+    }
+
+    GLuint texture = asset->texture;
+    {
+        std::lock_guard<std::mutex> lock(loader.mutex);
+        if (loader.baked || (desc.compression != TextureCompression::None && !loader.cacheDirectory.empty()))
+        {
+            loader.jobs.push_back({ asset.get(), TextureJobKind::Open, 0 });
+            loader.wake.notify_all();
+        }
+        else
+        {
+            QueueTextureFiles(loader, asset.get());
+        }
+        loader.assets.push_back(std::move(asset));
+    }
+    return texture;
+}
+
+inline bool TexturesPending(const TextureLoader& loader)
+{
+    return loader.takenCount < loader.assets.size();
+}
+
+/// <summary>
+/// Hands over the next texture whose chain is loaded, for its images to be uploaded on the thread
+/// owning the GL context.
+/// </summary>
+/// <param name="wait">Wait for one if none is decoded yet and some are still pending</param>
+/// <returns>The texture, or nullptr if none is ready</returns>
+inline TextureAsset* TakeDecodedTexture(TextureLoader& loader, bool wait)
+{
+    std::unique_lock<std::mutex> lock(loader.mutex);
+    if (wait && TexturesPending(loader))
+    {
+        loader.decoded.wait(lock, [&loader] { return !loader.finished.empty(); });
+    }
+    if (loader.finished.empty())
+    {
+        return nullptr;
+    }
+    TextureAsset* asset = loader.finished.front();
+    loader.finished.pop_front();
+    loader.takenCount++;
+    return asset;
+}
@@ -0,0 +1,782 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "BakedTexture.h"
+#include "BlockCompression.h"
+#include "CpuProfiler.h"
+#include "GLStateCache.h"
+#include "MipChain.h"
+#include "TextureChain.h"
+#include "TextureLoader.h"
+
+/// <summary>
+/// Most bytes uploaded per frame once rendering has started, for textures arriving from the loader
+/// and levels streaming back alike, so a burst of them is spread over a few frames. At least one
+/// texture is always uploaded.
+/// </summary>
+const size_t kTextureUploadBytesPerFrame = 8 << 20;
+
+/// <summary>
+/// Size along the longer side below which a texture keeps its levels, however tight the budget.
+/// </summary>
+const int kMinResidentTextureSize = 32;
+
+/// <summary>
+/// Bytes a texel of an RGB8 texture takes on the GPU: drivers pad it to four. Block-compressed
+/// chains take the bytes of their data.
+/// </summary>
+const size_t kResidentBytesPerTexel = 4;
+
+/// <summary>
+/// How the textures are loaded, kept and sampled.
+/// </summary>
+struct TextureSettings
+{
+    // Most GPU bytes the textures may take, 0 for no limit
+    size_t budgetBytes;
+
+    // False to sample the top level only, with neither mipmaps nor anisotropy, to compare against
+    bool mipmaps;
+
+    // Whether chains are mapped from the containers baked beside the files where there are any
+    bool baked;
+
+    // Whether textures are block-compressed where the context samples the formats, and where the
+    // encoded chains are cached, empty to encode them on every run
+    bool compression;
+    std::string cacheDirectory;
+};
+
+inline TextureSettings DefaultTextureSettings()
+{
+    return { 0, true, true, true, kDefaultTextureCacheDirectory };
+}
+
+/// <summary>
+/// Refers to a texture of the residency manager. Its GL name is looked up every frame instead of
+/// being kept, as the manager may replace what is behind it.
+/// </summary>
+struct TextureHandle
+{
+    uint32_t index;
+};
+
+struct ManagedTexture
+{
+    TextureDesc desc;
+    GLuint texture;
+    int references;
+
+    // Whether the chain is still loading, and then every level of each face from full size down
+    // to 1x1, the copy dropped levels stream back from: built as the files were decoded, or mapped
+    // from a baked container. No levels if a file failed to decode.
+    bool pending;
+    TextureChain chain;
+    TextureSource source;
+
+    // First level of the chain the GPU holds, the coarsest one it may drop to, and the bytes it takes from there
+    int residentLevel;
+    int lowestLevel;
+    size_t residentBytes;
+
+    // Last rendered frame the texture was in view
+    uint64_t lastVisibleFrame;
+};
+
+/// <summary>
+/// Owns every texture of the scene behind handles, with reference counts and the GPU bytes of each.
+/// With a budget it keeps the total under it by dropping the top levels of the textures seen least
+/// recently, and streams them back once the textures are in view again and there is room.
+/// </summary>
+struct TextureResidency
+{
+    TextureLoader loader;
+    std::vector<ManagedTexture> textures;
+    std::vector<uint32_t> freeSlots;
+
+    // False to sample the top level of every texture only, without anisotropy, to compare against
+    bool mipmaps;
+    float maxAnisotropy;
+
+    // Whether to compress textures, whether the context samples BC1 and BC3, and BC4 and BC5
+    bool compression;
+    bool s3tc;
+    bool rgtc;
+
+    // 0 for no budget
+    size_t budgetBytes;
+    size_t residentBytes;
+    size_t peakBytes;
+    uint64_t frame;
+
+    // Levels dropped to stay in the budget, and levels and bytes streamed back
+    int droppedLevels;
+    int restoredLevels;
+    size_t streamedBytes;
+
+    // Textures whose chain was mapped from a baked container or from the cache, and the time from
+    // the first request until every texture was ready
+    int bakedTextures;
+    int cachedTextures;
+    double loadMilliseconds;
+
+    // Texels encoded into blocks, the thread time it took, and the lowest PSNR of any compressed texture
+    uint64_t encodedTexels;
+    double encodeMilliseconds;
+    float lowestPsnr;
+};
+
+/// <summary>
+/// Starts the loader's threads. The residency holds the loader's mutex, so it is started where it lives.
+/// </summary>
+inline void StartTextureResidency(TextureResidency& residency, const TextureSettings& settings, int threadCount)
+{
+    StartTextureLoader(residency.loader, threadCount, settings.baked, settings.compression ? settings.cacheDirectory : std::string());
+    residency.mipmaps = settings.mipmaps;
+    residency.maxAnisotropy = MaxTextureAnisotropy();
+    residency.compression = settings.compression;
+    residency.s3tc = BlockCompressionSupported(TextureCompression::Color);
+    residency.rgtc = BlockCompressionSupported(TextureCompression::Red);
+    residency.budgetBytes = settings.budgetBytes;
+    residency.residentBytes = 0;
+    residency.peakBytes = 0;
+    residency.frame = 0;
+    residency.droppedLevels = 0;
+    residency.restoredLevels = 0;
+    residency.streamedBytes = 0;
+    residency.bakedTextures = 0;
+    residency.cachedTextures = 0;
+    residency.loadMilliseconds = 0.0;
+    residency.encodedTexels = 0;
+    residency.encodeMilliseconds = 0.0;
+    residency.lowestPsnr = 0.0f;
+}
+
+inline bool SameTextureDesc(const TextureDesc& a, const TextureDesc& b)
+{
+    return a.target == b.target && a.paths == b.paths && a.flip == b.flip && a.magFilter == b.magFilter
+        && a.minFilter == b.minFilter && a.wrap == b.wrap && a.anisotropy == b.anisotropy && a.mipFilter == b.mipFilter
+        && a.compression == b.compression;
+}
+
+/// <summary>
+/// Number of levels the GPU holds when the texture's chain starts at the provided level: the rest
+/// of the chain if it is sampled with mipmaps, else that level alone.
+/// </summary>
+inline int ResidentLevelCount(const ManagedTexture& texture, int level)
+{
+    return MinFilterUsesMipmaps(texture.desc.minFilter) ? texture.chain.levelCount - level : 1;
+}
+
+/// <summary>
+/// GPU bytes of a texture when its chain starts at the provided level.
+/// </summary>
+/// <param name="uncompressed">Count the bytes it would take without block compression instead</param>
+inline size_t TextureLevelBytes(const ManagedTexture& texture, int level, bool uncompressed = false)
+{
+    size_t bytes = 0;
+    for (int face = 0; face < texture.chain.faceCount; face++)
+    {
+        for (int i = level; i < level + ResidentLevelCount(texture, level); i++)
+        {
+            const TextureImage& image = ChainImage(texture.chain, i, face);
+            bytes += ChainCompressed(texture.chain) && !uncompressed ? image.size
+                : static_cast<size_t>(image.width) * image.height * kResidentBytesPerTexel;
+        }
+    }
+    return bytes;
+}
+
+inline bool TextureVisible(const TextureResidency& residency, const ManagedTexture& texture)
+{
+    return texture.lastVisibleFrame >= residency.frame;
+}
+
+/// <summary>
+/// Replaces the texture's storage with its chain from the provided level on, that level becoming
+/// level 0, and updates the byte counts. Texture coordinates are normalized, so a chain without its
+/// top levels samples the same image, only coarser.
+/// </summary>
+/// <returns>Bytes uploaded</returns>
+inline size_t UploadTextureLevel(TextureResidency& residency, ManagedTexture& texture, int level, GLStateCache* cache)
+{
+    CPU_ZONE("Texture upload");
+    BindTextureForUpload(cache, texture.desc.target, texture.texture);
+    int levelCount = ResidentLevelCount(texture, level);
+    size_t bytes = 0;
+    const TextureChain& chain = texture.chain;
+    for (int i = 0; i < chain.faceCount; i++)
+    {
+        GLenum imageTarget = texture.desc.target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + static_cast<GLenum>(i) : texture.desc.target;
+        for (int j = 0; j < levelCount; j++)
+        {
+            // Straight from the chain's bytes, a baked container's mapping included
+            const TextureImage& image = ChainImage(chain, level + j, i);
+            if (ChainCompressed(chain))
+            {
+                glCompressedTexImage2D(imageTarget, j, chain.internalFormat, image.width, image.height, 0,
+                    static_cast<GLsizei>(image.size), image.data);
+            }
+            else
+            {
+                glTexImage2D(imageTarget, j, chain.internalFormat, image.width, image.height, 0, chain.format, chain.type, image.data);
+            }
+            bytes += image.size;
+        }
+    }
+    glTexParameteri(texture.desc.target, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+
+    residency.residentBytes -= texture.residentBytes;
+    texture.residentLevel = level;
+    texture.residentBytes = TextureLevelBytes(texture, level);
+    residency.residentBytes += texture.residentBytes;
+    residency.peakBytes = std::max(residency.peakBytes, residency.residentBytes);
+    return bytes;
+}
+
+/// <summary>
+/// Whether a texture may lose levels to make room for another.
+/// </summary>
+inline bool TextureDroppable(const TextureResidency& residency, const ManagedTexture& texture, bool dropVisible)
+{
+    return texture.chain.levelCount != 0 && texture.residentLevel < texture.lowestLevel
+        && (dropVisible || !TextureVisible(residency, texture));
+}
+
+/// <summary>
+/// Drops the top level of the texture seen least recently, the largest one among those seen as recently.
+/// </summary>
+/// <param name="dropVisible">Whether textures in view may lose levels too</param>
+/// <param name="keep">Index of a texture to leave alone</param>
+/// <returns>False if no texture has a level left to drop</returns>
+inline bool DropTextureLevel(TextureResidency& residency, GLStateCache* cache, bool dropVisible, size_t keep)
+{
+    ManagedTexture* victim = nullptr;
+    for (size_t i = 0; i < residency.textures.size(); i++)
+    {
+        ManagedTexture& texture = residency.textures[i];
+        if (i == keep || !TextureDroppable(residency, texture, dropVisible))
+        {
+            continue;
+        }
+        if (victim == nullptr || texture.lastVisibleFrame < victim->lastVisibleFrame
+            || (texture.lastVisibleFrame == victim->lastVisibleFrame && texture.residentBytes > victim->residentBytes))
+        {
+            victim = &texture;
+        }
+    }
+    if (victim == nullptr)
+    {
+        return false;
+    }
+    UploadTextureLevel(residency, *victim, victim->residentLevel + 1, cache);
+    residency.droppedLevels++;
+    return true;
+}
+
+/// <summary>
+/// Drops levels until the provided number of bytes fits in the budget on top of what is resident.
+/// Levels of textures out of view are only dropped if that makes enough room, so a texture that
+/// cannot grow does not cost the others theirs. Textures in view give up what they can regardless.
+/// </summary>
+/// <param name="dropVisible">Whether textures in view may lose levels too</param>
+/// <param name="keep">Index of the texture the room is for</param>
+/// <returns>False if the bytes do not fit</returns>
+inline bool MakeTextureRoom(TextureResidency& residency, size_t bytes, GLStateCache* cache, bool dropVisible, size_t keep)
+{
+    if (residency.budgetBytes == 0 || residency.residentBytes + bytes <= residency.budgetBytes)
+    {
+        return true;
+    }
+    if (!dropVisible)
+    {
+        size_t droppable = 0;
+        for (size_t i = 0; i < residency.textures.size(); i++)
+        {
+            const ManagedTexture& texture = residency.textures[i];
+            if (i != keep && TextureDroppable(residency, texture, false))
+            {
+                droppable += texture.residentBytes - TextureLevelBytes(texture, texture.lowestLevel);
+            }
+        }
+        if (residency.residentBytes - droppable + bytes > residency.budgetBytes)
+        {
+            return false;
+        }
+    }
+    while (residency.residentBytes + bytes > residency.budgetBytes)
+    {
+        if (!DropTextureLevel(residency, cache, dropVisible, keep))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// <summary>
+/// Gives a handle to the texture, loading it unless a texture with the same description is already
+/// held, in which case that one is shared and its reference count goes up.
+/// </summary>
+/// <param name="cache">State cache once rendering has started, nullptr during setup</param>
+inline TextureHandle AcquireTexture(TextureResidency& residency, TextureDesc desc, GLStateCache* cache = nullptr)
+{
+    desc.anisotropy = std::min(desc.anisotropy, residency.maxAnisotropy);
+    if (!residency.mipmaps)
+    {
+        desc.minFilter = desc.minFilter == GL_NEAREST_MIPMAP_NEAREST || desc.minFilter == GL_NEAREST_MIPMAP_LINEAR ? GL_NEAREST : GL_LINEAR;
+        desc.anisotropy = 1.0f;
+    }
+    if (!residency.compression || (desc.compression == TextureCompression::Color && !residency.s3tc)
+        || (desc.compression != TextureCompression::Color && !residency.rgtc))
+    {
+        desc.compression = TextureCompression::None;
+    }
+    for (size_t i = 0; i < residency.textures.size(); i++)
+    {
+        ManagedTexture& texture = residency.textures[i];
+        if (texture.references > 0 && SameTextureDesc(texture.desc, desc))
+        {
+            texture.references++;
+            return { static_cast<uint32_t>(i) };
+        }
+    }
+
+    TextureHandle handle;
+    if (!residency.freeSlots.empty())
+    {
+        handle.index = residency.freeSlots.back();
+        residency.freeSlots.pop_back();
+    }
+    else
+    {
+        handle.index = static_cast<uint32_t>(residency.textures.size());
+        residency.textures.emplace_back();
+    }
+
+    ManagedTexture texture = {};
+    texture.desc = desc;
+    texture.texture = RequestTexture(residency.loader, desc, handle.index, cache);
+    texture.references = 1;
+    texture.pending = true;
+    texture.residentLevel = 0;
+    texture.lowestLevel = 0;
+    texture.residentBytes = 0;
+
+    // A texture just asked for is about to be drawn
+    texture.lastVisibleFrame = residency.frame;
+    residency.textures[handle.index] = std::move(texture);
+    return handle;
+}
+
+/// <summary>
+/// Deletes the texture's storage and its chain, and frees its handle for another texture.
+/// </summary>
+inline void DeleteManagedTexture(TextureResidency& residency, uint32_t index)
+{
+    ManagedTexture& texture = residency.textures[index];
+    glDeleteTextures(1, &texture.texture);
+    residency.residentBytes -= texture.residentBytes;
+    ReleaseTextureChain(texture.chain);
+    texture = ManagedTexture();
+    residency.freeSlots.push_back(index);
+}
+
+/// <summary>
+/// Gives a handle up. The last one deletes the texture, or has it deleted once its chain is loaded
+/// if it is still loading.
+/// </summary>
+inline void ReleaseTexture(TextureResidency& residency, TextureHandle handle)
+{
+    ManagedTexture& texture = residency.textures[handle.index];
+    if (--texture.references == 0 && !texture.pending)
+    {
+        DeleteManagedTexture(residency, handle.index);
+    }
+}
+
+/// <summary>
+/// The texture's GL name, to bind it this frame.
+/// </summary>
+inline GLuint ResidentTexture(const TextureResidency& residency, TextureHandle handle)
+{
+    return residency.textures[handle.index].texture;
+}
+
+/// <summary>
+/// Starts a rendered frame. Textures are in view in it once MarkTextureVisible says so.
+/// </summary>
+inline void BeginTextureFrame(TextureResidency& residency)
+{
+    residency.frame++;
+}
+
+/// <summary>
+/// Records whether something drawn with the texture is in view this frame.
+/// </summary>
+inline void MarkTextureVisible(TextureResidency& residency, TextureHandle handle, bool visible)
+{
+    if (visible)
+    {
+        residency.textures[handle.index].lastVisibleFrame = residency.frame;
+    }
+}
+
+/// <summary>
+/// Takes the chain of a texture once it is loaded and uploads it from the finest level that fits in the
+/// budget, and reports how long each step took. A file that failed to decode leaves the placeholder in place.
+/// </summary>
+/// <returns>Bytes uploaded</returns>
+inline size_t ArriveTexture(TextureResidency& residency, TextureAsset& asset, GLStateCache* cache, std::ostream& report)
+{
+    // The slot stays taken while its texture loads, even once every handle to it is released
+    uint32_t index = asset.slot;
+    ManagedTexture& texture = residency.textures[index];
+    texture.pending = false;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (!asset.staleBakedPath.empty())
+    {
+        report << "Baked texture " << asset.staleBakedPath << " does not match " << asset.desc.paths.front()
+            << ", decoding the files instead" << std::endl;
+    }
+    for (size_t i = 0; i < asset.faces.size(); i++)
+    {
+        if (asset.faces[i].empty())
+        {
+            report << "Failed to load image " << asset.desc.paths[i] << std::endl;
+        }
+    }
+    if (asset.cacheWriteFailed)
+    {
+        report << "Failed to write " << asset.desc.paths.front() << " to the texture cache as " << asset.cachePath << std::endl;
+    }
+    asset.faces.clear();
+    texture.chain = std::move(asset.chain);
+    texture.source = asset.source;
+    asset.chain = TextureChain();
+    if (texture.references == 0)
+    {
+        // Released while it was loading
+        DeleteManagedTexture(residency, static_cast<uint32_t>(index));
+        return 0;
+    }
+    if (texture.chain.levelCount == 0)
+    {
+        return 0;
+    }
+    const TextureChain& chain = texture.chain;
+    while (texture.lowestLevel + 1 < chain.levelCount
+        && std::max(ChainImage(chain, texture.lowestLevel + 1, 0).width, ChainImage(chain, texture.lowestLevel + 1, 0).height) >= kMinResidentTextureSize)
+    {
+        texture.lowestLevel++;
+    }
+
+    // The finest level that fits beside what is resident; if none does, the coarsest takes room from the others
+    int level = 0;
+    while (level < texture.lowestLevel && residency.budgetBytes != 0
+        && residency.residentBytes + TextureLevelBytes(texture, level) > residency.budgetBytes)
+    {
+        level++;
+    }
+    MakeTextureRoom(residency, TextureLevelBytes(texture, level), cache, true, index);
+    size_t bytes = UploadTextureLevel(residency, texture, level, cache);
+    residency.bakedTextures += asset.source == TextureSource::Baked ? 1 : 0;
+    residency.cachedTextures += asset.source == TextureSource::Cached ? 1 : 0;
+    uint64_t texels = 0;
+    for (const TextureImage& image : chain.images)
+    {
+        texels += static_cast<uint64_t>(image.width) * image.height;
+    }
+    if (ChainCompressed(chain))
+    {
+        residency.lowestPsnr = residency.lowestPsnr == 0.0f ? chain.psnr : std::min(residency.lowestPsnr, chain.psnr);
+        if (asset.source == TextureSource::Decoded)
+        {
+            residency.encodedTexels += texels;
+            residency.encodeMilliseconds += asset.encodeMilliseconds;
+        }
+    }
+
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    const TextureImage& full = ChainImage(chain, 0, 0);
+    report << std::fixed << std::setprecision(2) << "Texture " << asset.desc.paths.front();
+    if (asset.desc.paths.size() > 1)
+    {
+        report << " (+" << asset.desc.paths.size() - 1 << " faces)";
+    }
+    report << ": " << full.width << "x" << full.height << ", ";
+    std::string formatName = ChainCompressed(chain) ? BlockFormatName(chain.internalFormat) : "RGB8";
+    if (asset.source == TextureSource::Decoded)
+    {
+        report << "decoded in " << asset.decodeMilliseconds << " ms, " << chain.levelCount << " levels built in "
+            << asset.mipMilliseconds << " ms";
+        if (ChainCompressed(chain))
+        {
+            report << ", encoded to " << formatName << " in " << asset.encodeMilliseconds << " ms of thread time ("
+                << texels / std::max(asset.encodeMilliseconds, 1.0e-6) / 1000.0 << " Mtexel/s)";
+        }
+    }
+    else
+    {
+        report << chain.levelCount << " levels of " << formatName << " mapped from "
+            << (asset.source == TextureSource::Baked ? BakedTexturePath(asset.desc.paths.front()) : "the cache") << " in "
+            << asset.mapMilliseconds << " ms";
+    }
+    if (ChainCompressed(chain))
+    {
+        report << ", PSNR " << chain.psnr << " dB";
+    }
+    report << ", uploaded in " << std::chrono::duration<double, std::milli>(end - start).count() << " ms, ready "
+        << std::chrono::duration<double, std::milli>(end - asset.requested).count() << " ms after the request";
+    if (level != 0)
+    {
+        report << ", resident at " << ChainImage(chain, level, 0).width << "x" << ChainImage(chain, level, 0).height
+            << " to fit the budget";
+    }
+    report << std::endl;
+    if (!TexturesPending(residency.loader))
+    {
+        residency.loadMilliseconds = std::chrono::duration<double, std::milli>(end - residency.loader.firstRequest).count();
+        report << "Textures: " << residency.loader.assets.size() << " ready " << residency.loadMilliseconds
+            << " ms after the first request, " << residency.bakedTextures << " mapped from baked containers and "
+            << residency.cachedTextures << " from the cache, loaded by " << residency.loader.threads.size() << " threads" << std::endl;
+    }
+    report << std::defaultfloat;
+    return bytes;
+}
+
+/// <summary>
+/// Uploads the textures decoded since the last call, then streams levels back into textures in view
+/// for as long as they fit in the budget, taking room from textures out of view.
+/// Runs on the thread owning the GL context, once per loop iteration.
+/// </summary>
+/// <param name="cache">State cache once rendering has started, nullptr during setup</param>
+/// <param name="wait">Wait for and upload every texture requested, e.g. before a run that has to show them all</param>
+/// <returns>Number of textures whose images changed</returns>
+inline int UpdateTextureResidency(TextureResidency& residency, GLStateCache* cache, bool wait, std::ostream& report)
+{
+    int changed = 0;
+    size_t uploaded = 0;
+    while (TexturesPending(residency.loader) && (wait || uploaded < kTextureUploadBytesPerFrame))
+    {
+        TextureAsset* asset = TakeDecodedTexture(residency.loader, wait);
+        if (asset == nullptr)
+        {
+            break;
+        }
+        uploaded += ArriveTexture(residency, *asset, cache, report);
+        changed++;
+    }
+
+    for (size_t i = 0; i < residency.textures.size() && (wait || uploaded < kTextureUploadBytesPerFrame); i++)
+    {
+        ManagedTexture& texture = residency.textures[i];
+        if (texture.chain.levelCount == 0 || texture.residentLevel == 0 || !TextureVisible(residency, texture))
+        {
+            continue;
+        }
+        size_t growth = TextureLevelBytes(texture, texture.residentLevel - 1) - texture.residentBytes;
+        if (!MakeTextureRoom(residency, growth, cache, false, i))
+        {
+            continue;
+        }
+        size_t bytes = UploadTextureLevel(residency, texture, texture.residentLevel - 1, cache);
+        uploaded += bytes;
+        residency.streamedBytes += bytes;
+        residency.restoredLevels++;
+        changed++;
+    }
+    return changed;
+}
+
+/// <summary>
+/// How the textures are sampled, for reports comparing runs.
+/// </summary>
+inline std::string DescribeTextureSampling(const TextureResidency& residency)
+{
+    if (!residency.mipmaps)
+    {
+        return "top level only";
+    }
+    float anisotropy = 1.0f;
+    for (const ManagedTexture& texture : residency.textures)
+    {
+        anisotropy = std::max(anisotropy, texture.desc.anisotropy);
+    }
+    return "mipmapped, up to " + std::to_string(static_cast<int>(anisotropy)) + "x anisotropic";
+}
+
+/// <summary>
+/// Where the chains came from, for reports comparing startup with and without baked containers.
+/// </summary>
+inline std::string DescribeTextureSource(const TextureResidency& residency)
+{
+    int total = static_cast<int>(residency.loader.assets.size());
+    if (residency.bakedTextures == total)
+    {
+        return "baked";
+    }
+    if (residency.cachedTextures == total)
+    {
+        return "cached";
+    }
+    if (residency.bakedTextures == 0 && residency.cachedTextures == 0)
+    {
+        return "decoded";
+    }
+    return std::to_string(residency.bakedTextures) + " baked, " + std::to_string(residency.cachedTextures) + " cached, "
+        + std::to_string(total - residency.bakedTextures - residency.cachedTextures) + " decoded";
+}
+
+/// <summary>
+/// The block formats the textures are stored in, for reports comparing runs with and without compression.
+/// </summary>
+inline std::string DescribeTextureCompression(const TextureResidency& residency)
+{
+    std::string formats;
+    for (const char* name : { "BC1", "BC3", "BC4", "BC5" })
+    {
+        for (const ManagedTexture& texture : residency.textures)
+        {
+            if (texture.chain.levelCount != 0 && BlockFormatName(texture.chain.internalFormat) == name)
+            {
+                formats += (formats.empty() ? "" : ", ") + std::string(name);
+                break;
+            }
+        }
+    }
+    return formats.empty() ? "none" : formats;
+}
+
+/// <summary>
+/// GPU bytes the resident textures would take without block compression.
+/// </summary>
+inline size_t UncompressedTextureBytes(const TextureResidency& residency)
+{
+    size_t bytes = 0;
+    for (const ManagedTexture& texture : residency.textures)
+    {
+        if (texture.chain.levelCount != 0)
+        {
+            bytes += TextureLevelBytes(texture, texture.residentLevel, true);
+        }
+    }
+    return bytes;
+}
+
+/// <summary>
+/// Writes the chain of every texture into a container beside its files, for later runs to map
+/// instead of decoding. The chains are baked as the loader built them, block-compressed if they
+/// are, whatever the sampling of this run, so a run with --mipmaps off bakes the same files.
+/// </summary>
+/// <returns>Number of containers that could not be written</returns>
+inline int BakeTextures(const TextureResidency& residency, std::ostream& report)
+{
+    const double mebibyte = 1024.0 * 1024.0;
+    int failed = 0;
+    for (const ManagedTexture& texture : residency.textures)
+    {
+        // A chain mapped from its container would be written over itself
+        if (texture.chain.levelCount == 0 || texture.source == TextureSource::Baked)
+        {
+            continue;
+        }
+        std::string path = BakedTexturePath(texture.desc.paths.front());
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        uint32_t flags = BakedTextureFlags(texture.desc.flip, texture.desc.mipFilter, texture.desc.compression);
+        if (!WriteBakedTexture(path, texture.chain, flags, SourceFilesStamp(texture.desc.paths)))
+        {
+            report << "Failed to write the baked texture " << path << std::endl;
+            failed++;
+            continue;
+        }
+        size_t bytes = 0;
+        for (const TextureImage& image : texture.chain.images)
+        {
+            bytes += image.size;
+        }
+        report << std::fixed << std::setprecision(2) << "Baked " << path << ": " << texture.chain.faceCount << " faces of "
+            << texture.chain.levelCount << " levels of " << (ChainCompressed(texture.chain) ? BlockFormatName(texture.chain.internalFormat) : "RGB8") << ", " << bytes / mebibyte << " MiB in "
+            << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms"
+            << std::defaultfloat << std::endl;
+    }
+    return failed;
+}
+
+/// <summary>
+/// Writes the GPU bytes of every texture and what the budget cost.
+/// </summary>
+inline void ReportTextureResidency(const TextureResidency& residency, std::ostream& report)
+{
+    const double mebibyte = 1024.0 * 1024.0;
+    report << std::fixed << std::setprecision(2) << "Texture residency: " << residency.residentBytes / mebibyte << " MiB resident";
+    if (residency.budgetBytes != 0)
+    {
+        report << " of a " << residency.budgetBytes / mebibyte << " MiB budget";
+    }
+    report << ", peak " << residency.peakBytes / mebibyte << " MiB; " << residency.droppedLevels << " levels dropped, "
+        << residency.restoredLevels << " streamed back (" << residency.streamedBytes / mebibyte << " MiB)" << std::endl;
+    size_t uncompressedBytes = UncompressedTextureBytes(residency);
+    if (uncompressedBytes != residency.residentBytes)
+    {
+        report << "Block compression: " << DescribeTextureCompression(residency) << ", "
+            << (uncompressedBytes - residency.residentBytes) / mebibyte << " MiB saved of " << uncompressedBytes / mebibyte
+            << " MiB uncompressed, lowest PSNR " << residency.lowestPsnr << " dB";
+        if (residency.encodedTexels != 0)
+        {
+            report << "; " << residency.encodedTexels / 1.0e6 << " Mtexels encoded in " << residency.encodeMilliseconds
+                << " ms of thread time, " << residency.encodedTexels / residency.encodeMilliseconds / 1000.0 << " Mtexel/s per thread";
+        }
+        report << std::endl;
+    }
+    for (const ManagedTexture& texture : residency.textures)
+    {
+        if (texture.chain.levelCount == 0)
+        {
+            continue;
+        }
+        const TextureImage& full = ChainImage(texture.chain, 0, 0);
+        const TextureImage& resident = ChainImage(texture.chain, texture.residentLevel, 0);
+        report << "  " << texture.desc.paths.front() << ": " << resident.width << "x" << resident.height << " of "
+            << full.width << "x" << full.height << " " << (ChainCompressed(texture.chain) ? BlockFormatName(texture.chain.internalFormat) : "RGB8") << ", " << texture.residentBytes / mebibyte << " of "
+            << TextureLevelBytes(texture, 0) / mebibyte << " MiB, " << texture.references << " references" << std::endl;
+    }
+    report << std::defaultfloat;
+}
+
+/// <summary>
+/// Stops the loader and deletes every texture left, complaining about any still referenced.
+/// </summary>
+inline void StopTextureResidency(TextureResidency& residency)
+{
+    StopTextureLoader(residency.loader);
+    int leaked = 0;
+    for (size_t i = 0; i < residency.textures.size(); i++)
+    {
+        // Released while still loading, the texture is only deleted here
+        if (residency.textures[i].texture == 0)
+        {
+            continue;
+        }
+        if (residency.textures[i].references > 0)
+        {
+            leaked++;
+        }
+        DeleteManagedTexture(residency, static_cast<uint32_t>(i));
+    }
+    if (leaked != 0)
+    {
+        std::cerr << leaked << " textures were still referenced at shutdown" << std::endl;
+    }
+}
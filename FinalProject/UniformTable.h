@@ -0,0 +1,162 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "RenderStats.h"
+
+/// <summary>
+/// Every uniform the render loop writes, across all of the shader programs.
+/// A program that does not declare one of these simply gets a location of -1,
+/// which glUniform* silently ignores.
+/// </summary>
+enum class Uniform
+{
+    Tex,
+    Bump,
+    ShadowMap,
+    Skybox,
+    TransformationMatrix,
+    Model,
+    LightColor,
+    LightDirection,
+    LightAmbient,
+    LightDiffuse,
+    LightSpecular,
+    PointLights,
+    LightIndices,
+    MaterialAmbient,
+    MaterialDiffuse,
+    MaterialSpecular,
+    MaterialShininess,
+    CascadeRange,
+    CacheLightSpace,
+    StaticDepth,
+    CascadeToStatic,
+    StaticToCascade,
+    Count
+};
+
+/// <summary>
+/// GLSL names of the uniforms, in the same order as the Uniform enum.
+/// </summary>
+static const char* const kUniformNames[] =
+{
+    "tex",
+    "bump",
+    "shadowMap",
+    "skybox",
+    "transformationMatrix",
+    "model",
+    "lightColor",
+    "light.direction",
+    "light.ambient",
+    "light.diffuse",
+    "light.specular",
+    "pointLights",
+    "lightIndices",
+    "material.ambient",
+    "material.diffuse",
+    "material.specular",
+    "material.shininess",
+    "cascadeRange",
+    "cacheLightSpace",
+    "staticDepth",
+    "cascadeToStatic",
+    "staticToCascade",
+};
+
+static_assert(sizeof(kUniformNames) / sizeof(kUniformNames[0]) == static_cast<size_t>(Uniform::Count),
+    "kUniformNames must have one entry per Uniform");
+
+/// <summary>
+/// Uniform locations of one shader program, resolved once right after it is linked.
+/// </summary>
+struct UniformTable
+{
+    GLuint program;
+    GLint locations[static_cast<int>(Uniform::Count)];
+};
+
+/// <summary>
+/// Number of glGetUniformLocation calls made since the counter was last reset.
+/// The render loop resets it at the start of every frame, so any non-zero value
+/// at the end of a frame means a lookup crept back into the hot path.
+/// </summary>
+/// <returns>Reference to the counter</returns>
+inline int& UniformLookupCounter()
+{
+    static int lookups = 0;
+    return lookups;
+}
+
+/// <summary>
+/// Wrapper around glGetUniformLocation that bumps the lookup counter.
+/// </summary>
+/// <param name="program">Shader program handle</param>
+/// <param name="name">GLSL name of the uniform</param>
+/// <returns>Location of the uniform, or -1 if the program does not use it</returns>
+inline GLint GetUniformLocation(GLuint program, const char* name)
+{
+    ++UniformLookupCounter();
+    return glGetUniformLocation(program, name);
+}
+
+/// <summary>
+/// Looks up the location of every known uniform in the provided program.
+/// </summary>
+/// <param name="program">Linked shader program handle</param>
+/// <returns>Table of uniform locations for the program</returns>
+inline UniformTable ResolveUniforms(GLuint program)
+{
+    UniformTable table;
+    table.program = program;
+    for (int i = 0; i < static_cast<int>(Uniform::Count); i++)
+    {
+        table.locations[i] = GetUniformLocation(program, kUniformNames[i]);
+    }
+    return table;
+}
+
+/// <summary>
+/// Returns the cached location of a uniform.
+/// </summary>
+inline GLint Location(const UniformTable& table, Uniform uniform)
+{
+    return table.locations[static_cast<int>(uniform)];
+}
+
+// Typed setters. These write to whichever program is currently in use,
+// exactly like the glUniform* calls they wrap, and count as one upload each.
+
+inline void SetUniform(const UniformTable& table, Uniform uniform, GLint value)
+{
+    CountUniformUpload();
+    glUniform1i(Location(table, uniform), value);
+}
+
+inline void SetUniform(const UniformTable& table, Uniform uniform, GLfloat value)
+{
+    CountUniformUpload();
+    glUniform1f(Location(table, uniform), value);
+}
+
+inline void SetUniform(const UniformTable& table, Uniform uniform, const glm::ivec2& value)
+{
+    CountUniformUpload();
+    glUniform2iv(Location(table, uniform), 1, glm::value_ptr(value));
+}
+
+inline void SetUniform(const UniformTable& table, Uniform uniform, const glm::vec3& value)
+{
+    CountUniformUpload();
+    glUniform3fv(Location(table, uniform), 1, glm::value_ptr(value));
+}
+
+inline void SetUniform(const UniformTable& table, Uniform uniform, const glm::mat4& value)
+{
+    CountUniformUpload();
+    glUniformMatrix4fv(Location(table, uniform), 1, GL_FALSE, glm::value_ptr(value));
+}
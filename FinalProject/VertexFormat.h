@@ -0,0 +1,157 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cmath>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+/// <summary>
+/// Positions are stored as normalized 16-bit integers of position / kPositionRange.
+/// Must match kPositionRange in vertexformat.glsl; every mesh has to fit inside [-kPositionRange, kPositionRange].
+/// A power of two, so the scale itself adds no rounding.
+/// </summary>
+const float kPositionRange = 2.0f;
+
+/// <summary>
+/// Position stream, read by every pass. Depth-only passes and the skybox read nothing else.
+/// The fourth component only pads the stride to 8 bytes.
+/// </summary>
+struct PackedPosition
+{
+    GLshort x, y, z, w;
+};
+
+/// <summary>
+/// Everything else, in a second stream only the shaded passes read:
+/// RGB8 color, half-float UV and an octahedral-encoded normal in two normalized 16-bit integers.
+/// </summary>
+struct PackedAttributes
+{
+    GLubyte r, g, b, a;
+    GLushort u, v;
+    GLshort nx, ny;
+};
+
+static_assert(sizeof(PackedPosition) == 8, "PackedPosition must stay 8 bytes");
+static_assert(sizeof(PackedAttributes) == 12, "PackedAttributes must stay 12 bytes");
+
+/// <summary>
+/// Quantizes a float in [-1, 1] to a normalized 16-bit integer.
+/// </summary>
+inline GLshort PackSnorm16(float value)
+{
+    return static_cast<GLshort>(std::lround(glm::clamp(value, -1.0f, 1.0f) * 32767.0f));
+}
+
+/// <summary>
+/// Maps a direction onto the octahedron |x| + |y| + |z| = 1 and unfolds it into the [-1, 1] square.
+/// DecodeOctahedral in vertexformat.glsl undoes it.
+/// </summary>
+inline glm::vec2 EncodeOctahedral(const glm::vec3& normal)
+{
+    glm::vec3 n = normal / (std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z));
+    glm::vec2 encoded(n.x, n.y);
+    if (n.z < 0.0f)
+    {
+        // Fold the lower half over the diagonals
+        glm::vec2 signs(encoded.x >= 0.0f ? 1.0f : -1.0f, encoded.y >= 0.0f ? 1.0f : -1.0f);
+        encoded = (glm::vec2(1.0f) - glm::abs(glm::vec2(encoded.y, encoded.x))) * signs;
+    }
+    return encoded;
+}
+
+/// <summary>
+/// Splits full-precision vertices into the two packed streams.
+/// V needs x, y, z, r, g, b, u, v, nx, ny and nz members.
+/// </summary>
+template <typename V>
+void PackVertices(const std::vector<V>& vertices, std::vector<PackedPosition>& positions, std::vector<PackedAttributes>& attributes)
+{
+    positions.resize(vertices.size());
+    attributes.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        const V& vertex = vertices[i];
+        positions[i].x = PackSnorm16(vertex.x / kPositionRange);
+        positions[i].y = PackSnorm16(vertex.y / kPositionRange);
+        positions[i].z = PackSnorm16(vertex.z / kPositionRange);
+        positions[i].w = 0;
+
+        glm::vec2 normal = EncodeOctahedral(glm::vec3(vertex.nx, vertex.ny, vertex.nz));
+        attributes[i].r = vertex.r;
+        attributes[i].g = vertex.g;
+        attributes[i].b = vertex.b;
+        attributes[i].a = 255;
+        attributes[i].u = glm::packHalf1x16(vertex.u);
+        attributes[i].v = glm::packHalf1x16(vertex.v);
+        attributes[i].nx = PackSnorm16(normal.x);
+        attributes[i].ny = PackSnorm16(normal.y);
+    }
+}
+
+/// <summary>
+/// Points attribute 0 of the bound vertex array object at the position stream.
+/// </summary>
+inline void SetPositionStream(GLuint buffer)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, sizeof(PackedPosition), (void*)offsetof(PackedPosition, x));
+}
+
+/// <summary>
+/// Points attributes 1 (color), 2 (UV) and 3 (normal) of the bound vertex array object at the attribute stream.
+/// Passes that only need the normal leave color and UV off, so they are never fetched.
+/// </summary>
+inline void SetAttributeStream(GLuint buffer, bool colorAndUV)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    if (colorAndUV)
+    {
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PackedAttributes), (void*)offsetof(PackedAttributes, r));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedAttributes), (void*)offsetof(PackedAttributes, u));
+    }
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, sizeof(PackedAttributes), (void*)offsetof(PackedAttributes, nx));
+}
+
+/// <summary>
+/// Bytes of vertex data one vertex costs a pass, before (one interleaved stride) and after packing.
+/// </summary>
+struct VertexFetchCost
+{
+    size_t interleavedBytes;
+    size_t packedBytes;
+};
+
+/// <summary>
+/// Prints vertex memory and this frame's vertex fetch before and after packing.
+/// Fetch counts every drawn index, ignoring the post-transform cache, so it is an upper bound for both.
+/// </summary>
+/// <param name="report">Stream to print to</param>
+/// <param name="vertexCount">Number of vertices in the buffers</param>
+/// <param name="interleavedStride">Size of the full-precision interleaved vertex</param>
+/// <param name="fetched">Vertices drawn by each pass this frame</param>
+/// <param name="costs">What one vertex costs each pass</param>
+/// <param name="passCount">Number of passes</param>
+inline void ReportVertexFormat(std::ostream& report, size_t vertexCount, size_t interleavedStride,
+    const size_t* fetched, const VertexFetchCost* costs, int passCount)
+{
+    size_t before = 0;
+    size_t after = 0;
+    for (int i = 0; i < passCount; i++)
+    {
+        before += fetched[i] * costs[i].interleavedBytes;
+        after += fetched[i] * costs[i].packedBytes;
+    }
+    report << "Vertex memory: " << vertexCount * interleavedStride << " -> "
+        << vertexCount * (sizeof(PackedPosition) + sizeof(PackedAttributes)) << " bytes" << std::endl;
+    report << "Vertex fetch per frame: " << before << " -> " << after << " bytes" << std::endl;
+}
@@ -0,0 +1,25 @@
+// Per-frame camera and shadow data, shared by every shader program.
+// Written once per frame from the CameraBlock struct in CameraBlock.h,
+// so the member order and std140 layout must match it exactly.
+// Most shadow cascades, must match kMaxCascades in CascadedShadows.h
+const int kMaxCascades = 4;
+
+layout(std140) uniform Camera
+{
+	mat4 view;
+	mat4 projection;
+
+	// view without the translation, for the skybox
+	mat4 skyboxView;
+
+	// orthographic projection * view of the directional light, per cascade (CascadedShadows.h)
+	mat4 lightSpace[kMaxCascades];
+
+	// view depth each cascade ends at, 0 for unused cascades
+	vec4 cascadeSplits;
+
+	// 1 / depth range of each cascade, to turn a world space bias into a depth bias
+	vec4 cascadeDepthScale;
+
+	vec4 cameraPos;
+};
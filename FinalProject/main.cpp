@@ -3,11 +3,15 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstddef>
+#include <cstdio>
 #include <fstream>
 #include <iostream>
 #include <string>
-
+#include <thread>
 #include <vector>
 
 #include <glm/glm.hpp>
@@ -16,9 +20,49 @@
 
 #include <ctime>
 #include <cstdlib>
+
+#include "Benchmark.h"
+#include "CameraBlock.h"
+#include "CascadedShadows.h"
+#include "CpuProfiler.h"
+#include "DrawQueue.h"
+#include "FramePacer.h"
+#include "FrameSequence.h"
+#include "GpuProfiler.h"
+#include "GLStateCache.h"
+#include "GoldenImages.h"
+#include "InputRecording.h"
+#include "Instancing.h"
+#include "MeshBuilder.h"
+#include "LightList.h"
+#include "RenderStats.h"
+#include "ScreenshotCapture.h"
+#include "ShadowCache.h"
+#include "Simulation.h"
+#include "StatsOverlay.h"
+#include "TextureResidency.h"
+#include "UniformTable.h"
+#include "VertexFormat.h"
+
+// After the headers above, which may include stb_image.h for its declarations only
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
+/// <summary>
+/// Far plane of the camera projection, also used to quantize draw depth in the sort key.
+/// </summary>
+const float kFarPlane = 100.0f;
+
+/// <summary>
+/// Distance from the light over which shadow casters are ordered front to back in the sort key.
+/// </summary>
+const float kShadowSortDistance = 11.0f;
+
+/// <summary>
+/// Number of extra cabinets the --stress-instances mode fills the room with.
+/// </summary>
+const int kStressInstanceCount = 10000;
+
 /**
  * @brief Function for handling the event when the size of the framebuffer changed.
  * @param[in] window Reference to the window
@@ -31,8 +75,10 @@
  /// </summary>
  /// <param name="vertexShaderFilePath">Vertex shader file path</param>
  /// <param name="fragmentShaderFilePath">Fragment shader file path</param>
+ /// <param name="geometryShaderFilePath">Geometry shader file path, empty for none</param>
  /// <returns>OpenGL handle to the created shader program</returns>
-GLuint CreateShaderProgram(const std::string& vertexShaderFilePath, const std::string& fragmentShaderFilePath);
+GLuint CreateShaderProgram(const std::string& vertexShaderFilePath, const std::string& fragmentShaderFilePath,
+    const std::string& geometryShaderFilePath = "");
 
 /// <summary>
 /// Creates a shader based on the provided shader type and the path to the file containing the shader source.
@@ -42,6 +88,15 @@ GLuint CreateShaderProgram(const std::string& vertexShaderFilePath, const std::s
 /// <returns>OpenGL handle to the created shader</returns>
 GLuint CreateShaderFromFile(const GLuint& shaderType, const std::string& shaderFilePath);
 
+/// <summary>
+/// Reads a shader source file, expanding any #include "file" lines in it.
+/// GLSL 3.30 has no include directive, so shared blocks such as camera.glsl are pasted in here.
+/// </summary>
+/// <param name="shaderFilePath">Path to the file containing the shader source</param>
+/// <param name="shaderSource">Receives the expanded shader source</param>
+/// <returns>True if the file and everything it includes could be read</returns>
+bool ReadShaderSource(const std::string& shaderFilePath, std::string& shaderSource);
+
 /// <summary>
 /// Creates a shader based on the provided shader type and the string containing the shader source.
 /// </summary>
@@ -50,6 +105,9 @@ GLuint CreateShaderFromFile(const GLuint& shaderType, const std::string& shaderF
 /// <returns>OpenGL handle to the created shader</returns>
 GLuint CreateShaderFromSource(const GLuint& shaderType, const std::string& shaderSource);
 
+// The callbacks below mark the scene dirty, so the --on-demand mode renders again
+FramePacer framePacer = {};
+
 /// <summary>
 /// Function for handling the event when the size of the framebuffer changed.
 /// </summary>
@@ -62,13 +120,20 @@ void FramebufferSizeChangedCallback(GLFWwindow* window, int width, int height)
     // Whenever the size of the framebuffer changed (due to window resizing, etc.),
     // update the dimensions of the region to the new size
     glViewport(0, 0, width, height);
+    MarkFrameDirty(framePacer);
 }
 
-//camera
-glm::vec3 cameraPos = glm::vec3(0.0f, 2.0f, 8.0f);
+/// <summary>
+/// Function for handling the event when the window's contents were damaged, e.g. uncovered, and have to be drawn again.
+/// </summary>
+void WindowRefreshCallback(GLFWwindow*)
+{
+    MarkFrameDirty(framePacer);
+}
+
+//camera, its position is part of the SimulationState
 glm::vec3 cameraFront = glm::vec3(0.0f, -1.0f, -2.0f);
 glm::vec3 cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
-float cameraSpeed = 0.005f;
 
 //mouse
 float lastX = 400.f, lastY = 300.f;
@@ -76,6 +141,10 @@ float pitch = 0.0f;
 float yaw = -90.0f;
 bool firstMouse = true;
 
+// How far the cursor moved since the last frame. The camera turns once per frame by the sum,
+// so a recording only needs one delta per frame to turn it the same way.
+glm::vec2 cursorDelta = glm::vec2(0.0f);
+
 void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
 
     if (firstMouse) {
@@ -88,12 +157,22 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
     lastX = xpos;
     lastY = ypos;
 
-    const float sensitivity = 0.1f;
-    xoffset *= sensitivity;
-    yoffset *= sensitivity;
+    cursorDelta += glm::vec2(xoffset, yoffset);
+    MarkFrameDirty(framePacer);
+}
 
-    yaw += xoffset;
-    pitch += yoffset;
+/// <summary>
+/// Turns the camera by a frame's cursor movement.
+/// </summary>
+/// <param name="delta">Cursor movement in pixels, x to the right and y up</param>
+void TurnCamera(const glm::vec2& delta)
+{
+    if (delta == glm::vec2(0.0f)) {
+        return;
+    }
+    const float sensitivity = 0.1f;
+    yaw += delta.x * sensitivity;
+    pitch += delta.y * sensitivity;
 
     if (pitch > 89.0f) {
         pitch = 89.0f;
@@ -101,11 +180,30 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
     if (pitch < -89.0f) {
         pitch = -89.0f;
     }
-    glm::vec3 direction;
-    direction.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
-    direction.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
-    direction.y = sin(glm::radians(pitch));
-    cameraFront = glm::normalize(direction);
+    cameraFront = CameraFrontFromAngles(yaw, pitch);
+}
+
+/// <summary>
+/// Samples the keys the simulation reads, once per frame.
+/// </summary>
+/// <param name="window">Window to read the keys of</param>
+/// <returns>The held keys as kInputKey bits</returns>
+uint32_t PollInputKeys(GLFWwindow* window)
+{
+    CPU_ZONE("Input polling");
+    const struct { int key; uint32_t bit; } keys[] = {
+        { GLFW_KEY_W, kInputKeyW }, { GLFW_KEY_S, kInputKeyS }, { GLFW_KEY_D, kInputKeyD }, { GLFW_KEY_A, kInputKeyA },
+        { GLFW_KEY_UP, kInputKeyUp }, { GLFW_KEY_DOWN, kInputKeyDown },
+        { GLFW_KEY_RIGHT, kInputKeyRight }, { GLFW_KEY_LEFT, kInputKeyLeft },
+        { GLFW_KEY_SPACE, kInputKeySpace }
+    };
+    uint32_t held = 0;
+    for (const auto& key : keys) {
+        if (glfwGetKey(window, key.key) == GLFW_PRESS) {
+            held |= key.bit;
+        }
+    }
+    return held;
 }
 
  
@@ -117,6 +215,31 @@ struct Vertex
     GLfloat u, v;
     GLfloat nx, ny, nz;
 };
+
+/// <summary>
+/// Two vertices are the same if every attribute matches; used to weld the triangle lists into indexed meshes.
+/// </summary>
+bool operator==(const Vertex& a, const Vertex& b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z && a.r == b.r && a.g == b.g && a.b == b.b
+        && a.u == b.u && a.v == b.v && a.nx == b.nx && a.ny == b.ny && a.nz == b.nz;
+}
+
+struct VertexHash
+{
+    size_t operator()(const Vertex& vertex) const
+    {
+        std::hash<float> hashFloat;
+        size_t hash = hashFloat(vertex.x);
+        hash = hash * 31 + hashFloat(vertex.y);
+        hash = hash * 31 + hashFloat(vertex.z);
+        hash = hash * 31 + hashFloat(vertex.u);
+        hash = hash * 31 + hashFloat(vertex.v);
+        hash = hash * 31 + hashFloat(vertex.nx);
+        hash = hash * 31 + hashFloat(vertex.ny);
+        return hash * 31 + hashFloat(vertex.nz);
+    }
+};
 struct Light
 {
     glm::vec3 lightPos;
@@ -135,8 +258,219 @@ struct Light
  * A value of 0 indicates the program ended succesfully, while a non-zero value indicates
  * something wrong happened during execution.
  */
-int main()
+int main(int argc, char** argv)
 {
+    std::chrono::steady_clock::time_point launched = std::chrono::steady_clock::now();
+
+    // --bench-lights renders the scene with 1 to kMaxPointLights point lights and reports the frame times
+    // --stress-instances adds kStressInstanceCount small cabinets to show how many draw calls instancing saves
+    // --cascades N and --shadow-size N set the number of shadow cascades and the resolution of each
+    // --shadow-timing reports the GPU time of every cascade's static composite and of its casters, drawn a cascade at a time
+    // --shadow-cache-casters N caches the static casters' depth once there are at least N of them
+    //   (kDefaultStaticCacheCasters), and draws them with the moving ones otherwise; 0 always caches
+    // --on-demand only renders when something changed, sleeping in between, and reports the idle time
+    // --gpu-trace FILE writes the GPU time of every pass as a Chrome trace on exit
+    // --cpu-trace FILE records CPU zones and writes them as a Chrome trace on F9 and on exit
+    // --benchmark N renders N frames of a scripted camera path offscreen in an invisible window and writes a JSON report;
+    //   --resolution WxH sets the size of the offscreen target and --benchmark-report FILE where the report goes
+    // --record FILE writes the keys, cursor movement and frame times of the run, --replay FILE plays them back
+    //   frame by frame instead of reading the keyboard and mouse; --seed N fixes the day colors
+    // --golden DIR renders fixed poses offscreen and compares them with the reference images in DIR,
+    //   exiting with 1 if any differs; --golden-update writes the references instead
+    // --hud shows the render stats of every frame in the top left corner from the start; F3 toggles them
+    // --screenshots DIR is where F12 saves a screenshot and Shift+F12 a burst of kScreenshotBurstFrames,
+    //   as PNG unless --screenshot-format ppm is given
+    // --sequence N OUT renders N frames of the camera path offscreen as fast as possible, at --sequence-fps N
+    //   (60) of simulated time each, into OUT if it ends in .y4m and else as PPMs in the directory OUT;
+    //   --resolution WxH sets their size
+    // --texture-budget MB keeps the textures within MB of video memory by dropping the top levels of those
+    //   seen least recently, streaming them back once they are in view again
+    // --mipmaps off samples the top level of every texture only, as before chains were built, to compare
+    //   texture bandwidth in the benchmark with and without them
+    // --bake-textures decodes every texture, writes its chain into a .gdtx container beside its file and exits;
+    //   later runs map the containers instead of decoding, unless --baked-textures off is given to compare startup
+    // --texture-compression off uploads the textures uncompressed; otherwise they are encoded to BC1 on the
+    //   loader threads where the context takes S3TC, and the blocks cached in texture-cache for later runs
+    //   unless --texture-cache off is given
+    LightBenchmark lightBenchmark = { false, 1, 0, 0.0 };
+    bool stressInstances = false;
+    bool onDemand = false;
+    std::string gpuTracePath;
+    std::string cpuTracePath;
+    Benchmark benchmark = CreateBenchmark();
+    GoldenRun golden = CreateGoldenRun();
+    std::string recordPath;
+    std::string replayPath;
+    bool showStats = false;
+    std::string screenshotDirectory = ".";
+    ImageFormat screenshotFormat = ImageFormat::Png;
+    int sequenceFrames = 0;
+    int sequenceFps = 60;
+    std::string sequencePath;
+    TextureSettings textureSettings = DefaultTextureSettings();
+    bool bakeTextures = false;
+    bool seedGiven = false;
+    uint32_t seed = static_cast<uint32_t>(time(0));
+    CascadeSettings cascadeSettings = DefaultCascadeSettings();
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--bench-lights")
+        {
+            lightBenchmark.running = true;
+        }
+        else if (std::string(argv[i]) == "--stress-instances")
+        {
+            stressInstances = true;
+        }
+        else if (std::string(argv[i]) == "--cascades" && i + 1 < argc)
+        {
+            cascadeSettings.count = glm::clamp(std::atoi(argv[++i]), 1, kMaxCascades);
+        }
+        else if (std::string(argv[i]) == "--shadow-size" && i + 1 < argc)
+        {
+            cascadeSettings.resolution = glm::clamp(std::atoi(argv[++i]), 64, 8192);
+        }
+        else if (std::string(argv[i]) == "--shadow-timing")
+        {
+            cascadeSettings.timePerCascade = true;
+        }
+        else if (std::string(argv[i]) == "--shadow-cache-casters" && i + 1 < argc)
+        {
+            cascadeSettings.staticCacheCasters = std::max(0, std::atoi(argv[++i]));
+        }
+        else if (std::string(argv[i]) == "--on-demand")
+        {
+            onDemand = true;
+        }
+        else if (std::string(argv[i]) == "--gpu-trace" && i + 1 < argc)
+        {
+            gpuTracePath = argv[++i];
+        }
+        else if (std::string(argv[i]) == "--cpu-trace" && i + 1 < argc)
+        {
+            cpuTracePath = argv[++i];
+        }
+        else if (std::string(argv[i]) == "--benchmark" && i + 1 < argc)
+        {
+            benchmark.running = true;
+            benchmark.frames = std::max(std::atoi(argv[++i]), 1);
+        }
+        else if (std::string(argv[i]) == "--resolution" && i + 1 < argc)
+        {
+            int width = 0;
+            int height = 0;
+            if (std::sscanf(argv[++i], "%dx%d", &width, &height) == 2 && width > 0 && height > 0)
+            {
+                benchmark.width = width;
+                benchmark.height = height;
+            }
+        }
+        else if (std::string(argv[i]) == "--benchmark-report" && i + 1 < argc)
+        {
+            benchmark.reportPath = argv[++i];
+        }
+        else if (std::string(argv[i]) == "--golden" && i + 1 < argc)
+        {
+            golden.running = true;
+            golden.directory = argv[++i];
+        }
+        else if (std::string(argv[i]) == "--golden-update")
+        {
+            golden.update = true;
+        }
+        else if (std::string(argv[i]) == "--record" && i + 1 < argc)
+        {
+            recordPath = argv[++i];
+        }
+        else if (std::string(argv[i]) == "--replay" && i + 1 < argc)
+        {
+            replayPath = argv[++i];
+        }
+        else if (std::string(argv[i]) == "--seed" && i + 1 < argc)
+        {
+            seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+            seedGiven = true;
+        }
+        else if (std::string(argv[i]) == "--hud")
+        {
+            showStats = true;
+        }
+        else if (std::string(argv[i]) == "--screenshots" && i + 1 < argc)
+        {
+            screenshotDirectory = argv[++i];
+        }
+        else if (std::string(argv[i]) == "--screenshot-format" && i + 1 < argc)
+        {
+            screenshotFormat = std::string(argv[++i]) == "ppm" ? ImageFormat::Ppm : ImageFormat::Png;
+        }
+        else if (std::string(argv[i]) == "--sequence" && i + 2 < argc)
+        {
+            sequenceFrames = std::max(std::atoi(argv[++i]), 1);
+            sequencePath = argv[++i];
+        }
+        else if (std::string(argv[i]) == "--sequence-fps" && i + 1 < argc)
+        {
+            sequenceFps = glm::clamp(std::atoi(argv[++i]), 1, 120);
+        }
+        else if (std::string(argv[i]) == "--texture-budget" && i + 1 < argc)
+        {
+            textureSettings.budgetBytes = static_cast<size_t>(std::max(std::atoi(argv[++i]), 1)) << 20;
+        }
+        else if (std::string(argv[i]) == "--mipmaps" && i + 1 < argc)
+        {
+            textureSettings.mipmaps = std::string(argv[++i]) != "off";
+        }
+        else if (std::string(argv[i]) == "--bake-textures")
+        {
+            bakeTextures = true;
+        }
+        else if (std::string(argv[i]) == "--baked-textures" && i + 1 < argc)
+        {
+            textureSettings.baked = std::string(argv[++i]) != "off";
+        }
+        else if (std::string(argv[i]) == "--texture-compression" && i + 1 < argc)
+        {
+            textureSettings.compression = std::string(argv[++i]) != "off";
+        }
+        else if (std::string(argv[i]) == "--texture-cache" && i + 1 < argc)
+        {
+            if (std::string(argv[++i]) == "off")
+            {
+                textureSettings.cacheDirectory.clear();
+            }
+        }
+    }
+
+    // The benchmark, the golden images and sequences render offscreen at a size of their own, and take the place of the input
+    golden.running = golden.running && !benchmark.running;
+    bool sequencing = sequenceFrames != 0 && !benchmark.running && !golden.running;
+    bool offscreen = benchmark.running || golden.running || sequencing;
+    int offscreenWidth = golden.running ? kGoldenWidth : benchmark.width;
+    int offscreenHeight = golden.running ? kGoldenHeight : benchmark.height;
+
+    // A replay runs with the seed it was recorded with
+    InputReplay inputReplay = {};
+    bool replaying = !replayPath.empty() && !offscreen;
+    if (replaying)
+    {
+        std::string error;
+        if (!LoadInputReplay(inputReplay, replayPath, error))
+        {
+            std::cerr << "Failed to load the input recording " << replayPath << ": " << error << std::endl;
+            return 1;
+        }
+        seed = inputReplay.seed;
+        std::cout << "Replaying " << inputReplay.frames.size() << " frames from " << replayPath << std::endl;
+    }
+    else if ((benchmark.running || sequencing) && !seedGiven)
+    {
+        seed = kBenchmarkSeed;
+    }
+
+    // Recording from the start catches the setup: shader compiles and texture loads
+    NameCpuProfilerThread("Main");
+    EnableCpuProfiler(!cpuTracePath.empty());
+
     // Initialize GLFW
     int glfwInitStatus = glfwInit();
     if (glfwInitStatus == GLFW_FALSE)
@@ -157,6 +491,17 @@ int main()
     // Tell GLFW to create a window
     int windowWidth = 800;
     int windowHeight = 600;
+    if (offscreen)
+    {
+        // Nothing is drawn to the window, so it never has to be shown
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        windowWidth = offscreenWidth;
+        windowHeight = offscreenHeight;
+    }
+    if (bakeTextures)
+    {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    }
     GLFWwindow* window = glfwCreateWindow(windowWidth, windowHeight, "Final Project - GDEV32", nullptr, nullptr);
     if (window == nullptr)
     {
@@ -170,6 +515,7 @@ int main()
 
     // Register the callback function that handles when the framebuffer size has changed
     glfwSetFramebufferSizeCallback(window, FramebufferSizeChangedCallback);
+    glfwSetWindowRefreshCallback(window, WindowRefreshCallback);
 
     // Tell GLAD to load the OpenGL function pointers
     if (!gladLoadGLLoader(reinterpret_cast<GLADloadproc>(glfwGetProcAddress)))
@@ -178,6 +524,13 @@ int main()
         return 1;
     }
 
+    // The window was sized in screen coordinates, which are not pixels on a high-DPI display.
+    // From here on windowWidth and windowHeight hold the size of what is drawn to, in pixels
+    if (!offscreen)
+    {
+        glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
+    }
+
     // Tell OpenGL the dimensions of the region where stuff will be drawn.
     // For now, tell OpenGL to use the whole screen
     glViewport(0, 0, windowWidth, windowHeight);
@@ -187,6 +540,30 @@ int main()
     // (red = 0.0, green = 0.0, blue = 1.0)
     glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
 
+    // The images are mapped from their baked containers or decoded on a pool of threads while the rest
+    // of the setup runs, and uploaded as they arrive. Until then each handle shows a single grey texel.
+    // Baking decodes every texture afresh rather than mapping the containers it is about to replace.
+    TextureResidency textureResidency;
+    textureSettings.baked = textureSettings.baked && !bakeTextures;
+    StartTextureResidency(textureResidency, textureSettings, std::max(1, static_cast<int>(std::thread::hardware_concurrency())));
+    TextureHandle cabinetTexture = AcquireTexture(textureResidency, MaterialTextureDesc("cabinetTex.jpg"));
+    TextureHandle woodTexture = AcquireTexture(textureResidency, MaterialTextureDesc("woodTex.jpg"));
+    TextureHandle bedTopTexture = AcquireTexture(textureResidency, MaterialTextureDesc("bedTop.jpg"));
+
+    // The floor stretches its tiles ten times over and is mostly seen at a grazing angle
+    TextureDesc floorDesc = MaterialTextureDesc("tiles.jpg");
+    floorDesc.anisotropy = 16.0f;
+    TextureHandle tilesTexture = AcquireTexture(textureResidency, floorDesc);
+    TextureHandle simsTexture = AcquireTexture(textureResidency, MaterialTextureDesc("sims.jpg"));
+    TextureHandle faceTopTexture = AcquireTexture(textureResidency, MaterialTextureDesc("bottomDia.jpg", GL_NEAREST));
+    TextureHandle skyboxTexture = AcquireTexture(textureResidency, CubeMapTextureDesc({
+            "space-skybox-right.jpg",
+            "space-skybox-left.jpg",
+            "space-skybox-top.jpg",
+            "space-skybox-bottom.jpg",
+            "space-skybox-front.jpg",
+            "space-skybox-back.jpg" }));
+
     Vertex vertices[250];
 
   
@@ -535,88 +912,160 @@ int main()
     vertices[220] = { -1.0f, -1.0f,  1.0f,	0,0,0,      1.f,1.f,		0.0f, -1.0f, 0.0f };
     vertices[221] = { 1.0f, -1.0f,  1.0f,	0,0,0,      1.f,1.f,		0.0f, -1.0f, 0.0f };
     
-    // Create a vertex buffer object (VBO), and upload our vertices data to the VBO
-    GLuint vbo;
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    // Weld the triangle lists above into indexed meshes ordered for the vertex cache.
+    // The moving face is split by material, and its three parts are built back to back
+    // so the shadow pass can still draw it whole.
+    MeshBuilder<Vertex> meshBuilder;
+    MeshStats meshStats;
+    MeshRange planeMesh = AddMesh<VertexHash>(meshBuilder, vertices, 0, 6, meshStats);
+    ReportMesh(std::cout, "plane", meshStats);
+    MeshRange cubeMesh = AddMesh<VertexHash>(meshBuilder, vertices, 6, 36, meshStats);
+    ReportMesh(std::cout, "cube", meshStats);
+    MeshRange bedTopMesh = AddMesh<VertexHash>(meshBuilder, vertices, 60, 36, meshStats);
+    ReportMesh(std::cout, "bed top", meshStats);
+    MeshRange bedBelowMesh = AddMesh<VertexHash>(meshBuilder, vertices, 96, 36, meshStats);
+    ReportMesh(std::cout, "bed below", meshStats);
+    MeshRange pyramidMesh = AddMesh<VertexHash>(meshBuilder, vertices, 132, 18, meshStats);
+    ReportMesh(std::cout, "pyramid", meshStats);
+    MeshRange faceSidesMesh = AddMesh<VertexHash>(meshBuilder, vertices, 150, 24, meshStats);
+    ReportMesh(std::cout, "face sides", meshStats);
+    MeshRange faceTopMesh = AddMesh<VertexHash>(meshBuilder, vertices, 174, 6, meshStats);
+    ReportMesh(std::cout, "face top", meshStats);
+    MeshRange faceBottomMesh = AddMesh<VertexHash>(meshBuilder, vertices, 180, 6, meshStats);
+    ReportMesh(std::cout, "face bottom", meshStats);
+    MeshRange faceMesh = { faceSidesMesh.firstIndex, faceSidesMesh.indexCount + faceTopMesh.indexCount + faceBottomMesh.indexCount };
+    MeshRange skyboxMesh = AddMesh<VertexHash>(meshBuilder, vertices, 186, 36, meshStats);
+    ReportMesh(std::cout, "skybox", meshStats);
+
+    // Pack the welded vertices into two streams: positions alone, which is all the depth pass and skybox read,
+    // and the remaining attributes for the shaded passes
+    std::vector<PackedPosition> packedPositions;
+    std::vector<PackedAttributes> packedAttributes;
+    PackVertices(meshBuilder.vertices, packedPositions, packedAttributes);
+
+    // Create vertex buffer objects (VBO), and upload our vertices data to them
+    GLuint positionVbo;
+    glGenBuffers(1, &positionVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, positionVbo);
+    glBufferData(GL_ARRAY_BUFFER, packedPositions.size() * sizeof(PackedPosition), packedPositions.data(), GL_STATIC_DRAW);
+
+    GLuint attributeVbo;
+    glGenBuffers(1, &attributeVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, attributeVbo);
+    glBufferData(GL_ARRAY_BUFFER, packedAttributes.size() * sizeof(PackedAttributes), packedAttributes.data(), GL_STATIC_DRAW);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
+    // And the indices into an element buffer, which every vertex array object below points at
+    GLuint ebo;
+    glGenBuffers(1, &ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, meshBuilder.indices.size() * sizeof(GLushort), meshBuilder.indices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    // Object-space bounds of the meshes inside the vertex buffer, for light culling
+    BoundingSphere planeBounds = ComputeBounds(&vertices[0].x, sizeof(Vertex), 0, 6);
+    BoundingSphere cubeBounds = ComputeBounds(&vertices[0].x, sizeof(Vertex), 6, 36);
+    BoundingSphere bedTopBounds = ComputeBounds(&vertices[0].x, sizeof(Vertex), 60, 36);
+    BoundingSphere bedBelowBounds = ComputeBounds(&vertices[0].x, sizeof(Vertex), 96, 36);
+    BoundingSphere pyramidBounds = ComputeBounds(&vertices[0].x, sizeof(Vertex), 132, 18);
+    BoundingSphere faceBounds = ComputeBounds(&vertices[0].x, sizeof(Vertex), 150, 36);
+
     // Create a vertex array object that contains data on how to map vertex attributes
     // (e.g., position, color) to vertex shader properties.
     GLuint vao;
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
 
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
 
     // Vertex attribute 0 - Position
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, x));
-
-    // Vertex attribute 1 - Color
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)(offsetof(Vertex, r)));
+    SetPositionStream(positionVbo);
 
-    // Vertex attribute 2 - UV coordinate
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offsetof(Vertex, u)));
-
-    //Vertex Attribute 3 - Normal
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offsetof(Vertex, nx)));
+    // Vertex attributes 1, 2 and 3 - Color, UV coordinate and normal
+    SetAttributeStream(attributeVbo, true);
 
     glBindVertexArray(0);
 
     // Create a shader program
 
     GLuint program = CreateShaderProgram("main.vsh", "main.fsh");
+    EnableInstanceAttributes(vao);
 
     GLuint lightVAO;
     glGenVertexArrays(1, &lightVAO);
     glBindVertexArray(lightVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    SetPositionStream(positionVbo);
 
     GLuint lightShader = CreateShaderProgram("light.vsh", "light.fsh");
 
     GLuint depthVAO;
     glGenVertexArrays(1, &depthVAO);
     glBindVertexArray(depthVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    SetPositionStream(positionVbo);
     glBindVertexArray(0);
-    GLuint depthShader = CreateShaderProgram("depth.vsh", "depth.fsh");
+    GLuint depthShader = CreateShaderProgram("depth.vsh", "depth.fsh", "depth.gsh");
+    EnableInstanceAttributes(depthVAO);
 
 
     GLuint skyboxVAO;
     glGenVertexArrays(1, &skyboxVAO);
     glBindVertexArray(skyboxVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    SetPositionStream(positionVbo);
 
     GLuint skyboxShader = CreateShaderProgram("skybox.vsh", "skybox.fsh");
 
     GLuint reflectVAO;
     glGenVertexArrays(1, &reflectVAO);
     glBindVertexArray(reflectVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
     // Vertex attribute 0 - Position
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, x));
+    SetPositionStream(positionVbo);
 
 
     //Vertex Attribute 3 - Normal
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offsetof(Vertex, nx)));
+    SetAttributeStream(attributeVbo, false);
 
     glEnableVertexAttribArray(0);
 
     GLuint reflectShader = CreateShaderProgram("cubeReflect.vsh", "cubeReflect.fsh");
 
+    // Resolve every uniform location once, now that all programs are linked,
+    // so the render loop never has to look anything up by name.
+    UniformTable programUniforms = ResolveUniforms(program);
+    UniformTable lightUniforms = ResolveUniforms(lightShader);
+    UniformTable depthUniforms = ResolveUniforms(depthShader);
+    UniformTable skyboxUniforms = ResolveUniforms(skyboxShader);
+    UniformTable reflectUniforms = ResolveUniforms(reflectShader);
+
+    // Every program reads view/projection/shadow data from the shared Camera block
+    GLuint cameraUbo = CreateCameraBuffer();
+    BindCameraBlock(program);
+    BindCameraBlock(lightShader);
+    BindCameraBlock(depthShader);
+    BindCameraBlock(skyboxShader);
+    BindCameraBlock(reflectShader);
+
+    // Sampler bindings never change, so set them here instead of every frame.
+    // The shadow map gets a texture unit of its own.
+    glUseProgram(program);
+    SetUniform(programUniforms, Uniform::Tex, 0);
+    SetUniform(programUniforms, Uniform::Bump, 1);
+    SetUniform(programUniforms, Uniform::ShadowMap, 2);
+    SetUniform(programUniforms, Uniform::PointLights, kPointLightTextureUnit);
+    SetUniform(programUniforms, Uniform::LightIndices, kLightIndexTextureUnit);
+    glUseProgram(reflectShader);
+    SetUniform(reflectUniforms, Uniform::Skybox, 0);
+    glUseProgram(skyboxShader);
+    SetUniform(skyboxUniforms, Uniform::Skybox, 0);
+    glUseProgram(0);
+
+    // The golden images compare the scene alone, so they never show the stats
+    GLuint overlayShader = CreateShaderProgram("overlay.vsh", "overlay.fsh");
+    StatsOverlay statsOverlay = CreateStatsOverlay(overlayShader);
+    statsOverlay.visible = showStats && !golden.running;
     
 
     // Tell OpenGL the dimensions of the region where stuff will be drawn.
@@ -626,383 +1075,297 @@ int main()
     glEnable(GL_DEPTH_TEST);
     float angle = 0.0;
     //mouse
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-    glfwSetCursorPosCallback(window, mouse_callback);
-
-
-    glViewport(0, 0, windowWidth, windowHeight);
-
-
-
-#pragma region SECONDTEXTURE
-
-
-    //THIS IS FOR THE SECOND TEXTURE
-    GLuint tex1;
-    glGenTextures(1, &tex1);
-    stbi_set_flip_vertically_on_load(true);
-    int imageWidth, imageHeight, numChannels;
-
-    unsigned char* imageData = stbi_load("cabinetTex.jpg", &imageWidth, &imageHeight, &numChannels, 0);
-
-
-    if (imageData != nullptr)
-    {
-        glBindTexture(GL_TEXTURE_2D, tex1);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, imageData);
-
-
-        stbi_image_free(imageData);
-        imageData = nullptr;
-    }
-    else
+    if (!offscreen)
     {
-        std::cerr << "Failed to load image" << std::endl;
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        glfwSetCursorPosCallback(window, mouse_callback);
     }
 
 
-    stbi_set_flip_vertically_on_load(true);
-
-
-#pragma endregion
-
-#pragma region THIRDTEXTURE
-
+    glViewport(0, 0, windowWidth, windowHeight);
 
-    //THIS IS FOR THE THIRD TEXTURE
-    GLuint tex2;
-    glGenTextures(1, &tex2);
-    stbi_set_flip_vertically_on_load(true);
 
-    imageData = stbi_load("woodTex.jpg", &imageWidth, &imageHeight, &numChannels, 0);
 
-    if (imageData != nullptr)
+    // Every texture has to be in place before a run whose frames are compared or timed, or before it is baked
+    if (offscreen || lightBenchmark.running || bakeTextures)
     {
-        glBindTexture(GL_TEXTURE_2D, tex2);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, imageData);
-
-
-        stbi_image_free(imageData);
-        imageData = nullptr;
+        CPU_ZONE("Texture loading");
+        UpdateTextureResidency(textureResidency, nullptr, true, std::cout);
     }
-    else
+    if (bakeTextures)
     {
-        std::cerr << "Failed to load image" << std::endl;
+        int failed = BakeTextures(textureResidency, std::cout);
+        for (TextureHandle texture : { cabinetTexture, woodTexture, bedTopTexture, tilesTexture, simsTexture, faceTopTexture, skyboxTexture })
+        {
+            ReleaseTexture(textureResidency, texture);
+        }
+        StopTextureResidency(textureResidency);
+        glfwTerminate();
+        return failed == 0 ? 0 : 1;
     }
 
 
-    stbi_set_flip_vertically_on_load(true);
-
-
-#pragma endregion
-#pragma region FOURTHTEXTURE
-
+    // Shadow map, one layer per cascade
+    ShadowMap shadowMap = CreateShadowMap(cascadeSettings.resolution, cascadeSettings.count);
 
-    //THIS IS FOR THE FOURTH TEXTURE
-    GLuint tex3;
-    glGenTextures(1, &tex3);
-    stbi_set_flip_vertically_on_load(true);
-
-    imageData = stbi_load("bedTop.jpg", &imageWidth, &imageHeight, &numChannels, 0);
-
-    if (imageData != nullptr)
+    glBindFramebuffer(GL_FRAMEBUFFER, shadowMap.framebuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
     {
-        glBindTexture(GL_TEXTURE_2D, tex3);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        std::cout << "Error! Framebuffer not complete!" << std::endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    
+    
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, imageData);
+    // Camera, moving face, lamp and night/day toggle advance in fixed steps, independent of the frame rate
+    SimulationState previousState = CreateSimulationState(seed);
+    SimulationState currentState = previousState;
 
+    // Render loop
 
-        stbi_image_free(imageData);
-        imageData = nullptr;
-    }
-    else
+    LightList lightList = CreateLightList();
+    DrawQueue drawQueue = CreateDrawQueue();
+    DrawQueue shadowQueue = CreateDrawQueue();
+    DrawQueue staticShadowQueue = CreateDrawQueue();
+    GLuint shadowCompositeShader = CreateShaderProgram("shadowComposite.vsh", "shadowComposite.fsh");
+    StaticShadowCache staticShadows = {};
+    std::vector<BoundingSphere> staticCasterBounds;
+    ShadowTimer shadowTimer = CreateShadowTimer();
+    GpuProfiler gpuProfiler = CreateGpuProfiler(!gpuTracePath.empty() || benchmark.running);
+
+    // The benchmark's and golden images' frames go to an offscreen target, everything else to the window
+    OffscreenTarget offscreenTarget = {};
+    GLuint sceneFramebuffer = 0;
+    if (offscreen)
     {
-        std::cerr << "Failed to load image" << std::endl;
+        offscreenTarget = CreateOffscreenTarget(offscreenWidth, offscreenHeight, kBenchmarkSamples);
+        glBindFramebuffer(GL_FRAMEBUFFER, offscreenTarget.framebuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cerr << "Failed to create the offscreen framebuffer" << std::endl;
+            return 1;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        sceneFramebuffer = offscreenTarget.framebuffer;
     }
-
-
-    stbi_set_flip_vertically_on_load(true);
-
-
-#pragma endregion
-
-
-#pragma region SEVENTHTEX
-
-
-    GLuint tex6;
-    glGenTextures(1, &tex6);
-    stbi_set_flip_vertically_on_load(true);
-
-    imageData = stbi_load("tiles.jpg", &imageWidth, &imageHeight, &numChannels, 0);
-
-    if (imageData != nullptr)
+    if (golden.running)
     {
-        glBindTexture(GL_TEXTURE_2D, tex6);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, imageData);
-
-
-        stbi_image_free(imageData);
-        imageData = nullptr;
+        StartGoldenRun(golden);
     }
-    else
+    FrameSequence sequence;
+    if (sequencing && !StartFrameSequence(sequence, sequencePath, sequenceFrames, sequenceFps, offscreenWidth, offscreenHeight))
     {
-        std::cerr << "Failed to load image" << std::endl;
+        std::cerr << "Failed to create the sequence output " << sequencePath << std::endl;
+        return 1;
     }
 
-
-    stbi_set_flip_vertically_on_load(true);
-
-
-#pragma endregion
-#pragma region EIGHTTEX
-
-
-    GLuint tex7;
-    glGenTextures(1, &tex7);
-    stbi_set_flip_vertically_on_load(true);
-
-    imageData = stbi_load("sims.jpg", &imageWidth, &imageHeight, &numChannels, 0);
-
-    if (imageData != nullptr)
+    // A grid of small cabinets covering the floor, all sharing one mesh range and material
+    std::vector<glm::mat4> stressTransforms;
+    std::vector<glm::ivec2> stressLights;
+    if (stressInstances)
     {
-        glBindTexture(GL_TEXTURE_2D, tex7);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, imageData);
-
-
-        stbi_image_free(imageData);
-        imageData = nullptr;
+        int side = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(kStressInstanceCount))));
+        for (int i = 0; i < kStressInstanceCount; i++)
+        {
+            float x = -4.8f + 9.6f * (i % side) / side;
+            float z = -4.8f + 9.6f * (i / side) / side;
+            glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(x, -4.9f, z));
+            stressTransforms.push_back(glm::scale(transform, glm::vec3(0.04f)));
+        }
     }
-    else
+    // Everything the render loop binds goes through the cache, which drops calls that change nothing.
+    // It starts out knowing nothing, so the setup code above does not need to go through it.
+    GLStateCache glState = CreateGLStateCache();
+    bool vertexFormatReported = false;
+
+    if (lightBenchmark.running || offscreen)
     {
-        std::cerr << "Failed to load image" << std::endl;
+        glfwSwapInterval(0);
     }
+    double lastFrameTime = glfwGetTime();
+    SimulationClock simulationClock = CreateSimulationClock(glfwGetTimerValue(), glfwGetTimerFrequency());
 
+    // The benchmark has to render every frame it times
+    framePacer = CreateFramePacer(onDemand && !lightBenchmark.running && !offscreen && !replaying, glfwGetTime());
 
-    stbi_set_flip_vertically_on_load(true);
-
-
-#pragma endregion
-#pragma region NINTHTEX
-
-
-    GLuint tex8;
-    glGenTextures(1, &tex8);
-    stbi_set_flip_vertically_on_load(true);
-
-    imageData = stbi_load("bottomDia.jpg", &imageWidth, &imageHeight, &numChannels, 0);
-
-    if (imageData != nullptr)
+    InputRecorder inputRecorder;
+    bool recording = !recordPath.empty() && !offscreen;
+    if (recording && !OpenInputRecorder(inputRecorder, recordPath, simulationClock.frequency, seed))
     {
-        glBindTexture(GL_TEXTURE_2D, tex8);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, imageData);
-
-
-        stbi_image_free(imageData);
-        imageData = nullptr;
+        std::cerr << "Failed to create the input recording " << recordPath << std::endl;
+        recording = false;
     }
-    else
+
+    // Screenshots read the window's back buffer, which the offscreen modes do not draw to
+    ScreenshotCapture screenshots;
+    if (!offscreen)
     {
-        std::cerr << "Failed to load image" << std::endl;
+        StartScreenshotCapture(screenshots, screenshotDirectory, screenshotFormat, windowWidth, windowHeight);
     }
 
+    bool cpuTraceKeyDown = false;
+    bool statsKeyDown = false;
+    bool screenshotKeyDown = false;
+    benchmark.startupMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - launched).count();
+    while (!glfwWindowShouldClose(window))
+    {
+        CPU_ZONE("Frame");
 
-    stbi_set_flip_vertically_on_load(true);
-
-
-#pragma endregion
-    GLuint skyboxTex;
-    glGenTextures(1, &skyboxTex);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTex);
-
-
-    std::vector<std::string> cubeMapFaces { 
-            "space-skybox-right.jpg",
-            "space-skybox-left.jpg",
-            "space-skybox-top.jpg",
-            "space-skybox-bottom.jpg",
-            "space-skybox-front.jpg",
-
-            "space-skybox-back.jpg",
+        // Follow the window's framebuffer as it is resized or moved to a display of another scale.
+        // A minimized window has none, and keeps its last size until it is restored
+        if (!offscreen)
+        {
+            int framebufferWidth = 0;
+            int framebufferHeight = 0;
+            glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+            if (framebufferWidth > 0 && framebufferHeight > 0)
+            {
+                windowWidth = framebufferWidth;
+                windowHeight = framebufferHeight;
+                ResizeScreenshotCapture(screenshots, windowWidth, windowHeight);
+            }
+        }
 
-    };
-    stbi_set_flip_vertically_on_load(false);
-    for (int i = 0; i < cubeMapFaces.size(); i++) {
-        imageData = stbi_load(cubeMapFaces[i].c_str(), &imageWidth, &imageHeight, &numChannels, 0);
-        if (imageData != nullptr) {
-            std::cout << "Loading... " << cubeMapFaces[i] << std::endl;
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, imageData);
-            stbi_image_free(imageData);
+        SimulationInput input;
+        int steps;
+        if (benchmark.running)
+        {
+            // The camera path stands in for the keys and the mouse, and every frame runs the same steps
+            input = BeginBenchmarkFrame(benchmark, cameraUp);
+            cameraFront = input.cameraFront;
+            steps = BeginFixedSimulationFrame(simulationClock, glfwGetTimerValue(), kBenchmarkStepsPerFrame);
         }
-        else
+        else if (sequencing)
         {
-            std::cerr << "Failed to load image "  << cubeMapFaces[i] << std::endl;
+            // Like the benchmark, but at the sequence's frame rate
+            input = BeginSequenceFrame(sequence, cameraUp);
+            cameraFront = input.cameraFront;
+            steps = BeginFixedSimulationFrame(simulationClock, glfwGetTimerValue(), sequence.stepsPerFrame);
         }
-    }
-
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, 0);
-
-
-    // Framebuffer
-    GLuint framebuffer;
-    glGenFramebuffers(1, &framebuffer);
-
-    // Framebuffer Texture Attachment
-    GLuint framebufferTex;
-    glGenTextures(1, &framebufferTex);
-    glBindTexture(GL_TEXTURE_2D, framebufferTex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, 1024, 1024, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_BYTE, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    //glBindTexture(GL_TEXTURE_2D, 0);
-    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, framebufferTex, 0);
-    glDrawBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-    {
-        std::cout << "Error! Framebuffer not complete!" << std::endl;
-    }
-    
-    
-
+        else if (golden.running)
+        {
+            // Every frame shows one of the fixed poses, with nothing moving in between
+            input = SimulationInput();
+            steps = BeginFixedSimulationFrame(simulationClock, glfwGetTimerValue(), 0);
+            ApplyGoldenPose(golden, currentState, cameraFront);
+            previousState = currentState;
+        }
+        else
+        {
+            // A replayed frame stands in for the keys, the mouse and the time the frame took
+            uint64_t ticks = glfwGetTimerValue();
+            InputFrame inputFrame;
+            uint64_t inputFrequency = simulationClock.frequency;
+            if (replaying)
+            {
+                if (!NextReplayFrame(inputReplay, inputFrame))
+                {
+                    glfwSetWindowShouldClose(window, GLFW_TRUE);
+                    continue;
+                }
+                inputFrequency = inputReplay.frequency;
+            }
+            else
+            {
+                inputFrame.keys = PollInputKeys(window);
+                inputFrame.cursorDelta = cursorDelta;
+                inputFrame.elapsedTicks = ticks - simulationClock.lastTicks;
+            }
+            cursorDelta = glm::vec2(0.0f);
+            if (recording)
+            {
+                RecordInputFrame(inputRecorder, inputFrame);
+            }
+            TurnCamera(inputFrame.cursorDelta);
+            input = SimulationInputFromFrame(inputFrame, cameraFront, cameraUp);
 
-    glm::vec3 movingFacePosition = glm::vec3(1.5f, -1.f, -2.f);
-    float movingFaceSpeed = 0.005f;
-    glm::vec3 x = glm::vec3(1.0f,0,0);
-    glm::vec3 z = glm::vec3(0,0,-1.0f);
-    float xRot = 0;
+            // Run as many fixed steps as the time since the last frame holds, then render a blend of the last two
+            steps = BeginSimulationFrame(simulationClock, ticks, InputFrameSeconds(inputFrame, inputFrequency));
+        }
+        uint64_t stepsStart = glfwGetTimerValue();
+        for (int step = 0; step < steps; step++)
+        {
+            CPU_ZONE("Simulation step");
+            previousState = currentState;
+            StepSimulation(currentState, input);
+        }
+        EndSimulationSteps(simulationClock, steps, glfwGetTimerValue() - stepsStart);
+        SimulationState sim = InterpolateSimulation(previousState, currentState, SimulationAlpha(simulationClock));
 
-    double timeout = 0;
-    bool night = true;
-    // Render loop
+        // Held keys change the scene every step; without them only the animations do
+        if (SimulationInputActive(input))
+        {
+            MarkFrameDirty(framePacer);
+        }
 
-    // seed random generator
-    srand(static_cast <unsigned> (time(0)));
+        // Textures decoded since the last frame replace their placeholders, and ones back in view get their levels back
+        if (UpdateTextureResidency(textureResidency, &glState, false, std::cout) != 0)
+        {
+            MarkFrameDirty(framePacer);
+        }
+        double now = glfwGetTime();
+        ReportFramePacer(framePacer, now, std::cout);
+        if (!FrameDue(framePacer, now))
+        {
+            // Nothing to show yet: sleep until an event arrives or the next animation frame is due
+            glfwWaitEventsTimeout(SecondsUntilFrameDue(framePacer, now));
+            double slept = glfwGetTime() - now;
+            RecordIdle(framePacer, slept);
+            RecordSimulationIdle(simulationClock, slept);
+            continue;
+        }
+        RecordPresent(framePacer, now);
+        CountRenderedFrame(simulationClock);
 
-    // can change only 
-    bool canChange = true;
-    float lightColorX = 1.0f;
-    float lightColorY = 1.0f;
-    float lightColorZ = 1.0f;
+        UniformLookupCounter() = 0;
+        ResetGLStateCounters(glState);
+        BeginRenderStatsFrame();
+        BeginGpuFrame(gpuProfiler);
+        BeginGpuScope(&gpuProfiler, "Frame");
 
-    while (!glfwWindowShouldClose(window))
-    {
         // Clear the colors in our off-screen framebuffer
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         //Use Shader Program
-        glUseProgram(program);
+        UseProgram(glState, program);
 
         // Use the vertex array object that we created
-        glBindVertexArray(vao);
-
+        BindVertexArray(glState, vao);
 
 
-        int upstate = glfwGetKey(window, GLFW_KEY_W);
-        int downstate = glfwGetKey(window, GLFW_KEY_S);
-        int rightstate = glfwGetKey(window, GLFW_KEY_D);
-        int leftstate = glfwGetKey(window, GLFW_KEY_A);
-        if (upstate == GLFW_PRESS) {
-            cameraPos += cameraFront * cameraSpeed;
-        }
-        else if (downstate == GLFW_PRESS) {
-            cameraPos -= cameraFront * cameraSpeed;
-        }
-        if (rightstate == GLFW_PRESS) {
-            cameraPos += glm::normalize(glm::cross(cameraFront,cameraUp)) * cameraSpeed;
-        }
-        else if (leftstate == GLFW_PRESS) {
-            cameraPos -= glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
-        }
-
-        int upArrowState = glfwGetKey(window, GLFW_KEY_UP);
-        int downArrowState = glfwGetKey(window, GLFW_KEY_DOWN);
-        int rightArrowState = glfwGetKey(window, GLFW_KEY_RIGHT);
-        int leftArrowState = glfwGetKey(window, GLFW_KEY_LEFT);
-
-
-        if (upArrowState == GLFW_PRESS) {
-            movingFacePosition += z * movingFaceSpeed;
-        }
-        else if (downArrowState == GLFW_PRESS) {
-            movingFacePosition -= z * movingFaceSpeed;
-        }
-        if (rightArrowState == GLFW_PRESS) {
-            movingFacePosition += x * movingFaceSpeed;
-        }
-        else if (leftArrowState == GLFW_PRESS) {
-            movingFacePosition -= x * movingFaceSpeed;
-        }
+        glm::vec3 cameraPos = sim.cameraPos;
         glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
-        glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)windowWidth / (float)windowHeight, 0.1f, 100.0f);
-
-#pragma region firstpass
-        glUseProgram(depthShader);
-        glBindVertexArray(depthVAO);
-        glViewport(0, 0, 1024, 1024);
+        float aspect = (float)windowWidth / (float)windowHeight;
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), aspect, 0.1f, kFarPlane);
 
-        glm::mat4 orthoProj = glm::ortho(-5.f, 5.0f, -5.0f, 5.0f, 0.1f, 11.f);
+        // The light shines from (0, 5, 1) towards the origin; this view only orders the casters
         glm::mat4 dirLightViewMat = glm::lookAt(glm::vec3(0.0f, 5.0f, 1.f), glm::vec3(0.f), glm::vec3(0.f, 1.f, 0.f));
-        glm::mat4 lightProj = orthoProj * dirLightViewMat;
-        GLint orthoProjUnifLocation = glGetUniformLocation(depthShader, "orthoProjection");
-        glUniformMatrix4fv(orthoProjUnifLocation, 1, GL_FALSE, glm::value_ptr(orthoProj));
-        GLint dirLightViewMatUnifLocation = glGetUniformLocation(depthShader, "dirLightViewMatrix");
-        glUniformMatrix4fv(dirLightViewMatUnifLocation, 1, GL_FALSE, glm::value_ptr(dirLightViewMat));
-        GLint modelUniformLocation = glGetUniformLocation(depthShader, "model");
+        glm::vec3 shadowLightDirection = glm::normalize(glm::vec3(0.0f, -5.0f, -1.0f));
+        Cascades cascades = FitCascades(view, glm::radians(45.0f), aspect, 0.1f, shadowLightDirection, cascadeSettings);
+
+        // One upload of the camera and shadow matrices serves every program this frame
+        CameraBlock camera;
+        camera.view = view;
+        camera.projection = projection;
+        camera.skyboxView = glm::mat4(glm::mat3(view));
+        for (int i = 0; i < kMaxCascades; i++)
+        {
+            camera.lightSpace[i] = cascades.lightSpace[i];
+        }
+        camera.cascadeSplits = cascades.splits;
+        camera.cascadeDepthScale = cascades.depthScale;
+        camera.cameraPos = glm::vec4(cameraPos, 1.0f);
+        uint64_t cameraUploadStart = BeginCpuZone();
+        UpdateCameraBuffer(cameraUbo, camera);
+        EndCpuZone("Camera block upload", cameraUploadStart);
 
+#pragma region firstpass
+        BeginGpuScope(&gpuProfiler, "Shadow pass");
+        Viewport(glState, 0, 0, cascadeSettings.resolution, cascadeSettings.resolution);
+        uint64_t transformsStart = BeginCpuZone();
 
-        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-        glClear(GL_DEPTH_BUFFER_BIT);
+        DrawPacket packet;
 
         glm::mat4 planeTransform = glm::mat4(1.0f);
         glm::mat4 cabinetTransform = glm::mat4(1.0f);
@@ -1023,145 +1386,148 @@ int main()
         
         cabinetTransform = glm::translate(cabinetTransform, glm::vec3(3.f, -4.f, -4.f));
         cabinetTransform = glm::scale(cabinetTransform, glm::vec3(2.f, 2.f, 2.f));
-        glUniformMatrix4fv(modelUniformLocation, 1, GL_FALSE, glm::value_ptr(cabinetTransform));
-        glDrawArrays(GL_TRIANGLES, 6, 36);
-
 
         midLampTransform = glm::translate(midLampTransform, glm::vec3(3.f, -2.5f, -4.f));
         midLampTransform = glm::scale(midLampTransform, glm::vec3(0.05f, 1.f, 0.05f));
-        glUniformMatrix4fv(modelUniformLocation, 1, GL_FALSE, glm::value_ptr(midLampTransform));
-        glDrawArrays(GL_TRIANGLES, 6, 36);
-
 
         botLampTransform = glm::translate(botLampTransform, glm::vec3(3.f, -3.f, -4.f));
         botLampTransform = glm::scale(botLampTransform, glm::vec3(0.5f, 0.3f, 0.5f));
-        glUniformMatrix4fv(modelUniformLocation, 1, GL_FALSE, glm::value_ptr(botLampTransform));
-        glDrawArrays(GL_TRIANGLES, 6, 36);
-
 
         bedTransform = glm::translate(bedTransform, glm::vec3(-2.4f, -4.6f, -4.f));
         bedTransform = glm::scale(bedTransform, glm::vec3(3.f, 3.7f, 3.f));
 
-        glUniformMatrix4fv(modelUniformLocation, 1, GL_FALSE, glm::value_ptr(bedTransform));
-        //bedtop
-        glDrawArrays(GL_TRIANGLES, 60, 36);
-        //bedbelow
         belowBed = glm::translate(belowBed, glm::vec3(-2.4f, -4.5f, -4.f));
         belowBed = glm::scale(belowBed, glm::vec3(3.f, 3.2f, 3.f));
-        glUniformMatrix4fv(modelUniformLocation, 1, GL_FALSE, glm::value_ptr(belowBed));
-        glDrawArrays(GL_TRIANGLES, 96, 36);
 
-        xRot += 0.5f;
+        glm::vec3 movingFacePosition = sim.movingFacePosition;
+        float xRot = sim.movingFaceAngle;
         movingFace = glm::translate(movingFace, movingFacePosition);
         movingFace = glm::scale(movingFace, glm::vec3(1.f, 1.f, 1.f));
         movingFace = glm::rotate(movingFace, glm::radians(xRot), glm::vec3(0.f, 1.0f, 0.f));
 
-        glUniformMatrix4fv(modelUniformLocation, 1, GL_FALSE, glm::value_ptr(movingFace));
-        glDrawArrays(GL_TRIANGLES, 150, 36);
-
         sims = glm::translate(sims, movingFacePosition + glm::vec3(0.f, 2.f, 0.f));
         sims = glm::scale(sims, glm::vec3(0.5f,0.5f,0.5f));
         sims = glm::rotate(sims, glm::radians(xRot), glm::vec3(0.f, 1.f, 0.f));
-        /*glUniformMatrix4fv(modelUniformLocation, 1, GL_FALSE, glm::value_ptr(sims));
-        glDrawArrays(GL_TRIANGLES, 132, 18);*/
 
         simsBelow = glm::translate(simsBelow, movingFacePosition + glm::vec3(0.f, 1.5f, 0.f));
         simsBelow = glm::scale(simsBelow, glm::vec3(0.5f, 0.5f, 0.5f));
         simsBelow = glm::rotate(simsBelow, glm::radians(180.f), glm::vec3(1.f, 0.f, 0.f));
         simsBelow = glm::rotate(simsBelow, glm::radians(xRot), glm::vec3(0.f, -1.f, 0.f));
-        /*glUniformMatrix4fv(modelUniformLocation, 1, GL_FALSE, glm::value_ptr(simsBelow));
-        glDrawArrays(GL_TRIANGLES, 132, 18);*/
-
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glViewport(0, 0, windowWidth, windowHeight);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-#pragma endregion
-
-#pragma region secondpass
-        //Use Shader Program
-        glUseProgram(program);
-
-        // Use the vertex array object that we created
-        glBindVertexArray(vao);
-
-        GLint texUniformLocation = glGetUniformLocation(program, "tex");
-        glUniform1i(texUniformLocation, 0);
-
-        GLint bumpLoc = glGetUniformLocation(program, "bump");
-        glUniform1i(bumpLoc, 1);
-
-        GLint matUniformLocation = glGetUniformLocation(program, "transformationMatrix");
-
-        GLint shadowMapTexUnifLocation = glGetUniformLocation(framebufferTex, "shadowMap");
-        glUniform1i(shadowMapTexUnifLocation, 1);
-
-        GLint viewUniformLocation = glGetUniformLocation(program, "view");
-        glUniformMatrix4fv(viewUniformLocation, 1, GL_FALSE, glm::value_ptr(view));
-
-        GLint projectionUniformLocation = glGetUniformLocation(program, "projection");
-        glUniformMatrix4fv(projectionUniformLocation, 1, GL_FALSE, glm::value_ptr(projection));
-
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, framebufferTex);
-
-
-        planeTransform = glm::rotate(planeTransform, glm::radians(0.0f), glm::vec3(0.f, 1.0f, 0.0f));
-        planeTransform = glm::scale(planeTransform, glm::vec3(10.0f, 10.0f, 10.0f));
-
-        glActiveTexture(GL_TEXTURE0 + 1);
-        glBindTexture(GL_TEXTURE_2D, tex6);
-        glUniformMatrix4fv(matUniformLocation, 1, GL_FALSE, glm::value_ptr(planeTransform));
-
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        glBindTexture(GL_TEXTURE_2D, tex1);
-
-        glActiveTexture(GL_TEXTURE0);
-
-        glBindTexture(GL_TEXTURE_2D, tex1);
-
-        glUniformMatrix4fv(matUniformLocation, 1, GL_FALSE, glm::value_ptr(cabinetTransform));
-        glDrawArrays(GL_TRIANGLES, 6, 36);
-
-
-        glBindTexture(GL_TEXTURE_2D, tex2);
-        glUniformMatrix4fv(matUniformLocation, 1, GL_FALSE, glm::value_ptr(midLampTransform));
-        glDrawArrays(GL_TRIANGLES, 6, 36);
-
-        glBindTexture(GL_TEXTURE_2D, tex2);
-
-        glUniformMatrix4fv(matUniformLocation, 1, GL_FALSE, glm::value_ptr(botLampTransform));
-        glDrawArrays(GL_TRIANGLES, 6, 36);
-
+        EndCpuZone("Transform building", transformsStart);
+
+        // The furniture never moves. With enough of it, its depth is rendered once into a box of its own
+        // and carried into the cascades every frame; a few pieces cost less to draw again with the moving
+        // casters. Shadow casters go through queues of their own, so casters sharing a mesh are drawn instanced.
+        staticCasterBounds.clear();
+        staticCasterBounds.push_back(TransformBounds(cabinetTransform, cubeBounds));
+        staticCasterBounds.push_back(TransformBounds(midLampTransform, cubeBounds));
+        staticCasterBounds.push_back(TransformBounds(botLampTransform, cubeBounds));
+        staticCasterBounds.push_back(TransformBounds(bedTransform, bedTopBounds));
+        staticCasterBounds.push_back(TransformBounds(belowBed, bedBelowBounds));
+        for (const glm::mat4& stressTransform : stressTransforms)
+        {
+            staticCasterBounds.push_back(TransformBounds(stressTransform, cubeBounds));
+        }
+        bool staticShadowsCached = static_cast<int>(staticCasterBounds.size()) >= cascadeSettings.staticCacheCasters;
+        if (staticShadowsCached && staticShadows.texture == 0)
+        {
+            // Created the first time it is used, behind the state cache's back
+            staticShadows = CreateStaticShadowCache(cascadeSettings, shadowCompositeShader);
+            InvalidateGLState(glState);
+        }
+        glm::mat4 staticLightSpace = FitStaticShadows(shadowLightDirection, staticCasterBounds);
+        bool staticShadowsDirty = staticShadowsCached && StaticShadowsDirty(staticShadows, staticLightSpace);
+        ClearDrawQueue(shadowQueue);
+        if (!staticShadowsCached || staticShadowsDirty)
+        {
+            DrawQueue& staticQueue = staticShadowsCached ? staticShadowQueue : shadowQueue;
+            ClearDrawQueue(staticQueue);
+
+            packet = MakeInstancedDrawPacket(RenderPass::Opaque, depthShader, depthUniforms, depthVAO, { GL_TEXTURE_2D, 0, 0 }, cabinetTransform, cubeMesh);
+            SubmitDraw(staticQueue, packet, ViewDepth(dirLightViewMat, cabinetTransform), kShadowSortDistance);
+            packet = MakeInstancedDrawPacket(RenderPass::Opaque, depthShader, depthUniforms, depthVAO, { GL_TEXTURE_2D, 0, 0 }, midLampTransform, cubeMesh);
+            SubmitDraw(staticQueue, packet, ViewDepth(dirLightViewMat, midLampTransform), kShadowSortDistance);
+            packet = MakeInstancedDrawPacket(RenderPass::Opaque, depthShader, depthUniforms, depthVAO, { GL_TEXTURE_2D, 0, 0 }, botLampTransform, cubeMesh);
+            SubmitDraw(staticQueue, packet, ViewDepth(dirLightViewMat, botLampTransform), kShadowSortDistance);
+            //bedtop
+            packet = MakeInstancedDrawPacket(RenderPass::Opaque, depthShader, depthUniforms, depthVAO, { GL_TEXTURE_2D, 0, 0 }, bedTransform, bedTopMesh);
+            SubmitDraw(staticQueue, packet, ViewDepth(dirLightViewMat, bedTransform), kShadowSortDistance);
+            //bedbelow
+            packet = MakeInstancedDrawPacket(RenderPass::Opaque, depthShader, depthUniforms, depthVAO, { GL_TEXTURE_2D, 0, 0 }, belowBed, bedBelowMesh);
+            SubmitDraw(staticQueue, packet, ViewDepth(dirLightViewMat, belowBed), kShadowSortDistance);
+            for (const glm::mat4& stressTransform : stressTransforms)
+            {
+                packet = MakeInstancedDrawPacket(RenderPass::Opaque, depthShader, depthUniforms, depthVAO, { GL_TEXTURE_2D, 0, 0 }, stressTransform, cubeMesh);
+                SubmitDraw(staticQueue, packet, ViewDepth(dirLightViewMat, stressTransform), kShadowSortDistance);
+            }
+        }
 
-        glBindTexture(GL_TEXTURE_2D, tex3);
+        packet = MakeInstancedDrawPacket(RenderPass::Opaque, depthShader, depthUniforms, depthVAO, { GL_TEXTURE_2D, 0, 0 }, movingFace, faceMesh);
+        SubmitDraw(shadowQueue, packet, ViewDepth(dirLightViewMat, movingFace), kShadowSortDistance);
 
-        glUniformMatrix4fv(matUniformLocation, 1, GL_FALSE, glm::value_ptr(bedTransform));
-        //bedtop
-        glDrawArrays(GL_TRIANGLES, 60, 36);
-        glBindTexture(GL_TEXTURE_2D, tex2);
-        //bedbelow
-
-    
-        glUniformMatrix4fv(matUniformLocation, 1, GL_FALSE, glm::value_ptr(belowBed));
-        glDrawArrays(GL_TRIANGLES, 96, 36);
+        /*SetUniform(depthUniforms, Uniform::Model, sims);
+        glDrawArrays(GL_TRIANGLES, 132, 18);*/
 
+        /*SetUniform(depthUniforms, Uniform::Model, simsBelow);
+        glDrawArrays(GL_TRIANGLES, 132, 18);*/
 
-        glBindTexture(GL_TEXTURE_2D, tex7);
-        glUniformMatrix4fv(matUniformLocation, 1, GL_FALSE, glm::value_ptr(sims));
+        // --shadow-timing times the same steps as always, only one at a time
+        ShadowTimer* stepTimer = cascadeSettings.timePerCascade ? &shadowTimer : nullptr;
+        if (stepTimer == nullptr)
+        {
+            BeginShadowTimer(shadowTimer, 0);
+        }
+        if (staticShadowsDirty)
+        {
+            BeginShadowTimer(stepTimer, 0);
+            BeginStaticShadows(glState, staticShadows);
+            UseProgram(glState, depthShader);
+            SetUniform(depthUniforms, Uniform::CascadeRange, glm::ivec2(0, 0));
+            SetUniform(depthUniforms, Uniform::CacheLightSpace, staticLightSpace);
+            FlushDrawQueue(staticShadowQueue, glState);
+            MarkStaticShadowsRendered(staticShadows, staticLightSpace);
+            EndShadowTimer(stepTimer);
+        }
 
-        glDrawArrays(GL_TRIANGLES, 132, 18);
-        glUniformMatrix4fv(matUniformLocation, 1, GL_FALSE, glm::value_ptr(simsBelow));
-        glDrawArrays(GL_TRIANGLES, 132, 18);
+        // Start the frame's shadow map from the static depth, or from nothing if it is drawn below
+        if (staticShadowsCached)
+        {
+            CompositeStaticShadows(glState, staticShadows, cascades, shadowMap, stepTimer);
+        }
+        else
+        {
+            BindFramebuffer(glState, shadowMap.framebuffer);
+            Viewport(glState, 0, 0, shadowMap.resolution, shadowMap.resolution);
+            glClear(GL_DEPTH_BUFFER_BIT);
+        }
+        UseProgram(glState, depthShader);
+        if (stepTimer == nullptr)
+        {
+            // All cascades at once: depth.gsh copies every triangle into each layer
+            SetUniform(depthUniforms, Uniform::CascadeRange, glm::ivec2(0, cascades.count));
+            FlushDrawQueue(shadowQueue, glState);
+            EndShadowTimer();
+        }
+        else
+        {
+            for (int i = 0; i < cascades.count; i++)
+            {
+                BeginShadowTimer(shadowTimer, CasterShadowQuery(i));
+                SetUniform(depthUniforms, Uniform::CascadeRange, glm::ivec2(i, 1));
+                FlushDrawQueue(shadowQueue, glState);
+                EndShadowTimer();
+            }
+        }
+        AdvanceShadowTimer(shadowTimer, cascadeSettings, staticShadowsCached, staticShadowsDirty, std::cout);
+        EndGpuScope(&gpuProfiler);
 
-       
+        BindFramebuffer(glState, sceneFramebuffer);
+        Viewport(glState, 0, 0, windowWidth, windowHeight);
+        BeginGpuScope(&gpuProfiler, "Main pass");
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        //LIGHTS
-        float constant = 1.0f;
-        float linear = 0.14f;
-        float quadratic = 0.07f;
-        float materialShininess = 32.f;
 #pragma endregion
+
 #pragma region LIGHT_1
 
         //light
@@ -1169,35 +1535,13 @@ int main()
         Light light = {  };
         //glm::vec3 lightColor;
 
-        int spaceBarState = glfwGetKey(window, GLFW_KEY_SPACE);
-        timeout += 0.1;
-        if (spaceBarState == GLFW_PRESS && timeout > 40) {
-            timeout = 0;
-            if (night == false) {
-                night = true;
-            }
-            else {
-                night = false;
-
-            }
-        }
-        if (night == true) {
+        if (sim.night == true) {
             light.lightColor = glm::vec3(0.2f, 1.0f, 1.0f);
             light.diffuseColor = light.lightColor * glm::vec3(0.5f);
             light.ambientColor = light.diffuseColor * glm::vec3(0.5f);
-            canChange = true;
         }
         else {
-            if (canChange) {
-              
-                lightColorX = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-                lightColorY = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-                lightColorZ = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-            }
-            canChange = false;
-         
-          
-            light.lightColor = glm::vec3(lightColorX, lightColorY, lightColorZ);
+            light.lightColor = sim.dayLightColor;
             light.diffuseColor = light.lightColor * glm::vec3(1.f);
             light.ambientColor = light.diffuseColor * glm::vec3(1.f);
         }
@@ -1207,26 +1551,6 @@ int main()
 
         light.materialDiffuse = glm::vec3(1.f, 0.5f, 0.31f);
         light.materialSpecular = glm::vec3(0.5f, 0.5f, 0.5f);
-        GLint lightUniformDirection = glGetUniformLocation(program, "light.direction");
-
-
-        glUniform3fv(lightUniformDirection, 1, glm::value_ptr(light.lightDirection));
-        GLint lightUniformAmbient = glGetUniformLocation(program, "light.ambient");
-        glUniform3fv(lightUniformAmbient, 1, glm::value_ptr(light.ambientColor));
-        GLint lightUniformDiffuse = glGetUniformLocation(program, "light.diffuse");
-        glUniform3fv(lightUniformDiffuse, 1, glm::value_ptr(light.diffuseColor));
-        GLint lightUniformSpecular = glGetUniformLocation(program, "light.specular");
-        glUniform3fv(lightUniformSpecular, 1, glm::value_ptr(light.specular));
-
-
-        GLint materialUniformAmbient = glGetUniformLocation(program, "material.ambient");
-        glUniform3fv(materialUniformAmbient, 1, glm::value_ptr(light.materialAmbient));
-        GLint materialUniformDiffuse = glGetUniformLocation(program, "material.diffuse");
-        glUniform3fv(materialUniformDiffuse, 1, glm::value_ptr(light.materialDiffuse));
-        GLint materialUniformSpecular = glGetUniformLocation(program, "material.specular");
-        glUniform3fv(materialUniformSpecular, 1, glm::value_ptr(light.materialSpecular));
-        GLint materialUniformShininess = glGetUniformLocation(program, "material.shininess");
-        glUniform1f(materialUniformShininess, materialShininess);
 
 #pragma endregion
 
@@ -1235,141 +1559,310 @@ int main()
         //Point
         // 2nd light
         light2.lightPos = glm::vec3(3.f, -2.f, -4.f);
-        light2.lightColor.x = sin(glfwGetTime() * 2.0f);
-        light2.lightColor.y = sin(glfwGetTime() * 0.7f);
-        light2.lightColor.z = sin(glfwGetTime() * 1.3f);
+        light2.lightColor.x = sin(sim.lightTime * 2.0f);
+        light2.lightColor.y = sin(sim.lightTime * 0.7f);
+        light2.lightColor.z = sin(sim.lightTime * 1.3f);
         light2.diffuseColor = light2.lightColor * glm::vec3(0.5f);
         light2.ambientColor = light2.diffuseColor * glm::vec3(0.2f);
         light2.specular = glm::vec3(1.f, 1.f, 1.f);
-        light2.lightDirection = glm::vec3(1.2f, 0.0f, 3.0f);
-        light2.materialAmbient = glm::vec3(1.f, 0.5f, 0.31f);
-        light2.materialDiffuse = glm::vec3(1.f, 0.5f, 0.31f);
-        light2.materialSpecular = glm::vec3(0.5f, 0.5f, 0.5f);
 
+        // The lamp is just the first entry of the frame's point light list
+        ClearLightList(lightList);
+        PointLight lamp;
+        lamp.position = light2.lightPos;
+        lamp.ambient = light2.ambientColor;
+        lamp.diffuse = light2.diffuseColor;
+        lamp.specular = light2.specular;
+        lamp.constant = 1.0f;
+        lamp.linear = 0.14f;
+        lamp.quadratic = 0.07f;
+        AddPointLight(lightList, lamp);
+
+        if (lightBenchmark.running)
+        {
+            AddBenchmarkLights(lightList, lightBenchmark.lightCount);
+        }
+
+#pragma endregion
+
+#pragma region secondpass
+        planeTransform = glm::rotate(planeTransform, glm::radians(0.0f), glm::vec3(0.f, 1.0f, 0.0f));
+        planeTransform = glm::scale(planeTransform, glm::vec3(10.0f, 10.0f, 10.0f));
+
+        // Work out which point lights reach which object, then upload the whole list at once
+        glm::ivec2 planeLights = GatherLights(lightList, TransformBounds(planeTransform, planeBounds));
+        glm::ivec2 cabinetLights = GatherLights(lightList, TransformBounds(cabinetTransform, cubeBounds));
+        glm::ivec2 midLampLights = GatherLights(lightList, TransformBounds(midLampTransform, cubeBounds));
+        glm::ivec2 botLampLights = GatherLights(lightList, TransformBounds(botLampTransform, cubeBounds));
+        glm::ivec2 bedLights = GatherLights(lightList, TransformBounds(bedTransform, bedTopBounds));
+        glm::ivec2 belowBedLights = GatherLights(lightList, TransformBounds(belowBed, bedBelowBounds));
+        glm::ivec2 simsLights = GatherLights(lightList, TransformBounds(sims, pyramidBounds));
+        glm::ivec2 simsBelowLights = GatherLights(lightList, TransformBounds(simsBelow, pyramidBounds));
+        glm::ivec2 movingFaceLights = GatherLights(lightList, TransformBounds(movingFace, faceBounds));
+        stressLights.clear();
+        for (const glm::mat4& stressTransform : stressTransforms)
+        {
+            stressLights.push_back(GatherLights(lightList, TransformBounds(stressTransform, cubeBounds)));
+        }
 
+        // Textures of objects in view stay at full size, or stream back to it; unit 1's texture is everyone's bump map.
+        // The handles are resolved every frame, as the residency may replace what is behind them.
+        glm::mat4 viewProjection = projection * view;
+        BeginTextureFrame(textureResidency);
+        MarkTextureVisible(textureResidency, cabinetTexture, true);
+        MarkTextureVisible(textureResidency, skyboxTexture, true);
+        MarkTextureVisible(textureResidency, tilesTexture, SphereInFrustum(viewProjection, TransformBounds(planeTransform, planeBounds)));
+        MarkTextureVisible(textureResidency, woodTexture, SphereInFrustum(viewProjection, TransformBounds(midLampTransform, cubeBounds))
+            || SphereInFrustum(viewProjection, TransformBounds(botLampTransform, cubeBounds))
+            || SphereInFrustum(viewProjection, TransformBounds(belowBed, bedBelowBounds)));
+        MarkTextureVisible(textureResidency, bedTopTexture, SphereInFrustum(viewProjection, TransformBounds(bedTransform, bedTopBounds)));
+        MarkTextureVisible(textureResidency, simsTexture, SphereInFrustum(viewProjection, TransformBounds(sims, pyramidBounds))
+            || SphereInFrustum(viewProjection, TransformBounds(simsBelow, pyramidBounds)));
+        MarkTextureVisible(textureResidency, faceTopTexture, SphereInFrustum(viewProjection, TransformBounds(movingFace, faceBounds)));
+        GLuint tex1 = ResidentTexture(textureResidency, cabinetTexture);
+        GLuint tex2 = ResidentTexture(textureResidency, woodTexture);
+        GLuint tex3 = ResidentTexture(textureResidency, bedTopTexture);
+        GLuint tex6 = ResidentTexture(textureResidency, tilesTexture);
+        GLuint tex7 = ResidentTexture(textureResidency, simsTexture);
+        GLuint tex8 = ResidentTexture(textureResidency, faceTopTexture);
+        GLuint skyboxTex = ResidentTexture(textureResidency, skyboxTexture);
+
+        uint64_t uniformUploadStart = BeginCpuZone();
+        UploadLightList(lightList);
+        BindLightList(glState, lightList);
 
-        GLint light2UniformLocation = glGetUniformLocation(program, "plight.position");
+        float materialShininess = 32.f;
 
-        glUniform3fv(light2UniformLocation, 1, glm::value_ptr(light2.lightPos));
-        GLint light2UniformDirection = glGetUniformLocation(program, "plight.direction");
+        //Use Shader Program
+        UseProgram(glState, program);
 
-        glUniform3fv(light2UniformDirection, 1, glm::value_ptr(light2.lightDirection));
-        GLint light2UniformAmbient = glGetUniformLocation(program, "plight.ambient");
-        glUniform3fv(light2UniformAmbient, 1, glm::value_ptr(light2.ambientColor));
-        GLint light2UniformDiffuse = glGetUniformLocation(program, "plight.diffuse");
-        glUniform3fv(light2UniformDiffuse, 1, glm::value_ptr(light2.diffuseColor));
-        GLint light2UniformSpecular = glGetUniformLocation(program, "plight.specular");
-        glUniform3fv(light2UniformSpecular, 1, glm::value_ptr(light2.specular));
+        SetUniform(programUniforms, Uniform::LightDirection, light.lightDirection);
+        SetUniform(programUniforms, Uniform::LightAmbient, light.ambientColor);
+        SetUniform(programUniforms, Uniform::LightDiffuse, light.diffuseColor);
+        SetUniform(programUniforms, Uniform::LightSpecular, light.specular);
 
+        SetUniform(programUniforms, Uniform::MaterialAmbient, light.materialAmbient);
+        SetUniform(programUniforms, Uniform::MaterialDiffuse, light.materialDiffuse);
+        SetUniform(programUniforms, Uniform::MaterialSpecular, light.materialSpecular);
+        SetUniform(programUniforms, Uniform::MaterialShininess, materialShininess);
 
+        UseProgram(glState, lightShader);
+        SetUniform(lightUniforms, Uniform::LightColor, light2.lightColor);
+        EndCpuZone("Uniform uploads", uniformUploadStart);
 
-        glUniform3fv(materialUniformAmbient, 1, glm::value_ptr(light2.materialAmbient));
-        glUniform3fv(materialUniformDiffuse, 1, glm::value_ptr(light2.materialDiffuse));
-        glUniform3fv(materialUniformSpecular, 1, glm::value_ptr(light2.materialSpecular));
-        glUniform1f(materialUniformShininess, materialShininess);
+        BindTexture(glState, 2, GL_TEXTURE_2D_ARRAY, shadowMap.texture);
 
-        GLint pointConstantUniform = glGetUniformLocation(program, "plight.constant");
-        glUniform1f(pointConstantUniform, constant);
-        GLint pointLinearUniform = glGetUniformLocation(program, "plight.linear");
-        glUniform1f(pointLinearUniform, linear);
-        GLint pointQuadraticUniform = glGetUniformLocation(program, "plight.quadratic");
-        glUniform1f(pointQuadraticUniform, quadratic);
+        // Record every draw of the main framebuffer, then let the queue sort them by state.
+        // Unit 1 is the bump map: the plane uses its own texture there, everything else uses tex1.
+        ClearDrawQueue(drawQueue);
 
-#pragma endregion
+        packet = MakeInstancedDrawPacket(RenderPass::Opaque, program, programUniforms, vao, { GL_TEXTURE_2D, tex6, tex6 },
+            planeTransform, planeMesh);
+        packet.lightRange = planeLights;
+        SubmitDraw(drawQueue, packet, ViewDepth(view, planeTransform), kFarPlane);
 
-        glBindVertexArray(lightVAO);
-        glUseProgram(lightShader);
-        GLint matLightUniformLocation = glGetUniformLocation(lightShader, "transformationMatrix");
+        packet = MakeInstancedDrawPacket(RenderPass::Opaque, program, programUniforms, vao, { GL_TEXTURE_2D, tex1, tex1 },
+            cabinetTransform, cubeMesh);
+        packet.lightRange = cabinetLights;
+        SubmitDraw(drawQueue, packet, ViewDepth(view, cabinetTransform), kFarPlane);
 
-        GLint viewLightUniformLocation = glGetUniformLocation(lightShader, "view");
-        glUniformMatrix4fv(viewLightUniformLocation, 1, GL_FALSE, glm::value_ptr(view));
+        packet = MakeInstancedDrawPacket(RenderPass::Opaque, program, programUniforms, vao, { GL_TEXTURE_2D, tex2, tex1 },
+            midLampTransform, cubeMesh);
+        packet.lightRange = midLampLights;
+        SubmitDraw(drawQueue, packet, ViewDepth(view, midLampTransform), kFarPlane);
 
-        GLint projectionLightUniformLocation = glGetUniformLocation(lightShader, "projection");
-        glUniformMatrix4fv(projectionLightUniformLocation, 1, GL_FALSE, glm::value_ptr(projection));
+        packet = MakeInstancedDrawPacket(RenderPass::Opaque, program, programUniforms, vao, { GL_TEXTURE_2D, tex2, tex1 },
+            botLampTransform, cubeMesh);
+        packet.lightRange = botLampLights;
+        SubmitDraw(drawQueue, packet, ViewDepth(view, botLampTransform), kFarPlane);
 
+        //bedtop
+        packet = MakeInstancedDrawPacket(RenderPass::Opaque, program, programUniforms, vao, { GL_TEXTURE_2D, tex3, tex1 },
+            bedTransform, bedTopMesh);
+        packet.lightRange = bedLights;
+        SubmitDraw(drawQueue, packet, ViewDepth(view, bedTransform), kFarPlane);
 
-        GLint light2ColorLocation = glGetUniformLocation(lightShader, "lightColor");
-        glUniform3fv(light2ColorLocation, 1, glm::value_ptr(light2.lightColor));
+        //bedbelow
+        packet = MakeInstancedDrawPacket(RenderPass::Opaque, program, programUniforms, vao, { GL_TEXTURE_2D, tex2, tex1 },
+            belowBed, bedBelowMesh);
+        packet.lightRange = belowBedLights;
+        SubmitDraw(drawQueue, packet, ViewDepth(view, belowBed), kFarPlane);
+
+        packet = MakeInstancedDrawPacket(RenderPass::Opaque, program, programUniforms, vao, { GL_TEXTURE_2D, tex7, tex1 },
+            sims, pyramidMesh);
+        packet.lightRange = simsLights;
+        SubmitDraw(drawQueue, packet, ViewDepth(view, sims), kFarPlane);
+
+        packet = MakeInstancedDrawPacket(RenderPass::Opaque, program, programUniforms, vao, { GL_TEXTURE_2D, tex7, tex1 },
+            simsBelow, pyramidMesh);
+        packet.lightRange = simsBelowLights;
+        SubmitDraw(drawQueue, packet, ViewDepth(view, simsBelow), kFarPlane);
+
+        for (size_t i = 0; i < stressTransforms.size(); i++)
+        {
+            packet = MakeInstancedDrawPacket(RenderPass::Opaque, program, programUniforms, vao, { GL_TEXTURE_2D, tex1, tex1 },
+                stressTransforms[i], cubeMesh);
+            packet.lightRange = stressLights[i];
+            SubmitDraw(drawQueue, packet, ViewDepth(view, stressTransforms[i]), kFarPlane);
+        }
 
+#pragma endregion
 
         glm::mat4 topLampTransform = glm::mat4(1.0f);
         topLampTransform = glm::scale(topLampTransform, glm::vec3(0.8f, 0.8f, 0.8f));
         topLampTransform = glm::translate(topLampTransform, glm::vec3(3.75f, -2.5f, -5.f));
-        glUniformMatrix4fv(matLightUniformLocation, 1, GL_FALSE, glm::value_ptr(topLampTransform));
-
-        glDrawArrays(GL_TRIANGLES, 132, 18);
+        packet = MakeDrawPacket(RenderPass::Opaque, lightShader, lightUniforms, lightVAO, { GL_TEXTURE_2D, 0, 0 },
+            Uniform::TransformationMatrix, topLampTransform, pyramidMesh);
+        SubmitDraw(drawQueue, packet, ViewDepth(view, topLampTransform), kFarPlane);
 
 #pragma region reflection
         //REFLECTION
-        glUseProgram(reflectShader);
-        GLint cameraUniformLocation = glGetUniformLocation(reflectShader, "cameraPos");
-        glUniform3fv(cameraUniformLocation, 1, glm::value_ptr(cameraPos));
-        GLint modelRefLocation = glGetUniformLocation(reflectShader, "model");
-
-        GLint cubeViewUniformLocation = glGetUniformLocation(reflectShader, "view");
-        glUniformMatrix4fv(cubeViewUniformLocation, 1, GL_FALSE, glm::value_ptr(view));
-
-        GLint cubeProjectionUniformLocation = glGetUniformLocation(reflectShader, "projection");
-        glUniformMatrix4fv(cubeProjectionUniformLocation, 1, GL_FALSE, glm::value_ptr(projection));
-
-
-
-        GLint skyboxTexUniformLocation = glGetUniformLocation(reflectShader, "skybox");
-        glUniform1i(skyboxTexUniformLocation, 0);
-
-
-        glBindVertexArray(reflectVAO);
+        // The four sides are consecutive, so they go out as one draw
+        packet = MakeDrawPacket(RenderPass::Reflection, reflectShader, reflectUniforms, reflectVAO, { GL_TEXTURE_CUBE_MAP, skyboxTex, 0 },
+            Uniform::Model, movingFace, faceSidesMesh);
+        SubmitDraw(drawQueue, packet, ViewDepth(view, movingFace), kFarPlane);
+
+        packet = MakeInstancedDrawPacket(RenderPass::Opaque, program, programUniforms, vao, { GL_TEXTURE_2D, tex8, tex1 },
+            movingFace, faceTopMesh);
+        packet.lightRange = movingFaceLights;
+        SubmitDraw(drawQueue, packet, ViewDepth(view, movingFace), kFarPlane);
+
+        packet = MakeDrawPacket(RenderPass::Reflection, reflectShader, reflectUniforms, reflectVAO, { GL_TEXTURE_CUBE_MAP, skyboxTex, 0 },
+            Uniform::Model, movingFace, faceBottomMesh);
+        SubmitDraw(drawQueue, packet, ViewDepth(view, movingFace), kFarPlane);
+#pragma endregion
 
+        // SKYBOX
+        packet = MakeDrawPacket(RenderPass::Skybox, skyboxShader, skyboxUniforms, skyboxVAO, { GL_TEXTURE_CUBE_MAP, skyboxTex, 0 },
+            Uniform::Model, glm::mat4(1.0f), skyboxMesh);
+        SubmitDraw(drawQueue, packet, kFarPlane, kFarPlane);
+
+        uint64_t flushStart = BeginCpuZone();
+        FlushDrawQueue(drawQueue, glState, &gpuProfiler);
+        EndCpuZone("Draw queue flush", flushStart);
+        BindVertexArray(glState, 0);
+        EndGpuScope(&gpuProfiler);
+
+        // Last, over everything else: the stats of the frame before, as this one's are still being counted
+        if (statsOverlay.visible)
+        {
+            GpuScope overlayScope(&gpuProfiler, "Overlay");
+            DrawStatsOverlay(statsOverlay, glState, LastRenderStats(), windowWidth, windowHeight);
+        }
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTex);
+        if (!vertexFormatReported)
+        {
+            // Every pass used to stride through the whole interleaved vertex. Cached static casters are
+            // only drawn on the frames their cache is rendered, and timing per cascade draws the others once per cascade.
+            size_t depthFlushes = cascadeSettings.timePerCascade ? cascades.count : 1;
+            size_t fetched[] = {
+                DrawnVertexCount(shadowQueue, depthVAO) * depthFlushes + (staticShadowsDirty ? DrawnVertexCount(staticShadowQueue, depthVAO) : 0),
+                DrawnVertexCount(drawQueue, vao),
+                DrawnVertexCount(drawQueue, reflectVAO),
+                DrawnVertexCount(drawQueue, lightVAO) + DrawnVertexCount(drawQueue, skyboxVAO)
+            };
+            VertexFetchCost costs[] = {
+                { sizeof(Vertex), sizeof(PackedPosition) },
+                { sizeof(Vertex), sizeof(PackedPosition) + sizeof(PackedAttributes) },
+                { sizeof(Vertex), sizeof(PackedPosition) + sizeof(PackedAttributes::nx) + sizeof(PackedAttributes::ny) },
+                { sizeof(Vertex), sizeof(PackedPosition) }
+            };
+            ReportVertexFormat(std::cout, packedPositions.size(), sizeof(Vertex), fetched, costs, 4);
+            vertexFormatReported = true;
+        }
 
-        glUniformMatrix4fv(modelRefLocation, 1, GL_FALSE, glm::value_ptr(movingFace));
+        // Shown by the overlay and written to the benchmark report rather than logged every time they change
+        CountSortedStateChanges(TotalStateChanges(drawQueue.submittedOrder), TotalStateChanges(drawQueue.sortedOrder));
+        CountGLStateCalls(glState.counters.issued, glState.counters.elided);
 
-        glDrawArrays(GL_TRIANGLES, 150, 6);
-        glDrawArrays(GL_TRIANGLES, 156, 6);
-        glDrawArrays(GL_TRIANGLES, 162, 6);
-        glDrawArrays(GL_TRIANGLES, 168, 6);
+        if (UniformLookupCounter() != 0)
+        {
+            std::cerr << "Warning: " << UniformLookupCounter() << " uniform lookups in the render loop" << std::endl;
+        }
 
-        glUseProgram(program);
-        glBindVertexArray(vao);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, tex8);
+        EndGpuScope(&gpuProfiler);
+        EndGpuFrame(gpuProfiler);
+        EndRenderStatsFrame(LatestGpuScopeMilliseconds(gpuProfiler, "Frame"));
 
-        glUniformMatrix4fv(matUniformLocation, 1, GL_FALSE, glm::value_ptr(movingFace));
-        glDrawArrays(GL_TRIANGLES, 174, 6);
-        glUseProgram(reflectShader);
-        glUniformMatrix4fv(modelRefLocation, 1, GL_FALSE, glm::value_ptr(movingFace));
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTex);
-        glDrawArrays(GL_TRIANGLES, 180, 6);
-#pragma endregion
+        // The back buffer has to be read before it is swapped
+        if (!offscreen)
+        {
+            FinishScreenshots(screenshots, false);
+            CaptureScreenshotFrame(screenshots, glState);
+            if (screenshots.remaining != 0)
+            {
+                MarkFrameDirty(framePacer);
+            }
+        }
 
-        // SKYBOX
-        glDepthFunc(GL_LEQUAL); // disables depth so always at background
-        glUseProgram(skyboxShader);
-        view = glm::mat4(glm::mat3(view));
-        GLint viewSkyUniformLocation = glGetUniformLocation(skyboxShader, "view");
-        glUniformMatrix4fv(viewSkyUniformLocation, 1, GL_FALSE, glm::value_ptr(view));
-
-        GLint projectionSkyUniformLocation = glGetUniformLocation(skyboxShader, "projection");
-        glUniformMatrix4fv(projectionSkyUniformLocation, 1, GL_FALSE, glm::value_ptr(projection));
-        
-        glBindVertexArray(skyboxVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTex);
-        glDrawArrays(GL_TRIANGLES, 186, 36);
+        // Tell GLFW to swap the screen buffer with the offscreen buffer
+        glfwSwapBuffers(window);
+        ReportSimulationClock(simulationClock, std::cout);
+        ReportGpuProfiler(gpuProfiler, std::cout);
 
+        if (benchmark.running)
+        {
+            if (!EndBenchmarkFrame(benchmark, LastRenderStats()))
+            {
+                glfwSetWindowShouldClose(window, GLFW_TRUE);
+            }
+        }
 
+        if (sequencing && !EndSequenceFrame(sequence, glState, sceneFramebuffer))
+        {
+            glfwSetWindowShouldClose(window, GLFW_TRUE);
+        }
 
-        glBindVertexArray(0);
-        glDepthFunc(GL_LESS);  // set depth function back to default
+        if (golden.running)
+        {
+            CaptureGoldenFrame(golden, glState, sceneFramebuffer);
+            if (FinishGoldenReadbacks(golden, false, std::cout))
+            {
+                glfwSetWindowShouldClose(window, GLFW_TRUE);
+            }
+        }
 
+        if (lightBenchmark.running)
+        {
+            glFinish();
+            double now = glfwGetTime();
+            if (!AdvanceLightBenchmark(lightBenchmark, now - lastFrameTime, static_cast<int>(lightList.lights.size()), std::cout))
+            {
+                glfwSetWindowShouldClose(window, GLFW_TRUE);
+            }
+            lastFrameTime = now;
+        }
 
+        // F9 writes the CPU trace recorded so far, without stopping the recording
+        bool cpuTraceKeyPressed = glfwGetKey(window, GLFW_KEY_F9) == GLFW_PRESS;
+        if (cpuTraceKeyPressed && !cpuTraceKeyDown && !cpuTracePath.empty())
+        {
+            long long zones = WriteCpuTrace(cpuTracePath);
+            if (zones >= 0)
+            {
+                std::cout << "CPU trace: " << zones << " zones written to " << cpuTracePath << std::endl;
+            }
+        }
+        cpuTraceKeyDown = cpuTraceKeyPressed;
 
+        // F3 shows or hides the render stats
+        bool statsKeyPressed = glfwGetKey(window, GLFW_KEY_F3) == GLFW_PRESS;
+        if (statsKeyPressed && !statsKeyDown && !offscreen)
+        {
+            statsOverlay.visible = !statsOverlay.visible;
+            MarkFrameDirty(framePacer);
+        }
+        statsKeyDown = statsKeyPressed;
 
-        // Tell GLFW to swap the screen buffer with the offscreen buffer
-        glfwSwapBuffers(window);
+        // F12 takes a screenshot of the next frame, Shift+F12 of the next kScreenshotBurstFrames
+        bool screenshotKeyPressed = glfwGetKey(window, GLFW_KEY_F12) == GLFW_PRESS;
+        if (screenshotKeyPressed && !screenshotKeyDown && !offscreen)
+        {
+            bool burst = glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_RIGHT_SHIFT) == GLFW_PRESS;
+            RequestScreenshots(screenshots, burst ? kScreenshotBurstFrames : 1);
+            MarkFrameDirty(framePacer);
+        }
+        screenshotKeyDown = screenshotKeyPressed;
 
         // Tell GLFW to process window events (e.g., input events, window closed events, etc.)
         glfwPollEvents();
@@ -1377,24 +1870,128 @@ int main()
 
     // Clean
 
+    if (recording)
+    {
+        uint64_t frames = inputRecorder.frames;
+        if (CloseInputRecorder(inputRecorder))
+        {
+            std::cout << "Input of " << frames << " frames recorded to " << recordPath << std::endl;
+        }
+        else
+        {
+            std::cerr << "Failed to write the input recording " << recordPath << std::endl;
+        }
+    }
+    DeleteLightList(lightList);
+    DeleteDrawQueue(drawQueue);
+    DeleteDrawQueue(shadowQueue);
+    DeleteDrawQueue(staticShadowQueue);
+    DeleteStaticShadowCache(staticShadows);
+    DeleteShadowTimer(shadowTimer);
+    DeleteShadowMap(shadowMap);
+    DeleteStatsOverlay(statsOverlay);
+    benchmark.textureSampling = DescribeTextureSampling(textureResidency);
+    benchmark.textureBytes = textureResidency.residentBytes;
+    benchmark.textureSource = DescribeTextureSource(textureResidency);
+    benchmark.textureLoadMilliseconds = textureResidency.loadMilliseconds;
+    benchmark.textureCompression = DescribeTextureCompression(textureResidency);
+    benchmark.textureUncompressedBytes = UncompressedTextureBytes(textureResidency);
+    benchmark.texturePsnr = textureResidency.lowestPsnr;
+    benchmark.textureEncodeMtexelsPerSecond = textureResidency.encodeMilliseconds > 0.0
+        ? textureResidency.encodedTexels / textureResidency.encodeMilliseconds / 1000.0 : 0.0;
+    ReportTextureResidency(textureResidency, std::cout);
+    for (TextureHandle texture : { cabinetTexture, woodTexture, bedTopTexture, tilesTexture, simsTexture, faceTopTexture, skyboxTexture })
+    {
+        ReleaseTexture(textureResidency, texture);
+    }
+    StopTextureResidency(textureResidency);
+    if (!offscreen)
+    {
+        StopScreenshotCapture(screenshots, std::cout);
+    }
+    FlushGpuProfiler(gpuProfiler);
+    if (benchmark.frame != 0)
+    {
+        if (WriteBenchmarkReport(benchmark, gpuProfiler))
+        {
+            std::cout << "Benchmark report written to " << benchmark.reportPath << std::endl;
+        }
+        else
+        {
+            std::cerr << "Failed to write the benchmark report to " << benchmark.reportPath << std::endl;
+        }
+    }
+    if (sequencing)
+    {
+        FinishFrameSequence(sequence, std::cout);
+    }
+    bool goldenFailed = false;
+    if (golden.running)
+    {
+        FinishGoldenReadbacks(golden, true, std::cout);
+        goldenFailed = golden.failures != 0 || golden.finishedPoses != golden.poses.size();
+        std::cout << "Golden images: " << golden.finishedPoses - golden.failures << " of " << golden.poses.size()
+            << (golden.update ? " references written" : " poses passed") << std::endl;
+        DeleteGoldenRun(golden);
+    }
+    if (offscreen)
+    {
+        DeleteOffscreenTarget(offscreenTarget);
+    }
+    if (!gpuTracePath.empty())
+    {
+        if (WriteGpuTrace(gpuProfiler, gpuTracePath))
+        {
+            std::cout << "GPU trace written to " << gpuTracePath << std::endl;
+        }
+        else
+        {
+            std::cerr << "Failed to write the GPU trace to " << gpuTracePath << std::endl;
+        }
+    }
+    DeleteGpuProfiler(gpuProfiler);
+    if (!cpuTracePath.empty())
+    {
+        long long zones = WriteCpuTrace(cpuTracePath);
+        if (zones >= 0)
+        {
+            std::cout << "CPU trace: " << zones << " zones written to " << cpuTracePath << std::endl;
+        }
+        else
+        {
+            std::cerr << "Failed to write the CPU trace to " << cpuTracePath << std::endl;
+        }
+    }
+
     glDeleteProgram(program);
+    glDeleteProgram(shadowCompositeShader);
 
-    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &positionVbo);
+    glDeleteBuffers(1, &attributeVbo);
+    glDeleteBuffers(1, &ebo);
 
     glDeleteVertexArrays(1, &vao);
 
     glfwTerminate();
 
-    return 0;
+    return goldenFailed ? 1 : 0;
 }
 
-GLuint CreateShaderProgram(const std::string& vertexShaderFilePath, const std::string& fragmentShaderFilePath)
+GLuint CreateShaderProgram(const std::string& vertexShaderFilePath, const std::string& fragmentShaderFilePath,
+    const std::string& geometryShaderFilePath)
 {
+    CPU_ZONE("CreateShaderProgram");
     GLuint vertexShader = CreateShaderFromFile(GL_VERTEX_SHADER, vertexShaderFilePath);
     GLuint fragmentShader = CreateShaderFromFile(GL_FRAGMENT_SHADER, fragmentShaderFilePath);
+    GLuint geometryShader = 0;
     GLuint program = glCreateProgram();
     glAttachShader(program, vertexShader);
     glAttachShader(program, fragmentShader);
+    if (!geometryShaderFilePath.empty())
+    {
+        geometryShader = CreateShaderFromFile(GL_GEOMETRY_SHADER, geometryShaderFilePath);
+        glAttachShader(program, geometryShader);
+    }
 
     glLinkProgram(program);
 
@@ -1402,6 +1999,11 @@ GLuint CreateShaderProgram(const std::string& vertexShaderFilePath, const std::s
     glDeleteShader(vertexShader);
     glDetachShader(program, fragmentShader);
     glDeleteShader(fragmentShader);
+    if (geometryShader != 0)
+    {
+        glDetachShader(program, geometryShader);
+        glDeleteShader(geometryShader);
+    }
 
     GLint linkStatus;
     glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
@@ -1416,23 +2018,46 @@ GLuint CreateShaderProgram(const std::string& vertexShaderFilePath, const std::s
 }
 
 GLuint CreateShaderFromFile(const GLuint& shaderType, const std::string& shaderFilePath)
+{
+    std::string shaderSource;
+    if (!ReadShaderSource(shaderFilePath, shaderSource))
+    {
+        return 0;
+    }
+
+    return CreateShaderFromSource(shaderType, shaderSource);
+}
+
+bool ReadShaderSource(const std::string& shaderFilePath, std::string& shaderSource)
 {
     std::ifstream shaderFile(shaderFilePath);
     if (shaderFile.fail())
     {
         std::cerr << "Unable to open shader file: " << shaderFilePath << std::endl;
-        return 0;
+        return false;
     }
 
-    std::string shaderSource;
+    const std::string includeDirective = "#include \"";
     std::string temp;
     while (std::getline(shaderFile, temp))
     {
-        shaderSource += temp + "\n";
+        if (temp.compare(0, includeDirective.size(), includeDirective) == 0)
+        {
+            size_t pathEnd = temp.find('"', includeDirective.size());
+            std::string includePath = temp.substr(includeDirective.size(), pathEnd - includeDirective.size());
+            if (!ReadShaderSource(includePath, shaderSource))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            shaderSource += temp + "\n";
+        }
     }
     shaderFile.close();
 
-    return CreateShaderFromSource(shaderType, shaderSource);
+    return true;
 }
 
 GLuint CreateShaderFromSource(const GLuint& shaderType, const std::string& shaderSource)
@@ -0,0 +1,19 @@
+// Decoding of the packed vertex streams (VertexFormat.h)
+
+// Positions are stored divided by this, must match kPositionRange in VertexFormat.h
+const float kPositionRange = 2.0;
+
+vec3 DecodePosition(vec3 quantized)
+{
+	return quantized * kPositionRange;
+}
+
+// Unfolds a normal stored with EncodeOctahedral in VertexFormat.h
+vec3 DecodeOctahedral(vec2 encoded)
+{
+	vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+	float fold = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -fold : fold;
+	n.y += n.y >= 0.0 ? -fold : fold;
+	return normalize(n);
+}